@@ -0,0 +1,150 @@
+/*
+ * creat-unlink-bench:
+ *
+ * Measure how fast threads can create and unlink files in one directory,
+ * which serializes them all on the directory's i_mutex:
+ *
+ * ./creat-unlink-bench [-t threads] [-s seconds] directory
+ *
+ * Each thread creates a file of its own name in the directory, closes
+ * and unlinks it, over and over.  The default is 4 threads for 10
+ * seconds.  It reports the creat/unlink pairs per second of each thread
+ * and in total; run it with 1 thread up to more threads than cpus, on a
+ * tmpfs to keep the disk out of it.
+ *
+ * With CONFIG_MUTEX_SPIN_STATS and debugfs mounted on /sys/kernel/debug,
+ * it also reports how the optimistic spinning on the mutexes went during
+ * the run, all mutexes in the system included.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define DEFAULT_THREADS		4
+#define DEFAULT_SECONDS		10
+#define SPIN_STATS		"/sys/kernel/debug/mutex_spin_stats"
+#define NR_SPIN_STATS		3
+
+struct worker {
+	pthread_t thread;
+	char name[4096];
+	unsigned long pairs;
+};
+
+static volatile int stop;
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the number of counters read, 0 if there are no statistics */
+static int read_spin_stats(char names[][32], unsigned long *values)
+{
+	FILE *f = fopen(SPIN_STATS, "r");
+	int nr = 0;
+
+	if (!f)
+		return 0;
+	while (nr < NR_SPIN_STATS &&
+	       fscanf(f, "%31s %lu", names[nr], &values[nr]) == 2)
+		nr++;
+	fclose(f);
+	return nr;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	int fd;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		fd = open(w->name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+		if (fd < 0) {
+			perror(w->name);
+			exit(2);
+		}
+		close(fd);
+		if (unlink(w->name)) {
+			perror(w->name);
+			exit(2);
+		}
+		w->pairs++;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_threads = DEFAULT_THREADS, seconds = DEFAULT_SECONDS;
+	char names[NR_SPIN_STATS][32];
+	unsigned long before[NR_SPIN_STATS], after[NR_SPIN_STATS];
+	unsigned long total = 0;
+	struct worker *workers;
+	double elapsed;
+	int opt, i, nr_stats;
+
+	while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || nr_threads <= 0 || seconds <= 0)
+		goto usage;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < nr_threads; i++)
+		snprintf(workers[i].name, sizeof(workers[i].name),
+			 "%s/creat-unlink-bench.%d.%d", argv[optind],
+			 getpid(), i);
+
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+	nr_stats = read_spin_stats(names, before);
+	pthread_barrier_wait(&barrier);
+	elapsed = now();
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = now() - elapsed;
+	if (nr_stats && read_spin_stats(names, after) != nr_stats)
+		nr_stats = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		total += workers[i].pairs;
+		printf("thread %d: %.0f creat/unlink/s\n", i,
+		       workers[i].pairs / elapsed);
+	}
+	printf("total: %.0f creat/unlink/s\n", total / elapsed);
+	for (i = 0; i < nr_stats; i++)
+		printf("%s: %lu\n", names[i], after[i] - before[i]);
+	return 0;
+usage:
+	fprintf(stderr, "usage: creat-unlink-bench [-t threads] [-s seconds] "
+		"directory\n");
+	exit(1);
+}
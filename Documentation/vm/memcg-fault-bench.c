@@ -0,0 +1,282 @@
+/*
+ * memcg-fault-bench:
+ *
+ * Measure page fault throughput of processes each in its own memory
+ * cgroup, at the bottom of a hierarchy several levels deep, so that every
+ * charge has to be accounted all the way up to the common ancestors:
+ *
+ * ./memcg-fault-bench [-p procs] [-d depth] [-s size_mb] [-t seconds]
+ *                     [-l leaf_limit_mb] [-f file] [-c memcg_mount]
+ *
+ * Each process maps its share of size_mb, faults it in a page at a time
+ * and unmaps it, over and over, until the time is up.  With -f, it maps
+ * its share of the file instead, and drops the file's pages from the page
+ * cache after each pass, so each fault charges a new page cache page; set
+ * a leaf limit below each process' share to have them reclaimed instead.
+ *
+ * The default is 4 processes, 4 levels deep, 64MB each for 10 seconds,
+ * with the memory controller mounted on /sys/fs/cgroup/memory.  Run it as
+ * root, with more processes than cpus too, and compare "faults/s" across
+ * kernels or against a depth of 1.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#define DEFAULT_PROCS		4
+#define DEFAULT_DEPTH		4
+#define DEFAULT_SIZE_MB		64UL
+#define DEFAULT_SECONDS		10
+#define DEFAULT_MEMCG		"/sys/fs/cgroup/memory"
+#define PAGE_SIZE_4K		4096UL
+#define MAX_DEPTH		16
+
+struct shared {
+	volatile int stop;
+	unsigned long faults[];
+};
+
+static struct shared *shared;
+static unsigned long chunk;
+static const char *file;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_file(const char *dir, const char *name, const char *value)
+{
+	char path[512];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f || fputs(value, f) == EOF || fclose(f) == EOF) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Count locally: the processes would bounce a shared cacheline otherwise */
+static void fault_anon(int id)
+{
+	unsigned long i, faults = 0;
+	char *mem;
+
+	while (!shared->stop) {
+		mem = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) {
+			perror("mmap");
+			exit(2);
+		}
+		for (i = 0; i < chunk && !shared->stop; i += PAGE_SIZE_4K) {
+			mem[i] = 1;
+			faults++;
+		}
+		munmap(mem, chunk);
+	}
+	shared->faults[id] = faults;
+}
+
+static void fault_file(int id)
+{
+	off_t offset = chunk * id;
+	unsigned long i, faults = 0;
+	volatile char *mem;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		perror(file);
+		exit(2);
+	}
+	mem = mmap(NULL, chunk, PROT_READ, MAP_SHARED, fd, offset);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+	while (!shared->stop) {
+		for (i = 0; i < chunk && !shared->stop; i += PAGE_SIZE_4K) {
+			(void)mem[i];
+			faults++;
+		}
+		madvise((void *)mem, chunk, MADV_DONTNEED);
+		posix_fadvise(fd, offset, chunk, POSIX_FADV_DONTNEED);
+	}
+	munmap((void *)mem, chunk);
+	close(fd);
+	shared->faults[id] = faults;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = DEFAULT_SIZE_MB << 20, limit = 0;
+	const char *mount = DEFAULT_MEMCG;
+	int nr_procs = DEFAULT_PROCS, depth = DEFAULT_DEPTH;
+	int seconds = DEFAULT_SECONDS;
+	char dirs[MAX_DEPTH][256], leaf[512], buf[64];
+	unsigned long total = 0;
+	int start[2], opt, i;
+	double elapsed;
+	pid_t *pids;
+
+	while ((opt = getopt(argc, argv, "p:d:s:t:l:f:c:")) != -1) {
+		switch (opt) {
+		case 'p':
+			nr_procs = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'l':
+			limit = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'c':
+			mount = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc || nr_procs <= 0 || depth <= 0 ||
+	    depth > MAX_DEPTH || seconds <= 0)
+		goto usage;
+	chunk = size / nr_procs & ~(PAGE_SIZE_4K - 1);
+	if (!chunk) {
+		fprintf(stderr, "size is too small for %d processes\n",
+			nr_procs);
+		exit(1);
+	}
+
+	shared = mmap(NULL, sizeof(*shared) + nr_procs * sizeof(long),
+		      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pids = calloc(nr_procs, sizeof(*pids));
+	if (shared == MAP_FAILED || !pids || pipe(start)) {
+		perror("memcg-fault-bench");
+		exit(1);
+	}
+
+	/*
+	 * depth - 1 levels shared by all, the last one is a leaf per
+	 * process; everything below the top one is hierarchical.
+	 */
+	snprintf(dirs[0], sizeof(dirs[0]), "%s/memcg-fault-bench.%d",
+		 mount, getpid());
+	for (i = 0; i < depth - 1; i++) {
+		if (i)
+			snprintf(dirs[i], sizeof(dirs[i]), "%s/%d",
+				 dirs[i - 1], i);
+		if (mkdir(dirs[i], 0755)) {
+			perror(dirs[i]);
+			goto out_rmdir;
+		}
+		if (!i && write_file(dirs[i], "memory.use_hierarchy", "1")) {
+			i++;
+			goto out_rmdir;
+		}
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		if (depth > 1)
+			snprintf(leaf, sizeof(leaf), "%s/p%d",
+				 dirs[depth - 2], i);
+		else
+			snprintf(leaf, sizeof(leaf), "%s.p%d", dirs[0], i);
+		if (mkdir(leaf, 0755) && errno != EEXIST) {
+			perror(leaf);
+			goto out_kill;
+		}
+		snprintf(buf, sizeof(buf), "%lu", limit);
+		if (limit && write_file(leaf, "memory.limit_in_bytes", buf))
+			goto out_kill;
+
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("fork");
+			goto out_kill;
+		}
+		if (!pids[i]) {
+			snprintf(buf, sizeof(buf), "%d", getpid());
+			if (write_file(leaf, "tasks", buf))
+				exit(1);
+			close(start[1]);
+			read(start[0], buf, 1);
+			if (file)
+				fault_file(i);
+			else
+				fault_anon(i);
+			exit(0);
+		}
+	}
+
+	/* Let them all go at once */
+	close(start[1]);
+	elapsed = now();
+	sleep(seconds);
+	shared->stop = 1;
+	for (i = 0; i < nr_procs; i++)
+		waitpid(pids[i], NULL, 0);
+	elapsed = now() - elapsed;
+
+	printf("%d processes, %d levels deep, %lu MB each, %s\n",
+	       nr_procs, depth, chunk >> 20, file ? "file" : "anon");
+	for (i = 0; i < nr_procs; i++) {
+		total += shared->faults[i];
+		printf("process %d: %.0f faults/s\n", i,
+		       shared->faults[i] / elapsed);
+	}
+	printf("total: %.0f faults/s\n", total / elapsed);
+	goto out_rmleaves;
+
+out_kill:
+	shared->stop = 1;
+	close(start[1]);
+	nr_procs = i + 1;	/* leaf i may be there, process i is not */
+	while (i-- > 0)
+		waitpid(pids[i], NULL, 0);
+out_rmleaves:
+	for (i = 0; i < nr_procs; i++) {
+		if (depth > 1)
+			snprintf(leaf, sizeof(leaf), "%s/p%d",
+				 dirs[depth - 2], i);
+		else
+			snprintf(leaf, sizeof(leaf), "%s.p%d", dirs[0], i);
+		rmdir(leaf);
+	}
+	i = depth - 1;
+out_rmdir:
+	while (i-- > 0)
+		rmdir(dirs[i]);
+	return 0;
+usage:
+	fprintf(stderr, "usage: memcg-fault-bench [-p procs] [-d depth] "
+		"[-s size_mb] [-t seconds] [-l leaf_limit_mb] [-f file] "
+		"[-c memcg_mount]\n");
+	exit(1);
+}
@@ -0,0 +1,187 @@
+/*
+ * mmap-sem-bench:
+ *
+ * Measure how one process' threads get along on its mmap_sem: some of
+ * them map an area, fault it in and unmap it, over and over, which takes
+ * mmap_sem for writing twice and for reading on every fault; the others
+ * fault in an area of their own and zap it with MADV_DONTNEED, over and
+ * over, which only ever takes it for reading:
+ *
+ * ./mmap-sem-bench [-m mappers] [-f faulters] [-s size_kb] [-t seconds]
+ *
+ * The default is 4 mappers and 4 faulters on 256kB areas, for 10 seconds.
+ * It reports mmap/munmap cycles and page faults per second, of each kind
+ * of thread and in total.  Run it with more threads than cpus too, and
+ * with only mappers, and compare the throughput across kernels.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define DEFAULT_MAPPERS		4
+#define DEFAULT_FAULTERS	4
+#define DEFAULT_SIZE_KB		256
+#define DEFAULT_SECONDS		10
+
+struct worker {
+	pthread_t thread;
+	unsigned long cycles;
+	unsigned long faults;
+};
+
+static size_t size;
+static long page_size;
+static volatile int stop;
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *map_area(void)
+{
+	char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+	return mem;
+}
+
+static unsigned long touch_area(char *mem)
+{
+	unsigned long i, faults = 0;
+
+	for (i = 0; i < size && !stop; i += page_size) {
+		mem[i] = 1;
+		faults++;
+	}
+	return faults;
+}
+
+static void *mapper(void *arg)
+{
+	struct worker *w = arg;
+	char *mem;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		mem = map_area();
+		w->faults += touch_area(mem);
+		munmap(mem, size);
+		w->cycles++;
+	}
+	return NULL;
+}
+
+static void *faulter(void *arg)
+{
+	struct worker *w = arg;
+	char *mem = map_area();
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		w->faults += touch_area(mem);
+		madvise(mem, size, MADV_DONTNEED);
+		w->cycles++;
+	}
+	munmap(mem, size);
+	return NULL;
+}
+
+static void report(const char *name, struct worker *w, int nr, double elapsed)
+{
+	unsigned long cycles = 0, faults = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		cycles += w[i].cycles;
+		faults += w[i].faults;
+	}
+	if (nr)
+		printf("%d %s: %.0f cycles/s, %.0f faults/s\n", nr, name,
+		       cycles / elapsed, faults / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_mappers = DEFAULT_MAPPERS, nr_faulters = DEFAULT_FAULTERS;
+	int seconds = DEFAULT_SECONDS;
+	struct worker *mappers, *faulters;
+	unsigned long faults = 0;
+	double elapsed;
+	int opt, i;
+
+	size = DEFAULT_SIZE_KB << 10;
+	while ((opt = getopt(argc, argv, "m:f:s:t:")) != -1) {
+		switch (opt) {
+		case 'm':
+			nr_mappers = atoi(optarg);
+			break;
+		case 'f':
+			nr_faulters = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	page_size = sysconf(_SC_PAGESIZE);
+	if (optind != argc || nr_mappers < 0 || nr_faulters < 0 ||
+	    nr_mappers + nr_faulters == 0 || size < (size_t)page_size ||
+	    seconds <= 0)
+		goto usage;
+
+	mappers = calloc(nr_mappers + 1, sizeof(*mappers));
+	faulters = calloc(nr_faulters + 1, sizeof(*faulters));
+	if (!mappers || !faulters) {
+		perror("calloc");
+		exit(1);
+	}
+
+	pthread_barrier_init(&barrier, NULL, nr_mappers + nr_faulters + 1);
+	for (i = 0; i < nr_mappers; i++)
+		pthread_create(&mappers[i].thread, NULL, mapper, &mappers[i]);
+	for (i = 0; i < nr_faulters; i++)
+		pthread_create(&faulters[i].thread, NULL, faulter, &faulters[i]);
+	pthread_barrier_wait(&barrier);
+	elapsed = now();
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_mappers; i++)
+		pthread_join(mappers[i].thread, NULL);
+	for (i = 0; i < nr_faulters; i++)
+		pthread_join(faulters[i].thread, NULL);
+	elapsed = now() - elapsed;
+
+	printf("%zu kB areas, %d seconds\n", size >> 10, seconds);
+	report("mappers", mappers, nr_mappers, elapsed);
+	report("faulters", faulters, nr_faulters, elapsed);
+	for (i = 0; i < nr_mappers; i++)
+		faults += mappers[i].faults;
+	for (i = 0; i < nr_faulters; i++)
+		faults += faulters[i].faults;
+	printf("total: %.0f faults/s\n", faults / elapsed);
+	return 0;
+usage:
+	fprintf(stderr, "usage: mmap-sem-bench [-m mappers] [-f faulters] "
+		"[-s size_kb] [-t seconds]\n");
+	exit(1);
+}
@@ -0,0 +1,199 @@
+/*
+ * readahead-bench:
+ *
+ * Measure sequential read throughput with several streams reading one file
+ * at once, each through its own file descriptor (so with its own readahead
+ * state), like fio's numjobs with offset_increment:
+ *
+ * ./readahead-bench [-s streams] [-r read_kb] [-b bdi_dir] file
+ *
+ * Stream n reads the n'th of "streams" equal parts of the file from start
+ * to end, read_kb at a time.  The file's pages are dropped from the page
+ * cache before each run, so it need not be larger than memory; but make it
+ * a few hundred MB per stream for the windows to matter.  The default is 4
+ * streams of 16kB reads.
+ *
+ * With -b /sys/class/bdi/MAJOR:MINOR, the bdi of the device holding the
+ * file, it runs once with read_ahead_adaptive off and once with it on,
+ * then restores the setting: run it as root.  Try 1 stream and many, on
+ * a fast SSD and on a rotating disk.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEFAULT_STREAMS		4
+#define DEFAULT_READ_KB		16
+
+static const char *path;
+static off_t part;
+static size_t read_size;
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_file(const char *name, char *buf, size_t len)
+{
+	FILE *f = fopen(name, "r");
+
+	if (!f || !fgets(buf, len, f)) {
+		perror(name);
+		if (f)
+			fclose(f);
+		return -1;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static int write_file(const char *name, const char *value)
+{
+	FILE *f = fopen(name, "w");
+
+	if (!f || fputs(value, f) == EOF || fclose(f) == EOF) {
+		perror(name);
+		return -1;
+	}
+	return 0;
+}
+
+static void *stream(void *arg)
+{
+	off_t pos = part * (unsigned long)arg;
+	off_t end = pos + part;
+	char *buf;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	buf = malloc(read_size);
+	if (fd < 0 || !buf) {
+		perror(path);
+		exit(2);
+	}
+
+	pthread_barrier_wait(&barrier);
+	while (pos < end) {
+		ret = pread(fd, buf, read_size, pos);
+		if (ret <= 0) {
+			perror("pread");
+			exit(2);
+		}
+		pos += ret;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static double run(int nr_streams)
+{
+	pthread_t *threads;
+	double start;
+	unsigned long i;
+	int fd;
+
+	/* Start cold: write back anything dirty, then drop it all */
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	threads = calloc(nr_streams, sizeof(*threads));
+	pthread_barrier_init(&barrier, NULL, nr_streams + 1);
+	for (i = 0; i < nr_streams; i++)
+		pthread_create(&threads[i], NULL, stream, (void *)i);
+	pthread_barrier_wait(&barrier);
+	start = now();
+	for (i = 0; i < nr_streams; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+
+	return (double)part * nr_streams / (1 << 20) / (now() - start);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_streams = DEFAULT_STREAMS;
+	const char *bdi = NULL;
+	char knob[256], saved[16];
+	struct stat st;
+	int opt;
+
+	read_size = DEFAULT_READ_KB << 10;
+	while ((opt = getopt(argc, argv, "s:r:b:")) != -1) {
+		switch (opt) {
+		case 's':
+			nr_streams = atoi(optarg);
+			break;
+		case 'r':
+			read_size = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'b':
+			bdi = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || nr_streams <= 0 || !read_size)
+		goto usage;
+	path = argv[optind];
+	if (stat(path, &st)) {
+		perror(path);
+		exit(1);
+	}
+	part = st.st_size / nr_streams;
+	part -= part % read_size;
+	if (!part) {
+		fprintf(stderr, "%s is too small for %d streams\n",
+			path, nr_streams);
+		exit(1);
+	}
+
+	printf("%d streams of %lu MB, %zu kB reads\n",
+	       nr_streams, (unsigned long)(part >> 20), read_size >> 10);
+	if (!bdi) {
+		printf("read: %.1f MB/s\n", run(nr_streams));
+		return 0;
+	}
+
+	snprintf(knob, sizeof(knob), "%s/read_ahead_adaptive", bdi);
+	if (read_file(knob, saved, sizeof(saved)))
+		exit(1);
+	if (write_file(knob, "0"))
+		exit(1);
+	printf("read_ahead_adaptive=0: %.1f MB/s\n", run(nr_streams));
+	if (write_file(knob, "1"))
+		exit(1);
+	/* one run to let the bdi measure the device, then the real one */
+	run(nr_streams);
+	printf("read_ahead_adaptive=1: %.1f MB/s\n", run(nr_streams));
+	write_file(knob, saved);
+	return 0;
+usage:
+	fprintf(stderr, "usage: readahead-bench [-s streams] [-r read_kb] "
+		"[-b /sys/class/bdi/MAJOR:MINOR] file\n");
+	exit(1);
+}
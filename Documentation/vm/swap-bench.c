@@ -0,0 +1,205 @@
+/*
+ * swap-bench:
+ *
+ * Measure swapout and swapin throughput with several threads touching
+ * anonymous memory in a memory cgroup limited well below their total, so
+ * that every pass over the memory has to go through swap:
+ *
+ * ./swap-bench [-t threads] [-l limit_mb] [-c memcg_mount] size_mb
+ *
+ * Each thread writes its share of size_mb (swapping out the rest of it),
+ * then reads it all back (swapping it in), and checks what it reads.  The
+ * default is 4 threads in a 256MB cgroup, with the memory controller
+ * mounted on /sys/fs/cgroup/memory.  Run it as root, with enough swap
+ * for size_mb, and compare "pswpout"/"pswpin" MB/s across kernels or
+ * with a single thread to see how swap allocation scales.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define DEFAULT_THREADS		4
+#define DEFAULT_LIMIT_MB	256UL
+#define DEFAULT_MEMCG		"/sys/fs/cgroup/memory"
+#define PAGE_SIZE_4K		4096UL
+
+static unsigned long chunk;
+static pthread_barrier_t barrier;
+static double phase_start[2], phase_end[2];
+static int failed;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long vmstat(const char *name)
+{
+	char line[128];
+	size_t len = strlen(name);
+	long value = -1;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, name, len) && line[len] == ' ') {
+			value = atol(line + len + 1);
+			break;
+		}
+	}
+	fclose(f);
+	return value;
+}
+
+static int write_file(const char *dir, const char *name, const char *value)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f || fputs(value, f) == EOF || fclose(f) == EOF) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Both phases are timed from the first thread in to the last one out */
+static void phase(int n, int end)
+{
+	int ret = pthread_barrier_wait(&barrier);
+
+	if (ret == PTHREAD_BARRIER_SERIAL_THREAD) {
+		if (end)
+			phase_end[n] = now();
+		else
+			phase_start[n] = now();
+	}
+}
+
+static void *worker(void *arg)
+{
+	unsigned long id = (unsigned long)arg;
+	unsigned long i;
+	char *mem;
+
+	mem = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+
+	phase(0, 0);
+	for (i = 0; i < chunk; i += PAGE_SIZE_4K)
+		*(unsigned long *)(mem + i) = i ^ id;
+	phase(0, 1);
+
+	phase(1, 0);
+	for (i = 0; i < chunk; i += PAGE_SIZE_4K)
+		if (*(unsigned long *)(mem + i) != (i ^ id))
+			failed = 1;
+	phase(1, 1);
+
+	munmap(mem, chunk);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long limit = DEFAULT_LIMIT_MB << 20;
+	const char *mount = DEFAULT_MEMCG;
+	int nr_threads = DEFAULT_THREADS;
+	unsigned long size, i;
+	long out[2], in[2];
+	char memcg[256], buf[64];
+	pthread_t *threads;
+	double elapsed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:l:c:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'l':
+			limit = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'c':
+			mount = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || nr_threads <= 0)
+		goto usage;
+	size = strtoul(argv[optind], NULL, 0) << 20;
+	chunk = size / nr_threads & ~(PAGE_SIZE_4K - 1);
+	if (!chunk || size <= limit) {
+		fprintf(stderr, "size must exceed the limit of %lu MB\n",
+			limit >> 20);
+		exit(1);
+	}
+
+	snprintf(memcg, sizeof(memcg), "%s/swap-bench.%d", mount, getpid());
+	if (mkdir(memcg, 0755) && errno != EEXIST) {
+		perror(memcg);
+		exit(1);
+	}
+	snprintf(buf, sizeof(buf), "%lu", limit);
+	if (write_file(memcg, "memory.limit_in_bytes", buf))
+		goto out_rmdir;
+	snprintf(buf, sizeof(buf), "%d", getpid());
+	if (write_file(memcg, "tasks", buf))
+		goto out_rmdir;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	pthread_barrier_init(&barrier, NULL, nr_threads);
+	out[0] = vmstat("pswpout");
+	in[0] = vmstat("pswpin");
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	out[1] = vmstat("pswpout");
+	in[1] = vmstat("pswpin");
+
+	printf("%d threads, %lu MB in a %lu MB memcg\n",
+	       nr_threads, size >> 20, limit >> 20);
+	elapsed = phase_end[0] - phase_start[0];
+	printf("write: %.3f s, %.1f MB/s, pswpout %.1f MB/s\n", elapsed,
+	       (size >> 20) / elapsed,
+	       (out[1] - out[0]) * (PAGE_SIZE_4K >> 10) / 1024.0 / elapsed);
+	elapsed = phase_end[1] - phase_start[1];
+	printf("read:  %.3f s, %.1f MB/s, pswpin %.1f MB/s\n", elapsed,
+	       (size >> 20) / elapsed,
+	       (in[1] - in[0]) * (PAGE_SIZE_4K >> 10) / 1024.0 / elapsed);
+	if (failed)
+		printf("read back the wrong data!\n");
+
+	/* Leave the memcg, so that it can be removed */
+	snprintf(buf, sizeof(buf), "%d", getpid());
+	write_file(mount, "tasks", buf);
+out_rmdir:
+	rmdir(memcg);
+	return failed;
+usage:
+	fprintf(stderr, "usage: swap-bench [-t threads] [-l limit_mb] "
+		"[-c memcg_mount] size_mb\n");
+	exit(1);
+}
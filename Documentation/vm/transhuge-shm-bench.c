@@ -0,0 +1,264 @@
+/*
+ * transhuge-shm-bench:
+ *
+ * Measure random reads over a large Sys V shared memory segment, and the
+ * page faults and dTLB load misses they take, to compare tmpfs huge pages
+ * against regular pages.  The segment is 64GB unless another size in MB is
+ * given, and 2^26 reads are done unless another count is given:
+ *
+ * ./transhuge-shm-bench [size_mb [reads]]
+ *
+ * Run it once with
+ *
+ * echo never > /sys/kernel/mm/transparent_hugepage/shmem_enabled
+ *
+ * and once with "always" (or "advise": the segment is madvised with
+ * MADV_HUGEPAGE) to see the difference.  The thp_file_mapped count shows
+ * how many 2MB extents were mapped with a huge pmd.
+ *
+ * With -f, the random reads go to a read-only shared mapping of an
+ * existing file instead, which is not populated beforehand:
+ *
+ * ./transhuge-shm-bench -f FILE [reads]
+ *
+ * Drop the page cache (echo 3 > /proc/sys/vm/drop_caches) and compare
+ * /sys/kernel/mm/transparent_hugepage/enabled set to "never" and to
+ * "always" (or "madvise") for page cache huge pages.
+ *
+ * Note: the shared memory limits must allow a segment that large, e.g.
+ *
+ * echo 68719476736 > /proc/sys/kernel/shmmax
+ * echo 16777216 > /proc/sys/kernel/shmall
+ *
+ * and the dTLB counter needs /proc/sys/kernel/perf_event_paranoid <= 1
+ * or root; without it only the time is reported.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+#define DEFAULT_SIZE_MB		(64UL * 1024)
+#define DEFAULT_READS		(1UL << 26)
+#define PAGE_SIZE_4K		4096UL
+
+static int dtlb_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long vmstat(const char *name)
+{
+	char line[128];
+	size_t len = strlen(name);
+	long value = -1;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, name, len) && line[len] == ' ') {
+			value = atol(line + len + 1);
+			break;
+		}
+	}
+	fclose(f);
+	return value;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void faults(long *minflt, long *majflt)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	*minflt = ru.ru_minflt;
+	*majflt = ru.ru_majflt;
+}
+
+static char *map_file(const char *path, unsigned long *size)
+{
+	struct stat st;
+	char *addr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		exit(1);
+	}
+	*size = st.st_size;
+	addr = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		exit(2);
+	}
+	close(fd);
+	return addr;
+}
+
+static char *map_shm(unsigned long size)
+{
+	char *shmaddr;
+	int shmid;
+
+	shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | SHM_R | SHM_W);
+	if (shmid < 0) {
+		perror("shmget");
+		exit(1);
+	}
+	shmaddr = shmat(shmid, NULL, 0);
+	/* the segment goes away with the last detach */
+	shmctl(shmid, IPC_RMID, NULL);
+	if (shmaddr == (char *)-1) {
+		perror("Shared memory attach failure");
+		exit(2);
+	}
+	return shmaddr;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = DEFAULT_SIZE_MB << 20;
+	unsigned long reads = DEFAULT_READS;
+	unsigned long i, npages;
+	uint64_t misses = 0, seed = 88172645463325252ULL;
+	long mapped, minflt, majflt, minflt2, majflt2;
+	volatile unsigned long sum = 0;
+	double start, elapsed;
+	const char *path = NULL;
+	char *shmaddr;
+	int fd;
+
+	if (argc > 2 && !strcmp(argv[1], "-f")) {
+		path = argv[2];
+		argc -= 2;
+		argv += 2;
+		if (argc > 1)
+			reads = strtoul(argv[1], NULL, 0);
+	} else {
+		if (argc > 1)
+			size = strtoul(argv[1], NULL, 0) << 20;
+		if (argc > 2)
+			reads = strtoul(argv[2], NULL, 0);
+	}
+
+	if (path)
+		shmaddr = map_file(path, &size);
+	else if (size)
+		shmaddr = map_shm(size);
+	npages = size / PAGE_SIZE_4K;
+	if (!npages || !reads) {
+		fprintf(stderr, "usage: transhuge-shm-bench [size_mb [reads]]\n"
+			"       transhuge-shm-bench -f FILE [reads]\n");
+		exit(1);
+	}
+
+	if (madvise(shmaddr, size, MADV_HUGEPAGE))
+		perror("madvise(MADV_HUGEPAGE)");
+	printf("%s: %p (%s2MB aligned), %lu MB\n", path ? path : "shm",
+	       shmaddr,
+	       ((unsigned long)shmaddr & ((2UL << 20) - 1)) ? "not " : "",
+	       size >> 20);
+
+	mapped = vmstat("thp_file_mapped");
+	if (!path) {
+		faults(&minflt, &majflt);
+		start = now();
+		for (i = 0; i < npages; i++)
+			shmaddr[i * PAGE_SIZE_4K] = (char)i;
+		elapsed = now() - start;
+		faults(&minflt2, &majflt2);
+		printf("populate: %.3f s, %ld faults", elapsed,
+		       minflt2 - minflt + majflt2 - majflt);
+		if (mapped >= 0)
+			printf(", thp_file_mapped +%ld",
+			       vmstat("thp_file_mapped") - mapped);
+		printf("\n");
+		mapped = vmstat("thp_file_mapped");
+	}
+
+	fd = dtlb_open();
+	if (fd < 0)
+		perror("perf_event_open(dTLB-load-misses)");
+
+	faults(&minflt, &majflt);
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = now();
+	for (i = 0; i < reads; i++) {
+		/* xorshift64: cheap enough not to hide the misses */
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		sum += shmaddr[(seed % npages) * PAGE_SIZE_4K +
+			       (seed >> 52) % PAGE_SIZE_4K];
+	}
+	elapsed = now() - start;
+	faults(&minflt2, &majflt2);
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+		close(fd);
+	}
+
+	printf("random reads: %lu in %.3f s, %.1f ns/read\n",
+	       reads, elapsed, elapsed * 1e9 / reads);
+	printf("faults: %ld minor, %ld major", minflt2 - minflt,
+	       majflt2 - majflt);
+	if (mapped >= 0)
+		printf(", thp_file_mapped +%ld",
+		       vmstat("thp_file_mapped") - mapped);
+	printf("\n");
+	if (fd >= 0)
+		printf("dTLB-load-misses: %llu, %.3f per read\n",
+		       (unsigned long long)misses, (double)misses / reads);
+
+	if (path)
+		munmap(shmaddr, size);
+	else if (shmdt(shmaddr) != 0) {
+		perror("Detach failure");
+		exit(3);
+	}
+	return 0;
+}
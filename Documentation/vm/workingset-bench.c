@@ -0,0 +1,225 @@
+/*
+ * workingset-bench:
+ *
+ * Measure how well a hot set of page cache survives a large streaming
+ * read: one thread keeps reading a hot file at random, while another
+ * reads a stream file sequentially, over and over:
+ *
+ * ./workingset-bench [-t seconds] [-r read_kb] hotfile streamfile
+ *
+ * Make the hot file fit comfortably in memory, a third of it or so, and
+ * the stream file larger than memory.  The files' pages are dropped from
+ * the page cache first, then the hot file is read twice, to get it onto
+ * the active list, before the clock starts.  The default is 30 seconds of
+ * 4kB reads on both.
+ *
+ * It reports the throughput of both readers, how much of the hot file is
+ * still in the page cache at the end, and how much the workingset_refault
+ * and workingset_activate counters of /proc/vmstat went up meanwhile.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define DEFAULT_SECONDS		30
+#define DEFAULT_READ_KB		4
+
+struct reader {
+	const char *path;
+	int fd;
+	off_t size;
+	int random;
+	unsigned long long bytes;
+};
+
+static size_t read_size;
+static volatile int stop;
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long vmstat(const char *name)
+{
+	char line[128];
+	size_t len = strlen(name);
+	unsigned long value = 0;
+	FILE *f = fopen("/proc/vmstat", "r");
+
+	if (!f) {
+		perror("/proc/vmstat");
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, name, len) && line[len] == ' ') {
+			value = strtoul(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+	return value;
+}
+
+static void open_reader(struct reader *r)
+{
+	struct stat st;
+
+	r->fd = open(r->path, O_RDONLY);
+	if (r->fd < 0 || fstat(r->fd, &st)) {
+		perror(r->path);
+		exit(1);
+	}
+	r->size = st.st_size - st.st_size % read_size;
+	if (!r->size) {
+		fprintf(stderr, "%s is smaller than a read\n", r->path);
+		exit(1);
+	}
+	fdatasync(r->fd);
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static void read_at(struct reader *r, char *buf, off_t pos)
+{
+	if (pread(r->fd, buf, read_size, pos) <= 0) {
+		perror("pread");
+		exit(2);
+	}
+}
+
+static void *reader(void *arg)
+{
+	struct reader *r = arg;
+	unsigned long nr_reads = r->size / read_size;
+	unsigned int seed = r->fd;
+	off_t pos = 0;
+	char *buf;
+
+	buf = malloc(read_size);
+	if (!buf) {
+		perror("malloc");
+		exit(2);
+	}
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		if (r->random) {
+			pos = (off_t)(rand_r(&seed) % nr_reads) * read_size;
+		} else if (pos >= r->size) {
+			pos = 0;
+		}
+		read_at(r, buf, pos);
+		r->bytes += read_size;
+		pos += read_size;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* Percentage of the file's pages which are in the page cache */
+static double resident(struct reader *r)
+{
+	unsigned long pages, i, nr = 0;
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned char *vec;
+	void *map;
+
+	pages = (r->size + page_size - 1) / page_size;
+	map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+	vec = malloc(pages);
+	if (map == MAP_FAILED || !vec || mincore(map, r->size, vec)) {
+		perror("mincore");
+		exit(1);
+	}
+	for (i = 0; i < pages; i++)
+		nr += vec[i] & 1;
+	munmap(map, r->size);
+	free(vec);
+	return 100.0 * nr / pages;
+}
+
+int main(int argc, char **argv)
+{
+	struct reader hot = { .random = 1 }, stream = { .random = 0 };
+	unsigned long refault, activate;
+	int seconds = DEFAULT_SECONDS;
+	pthread_t threads[2];
+	double elapsed;
+	off_t pos;
+	char *buf;
+	int opt, i;
+
+	read_size = DEFAULT_READ_KB << 10;
+	while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			read_size = strtoul(optarg, NULL, 0) << 10;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 2 || seconds <= 0 || !read_size)
+		goto usage;
+	hot.path = argv[optind];
+	stream.path = argv[optind + 1];
+	open_reader(&hot);
+	open_reader(&stream);
+
+	/* Twice through the hot file, to get it activated */
+	buf = malloc(read_size);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < 2; i++)
+		for (pos = 0; pos < hot.size; pos += read_size)
+			read_at(&hot, buf, pos);
+	free(buf);
+
+	refault = vmstat("workingset_refault");
+	activate = vmstat("workingset_activate");
+	pthread_barrier_init(&barrier, NULL, 3);
+	pthread_create(&threads[0], NULL, reader, &hot);
+	pthread_create(&threads[1], NULL, reader, &stream);
+	pthread_barrier_wait(&barrier);
+	elapsed = now();
+	sleep(seconds);
+	stop = 1;
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+	elapsed = now() - elapsed;
+	refault = vmstat("workingset_refault") - refault;
+	activate = vmstat("workingset_activate") - activate;
+
+	printf("hot: %lu MB, %.1f MB/s, %.1f%% resident\n",
+	       (unsigned long)(hot.size >> 20),
+	       hot.bytes / elapsed / (1 << 20), resident(&hot));
+	printf("stream: %lu MB, %.1f MB/s\n",
+	       (unsigned long)(stream.size >> 20),
+	       stream.bytes / elapsed / (1 << 20));
+	printf("workingset_refault: %lu\n", refault);
+	printf("workingset_activate: %lu\n", activate);
+	return 0;
+usage:
+	fprintf(stderr, "usage: workingset-bench [-t seconds] [-r read_kb] "
+		"hotfile streamfile\n");
+	exit(1);
+}
@@ -0,0 +1,18 @@
+#ifndef _ASM_X86_QSPINLOCK_H
+#define _ASM_X86_QSPINLOCK_H
+
+#include <asm-generic/qspinlock_types.h>
+
+/*
+ * Only the lock holder ever writes the locked byte while it is set, so
+ * a plain byte store drops the lock, no locked instruction needed.
+ */
+#define	queued_spin_unlock queued_spin_unlock
+static __always_inline void queued_spin_unlock(struct qspinlock *lock)
+{
+	smp_store_release((u8 *)lock, 0);
+}
+
+#include <asm-generic/qspinlock.h>
+
+#endif /* _ASM_X86_QSPINLOCK_H */
@@ -1840,6 +1840,9 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 		part = req->part;
 		part_stat_add(cpu, part, sectors[rw], bytes >> 9);
 		part_stat_unlock();
+
+		if (rw == READ)
+			bdi_account_read(&req->q->backing_dev_info, bytes);
 	}
 }
 
@@ -1866,6 +1869,10 @@ static void blk_account_io_done(struct request *req)
 
 		hd_struct_put(part);
 		part_stat_unlock();
+
+		if (rw == READ)
+			bdi_account_read_done(&req->q->backing_dev_info,
+					      duration);
 	}
 }
 
@@ -0,0 +1,188 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+
+#include "zram_comp.h"
+
+/* Compressors offered through the comp_algorithm sysfs node */
+static const char * const backends[] = {
+	"lzo",
+	"deflate",
+	NULL
+};
+
+bool zcomp_available(const char *name)
+{
+	return crypto_has_comp(name, 0, 0);
+}
+
+/* Lists the compressors this kernel has, with the current one in [] */
+ssize_t zcomp_available_show(const char *cur, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!zcomp_available(backends[i]))
+			continue;
+		if (!strcmp(cur, backends[i]))
+			sz += sprintf(buf + sz, "[%s] ", backends[i]);
+		else
+			sz += sprintf(buf + sz, "%s ", backends[i]);
+	}
+	if (sz)
+		sz--;
+	sz += sprintf(buf + sz, "\n");
+	return sz;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (zstrm->tfm)
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zcomp_strm *zcomp_strm_alloc(const char *name)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(name, 0, 0);
+	if (IS_ERR(zstrm->tfm)) {
+		zstrm->tfm = NULL;
+		goto fail;
+	}
+
+	/*
+	 * Allocate two pages: compressing an incompressible page can
+	 * produce more than PAGE_SIZE bytes before we give up on it.
+	 */
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zstrm->buffer)
+		goto fail;
+
+	return zstrm;
+
+fail:
+	zcomp_strm_free(zstrm);
+	return NULL;
+}
+
+/*
+ * All the streams are allocated up front: allocating one when a write
+ * finds them all busy could recurse into reclaim, and from there into
+ * swap to this very device.
+ */
+struct zcomp *zcomp_create(const char *name, int max_strm)
+{
+	struct zcomp_strm *zstrm;
+	struct zcomp *comp;
+	int i;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+
+	for (i = 0; i < max_strm; i++) {
+		zstrm = zcomp_strm_alloc(name);
+		if (!zstrm) {
+			zcomp_destroy(comp);
+			return NULL;
+		}
+		list_add(&zstrm->list, &comp->idle_strm);
+	}
+
+	return comp;
+}
+
+/* Called when no request can be using the streams any more */
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				   struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	kfree(comp);
+}
+
+/* Get an idle stream, sleeping until one is released if there is none */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	for (;;) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					   struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	list_add(&zstrm->list, &comp->idle_strm);
+	spin_unlock(&comp->strm_lock);
+	wake_up(&comp->strm_wait);
+}
+
+/* Compress one page from src into zstrm->buffer */
+int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+		   size_t *dst_len)
+{
+	unsigned int len = 2 * PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+				   zstrm->buffer, &len);
+	*dst_len = len;
+	return ret;
+}
+
+/* Decompress src_len bytes from src into the page at dst */
+int zcomp_decompress(struct zcomp_strm *zstrm, const unsigned char *src,
+		     size_t src_len, unsigned char *dst)
+{
+	unsigned int len = PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_decompress(zstrm->tfm, src, src_len, dst, &len);
+	if (!ret && len != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
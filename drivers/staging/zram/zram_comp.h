@@ -0,0 +1,58 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#define ZRAM_DEFAULT_COMPRESSOR	"lzo"
+
+/*
+ * A compression stream: a crypto API compressor instance, which keeps its
+ * working memory in the tfm, and a buffer for its output.  A stream is
+ * used by one request at a time; each device keeps a pool of them so
+ * that writes can compress in parallel.
+ */
+struct zcomp_strm {
+	struct crypto_comp *tfm;
+	void *buffer;		/* compressed output: two pages */
+	struct list_head list;
+};
+
+struct zcomp {
+	spinlock_t strm_lock;	/* protects idle_strm */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+};
+
+extern struct zcomp *zcomp_create(const char *name, int max_strm);
+extern void zcomp_destroy(struct zcomp *comp);
+
+extern struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+extern void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+extern int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+			  size_t *dst_len);
+extern int zcomp_decompress(struct zcomp_strm *zstrm,
+			    const unsigned char *src, size_t src_len,
+			    unsigned char *dst);
+
+extern bool zcomp_available(const char *name);
+extern ssize_t zcomp_available_show(const char *cur, char *buf);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/jhash.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+void zram_dedup_init(struct zram *zram)
+{
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
+}
+
+u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+/*
+ * Checksums can collide: decompress the entry's object into the stream's
+ * buffer, and compare.  Decompressing is still cheaper than compressing.
+ */
+static bool zram_dedup_match(struct zram *zram, struct zcomp_strm *zstrm,
+			     struct zram_entry *entry, unsigned char *mem)
+{
+	unsigned char *cmem;
+	int ret;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = zcomp_decompress(zstrm, cmem + sizeof(struct zobj_header),
+			       entry->len, zstrm->buffer);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return !ret && !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+}
+
+/*
+ * Look for an object holding the same page as mem, which has the given
+ * checksum.  Returns its entry with a reference held for the caller, or
+ * NULL.  Clobbers zstrm->buffer.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram,
+				struct zcomp_strm *zstrm, unsigned char *mem,
+				u32 checksum)
+{
+	struct rb_node *rb_node;
+	struct zram_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+	rb_node = zram->dedup_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+
+			if (zram_dedup_match(zram, zstrm, entry, mem))
+				return entry;
+			zram_dedup_put(zram, entry);
+			return NULL;
+		}
+		if (checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/*
+ * Make an entry, with one reference, for a newly stored object.  Entries
+ * with the same checksum may coexist: find only ever looks at one.
+ */
+struct zram_entry *zram_dedup_insert(struct zram *zram,
+				unsigned long handle, u32 len, u32 checksum)
+{
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry, *this;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->refcount = 1;
+	entry->handle = handle;
+
+	spin_lock(&zram->dedup_lock);
+	rb_node = &zram->dedup_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		this = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < this->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &zram->dedup_root);
+	zram->stats.dedup_entries++;
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference to the entry, freeing it and its object with the last.
+ * Returns true if other references remain, i.e. the caller's was one of
+ * the duplicates.
+ */
+bool zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return true;
+	}
+	rb_erase(&entry->rb_node, &zram->dedup_root);
+	zram->stats.dedup_entries--;
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+	return false;
+}
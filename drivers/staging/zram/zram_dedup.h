@@ -0,0 +1,48 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/types.h>
+
+struct zram;
+struct zcomp_strm;
+
+/*
+ * With deduplication enabled, each compressed object is described by an
+ * entry, and the table points to the entry rather than to the object:
+ * pages with identical contents share one entry, and so one object.
+ * Entries are kept in an rbtree ordered by the checksum of the
+ * uncompressed page.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 checksum;
+	u32 len;		/* compressed size */
+	unsigned long refcount;	/* table entries using it: dedup_lock */
+	unsigned long handle;	/* zsmalloc handle of the object */
+};
+
+extern void zram_dedup_init(struct zram *zram);
+extern u32 zram_dedup_checksum(unsigned char *mem);
+extern struct zram_entry *zram_dedup_find(struct zram *zram,
+				struct zcomp_strm *zstrm, unsigned char *mem,
+				u32 checksum);
+extern struct zram_entry *zram_dedup_insert(struct zram *zram,
+				unsigned long handle, u32 len, u32 checksum);
+extern bool zram_dedup_put(struct zram *zram, struct zram_entry *entry);
+
+#endif
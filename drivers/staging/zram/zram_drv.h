@@ -18,7 +18,9 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zram_comp.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -51,8 +53,8 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -71,18 +73,23 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is one word repeated: zero, or some other pattern */
+	ZRAM_SAME,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * Allocated for each disk page.  handle is a zsmalloc handle (or the
+ * struct zram_entry of the object, with use_dedup), the struct page
+ * itself for a ZRAM_UNCOMPRESSED page, or the repeated word of a
+ * ZRAM_SAME page.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;
+	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -96,19 +103,27 @@ struct zram_stats {
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of same filled pages, zero included */
+	u32 pages_dup;		/* no. of pages sharing another's object */
+	u32 dedup_entries;	/* no. of struct zram_entry allocated */
+	u64 dup_data_size;	/* compressed size of those not stored */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 comp_pages;		/* no. of pages compressed */
+	u64 comp_nsecs;		/* time spent compressing them */
+	u64 decomp_pages;	/* no. of pages decompressed */
+	u64 decomp_nsecs;	/* time spent decompressing them */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zcomp *comp;	/* pool of compression streams */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent read
+				   * and writes: compression is done outside
+				   * it, in one of the comp streams */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +134,13 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Compressor, number of comp streams, and dedup, set before init */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	int max_comp_streams;
+	/* Share one object between pages with the same contents */
+	bool use_dedup;
+	spinlock_t dedup_lock;	/* protects dedup_root and refcounts */
+	struct rb_root dedup_root;
 
 	struct zram_stats stats;
 };
@@ -0,0 +1,783 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * zsmalloc is a slab-like allocator for compressed pages.  Unlike xvmalloc
+ * it never needs a higher order allocation, and it never hands out a
+ * pointer: zs_malloc() returns an opaque handle, which zs_map_object()
+ * translates to an address for the short while the object is accessed.
+ *
+ * Objects are grouped in size classes ZS_SIZE_CLASS_DELTA bytes apart and
+ * packed end to end over "zspages" of a few pages each, so an object may
+ * span two pages.  Because users only ever hold handles, objects can be
+ * moved: zs_compact() empties sparsely used zspages into others of their
+ * class, and gives the pages back.
+ *
+ * A handle is a word allocated from zs_handle_cache, holding the location
+ * of its object (see zsmalloc_int.h) and a pin bit.  zs_map_object() and
+ * zs_free() pin the handle, which keeps compaction off the object; the
+ * first word of the object points back to the handle, which is how
+ * compaction finds the handle to update when it moves the object.
+ */
+
+#define KMSG_COMPONENT "zsmalloc"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#ifdef CONFIG_ZSMALLOC_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *zs_handle_cache;
+
+/* Only one object may be mapped per cpu at a time */
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static gfp_t zs_meta_flags(struct zs_pool *pool)
+{
+	return pool->flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle >> OBJ_TAG_BITS;
+}
+
+/* The caller has the handle pinned, or it is not yet visible to anyone */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *p = (unsigned long *)handle;
+
+	*p = (obj << OBJ_TAG_BITS) | (*p & BIT(HANDLE_PIN_BIT));
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static unsigned long location_to_obj(struct zspage *zspage, unsigned int idx)
+{
+	return (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+}
+
+static struct zspage *obj_to_location(unsigned long obj, unsigned int *idx)
+{
+	struct page *first_page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+
+	*idx = obj & OBJ_INDEX_MASK;
+	return (struct zspage *)page_private(first_page);
+}
+
+/* Byte offset of object idx in its zspage */
+static unsigned long obj_offset(struct size_class *class, unsigned int idx)
+{
+	return (unsigned long)idx * class->size;
+}
+
+/*
+ * The first word of an object: objects start on a word boundary, so it
+ * never spans two pages.
+ */
+static unsigned long get_obj_word(struct size_class *class,
+				struct zspage *zspage, unsigned int idx)
+{
+	unsigned long off = obj_offset(class, idx);
+	unsigned long word;
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	word = *(unsigned long *)(addr + (off & ~PAGE_MASK));
+	kunmap_atomic(addr, KM_USER0);
+
+	return word;
+}
+
+static void set_obj_word(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, unsigned long word)
+{
+	unsigned long off = obj_offset(class, idx);
+	void *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	*(unsigned long *)(addr + (off & ~PAGE_MASK)) = word;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Number of pages to make a zspage of for objects of the given size: the
+ * one, up to ZS_MAX_PAGES_PER_ZSPAGE, which leaves least of them unused.
+ */
+static int get_pages_per_zspage(int size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse * 100 <= max_objects * ZS_ALMOST_FULL_PERCENT)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move the zspage to the list its use now calls for, taking it off all of
+ * them once empty.  Returns its new fullness group.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	if (zspage->fullness != ZS_EMPTY)
+		list_del(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/*
+ * Allocate a zspage for the class, its objects all on its free list.  Not
+ * yet on any fullness list: the caller allocates from it at once.
+ */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zspage *zspage;
+	unsigned int idx;
+	int i;
+
+	zspage = kzalloc(sizeof(*zspage), zs_meta_flags(pool));
+	if (unlikely(!zspage))
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(pool->flags);
+
+		if (unlikely(!page))
+			goto fail;
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++)
+		set_obj_word(class, zspage, idx, (idx + 1) << OBJ_TAG_BITS);
+
+	zspage->class_idx = class->index;
+	zspage->fullness = ZS_EMPTY;
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+
+fail:
+	while (--i >= 0) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+	return NULL;
+}
+
+/* The fullest zspage of the class with a free object, if any */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i >= ZS_ALMOST_EMPTY; i--) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/* Called with class->lock held, on a zspage with a free object */
+static unsigned long obj_malloc(struct size_class *class,
+				struct zspage *zspage, unsigned long handle)
+{
+	unsigned int idx = zspage->freeobj;
+
+	zspage->freeobj = get_obj_word(class, zspage, idx) >> OBJ_TAG_BITS;
+	set_obj_word(class, zspage, idx, handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_used++;
+
+	return location_to_obj(zspage, idx);
+}
+
+/* Called with class->lock held */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int idx)
+{
+	set_obj_word(class, zspage, idx, zspage->freeobj << OBJ_TAG_BITS);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	class->objs_used--;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * Returns a handle for the block, or 0 on failure: pass the handle to
+ * zs_map_object() to get at the block, and to zs_free() to free it.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE always fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cache,
+						zs_meta_flags(pool));
+	if (unlikely(!handle))
+		return 0;
+	*(unsigned long *)handle = 0;
+
+	size += ZS_HANDLE_SIZE;
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, (void *)handle);
+			return 0;
+		}
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj = obj_malloc(class, zspage, handle);
+	record_obj(handle, obj);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	enum fullness_group fullness;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Compaction cannot move the object from under us once pinned */
+	pin_tag(handle);
+	zspage = obj_to_location(handle_to_obj(handle), &idx);
+	class = &pool->size_class[zspage->class_idx];
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+	kmem_cache_free(zs_handle_cache, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/*
+ * Copy size bytes from or to the object at offset off of pages[0], which
+ * goes on into pages[1].
+ */
+static void zs_copy_spanning(char *buf, struct page *pages[2], int off,
+				int size, bool to_buf)
+{
+	int sizes[2];
+	char *addr;
+
+	sizes[0] = PAGE_SIZE - off;
+	sizes[1] = size - sizes[0];
+
+	addr = kmap_atomic(pages[0], KM_USER0);
+	if (to_buf)
+		memcpy(buf, addr + off, sizes[0]);
+	else
+		memcpy(addr + off, buf, sizes[0]);
+	kunmap_atomic(addr, KM_USER0);
+
+	addr = kmap_atomic(pages[1], KM_USER0);
+	if (to_buf)
+		memcpy(buf + sizes[0], addr, sizes[1]);
+	else
+		memcpy(addr, buf + sizes[0], sizes[1]);
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/* Called with the handle pinned: its object cannot move */
+static struct size_class *handle_to_pages(struct zs_pool *pool,
+				unsigned long handle, struct page *pages[2],
+				int *off)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned long offset;
+	unsigned int idx;
+
+	zspage = obj_to_location(handle_to_obj(handle), &idx);
+	class = &pool->size_class[zspage->class_idx];
+	offset = obj_offset(class, idx);
+
+	pages[0] = zspage->pages[offset >> PAGE_SHIFT];
+	*off = offset & ~PAGE_MASK;
+	if (*off + class->size > PAGE_SIZE)
+		pages[1] = zspage->pages[(offset >> PAGE_SHIFT) + 1];
+	else
+		pages[1] = NULL;
+
+	return class;
+}
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the object will be accessed
+ *
+ * The object stays where it is, and the cpu is not preempted, until
+ * zs_unmap_object() is called: it is for short accesses only, with at most
+ * one object mapped per cpu at a time, and nothing that may sleep between.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct mapping_area *area;
+	struct size_class *class;
+	struct page *pages[2];
+	int off;
+
+	BUG_ON(!handle);
+	BUG_ON(in_interrupt());
+
+	/* Disables preemption, as the per-cpu area requires */
+	pin_tag(handle);
+	class = handle_to_pages(pool, handle, pages, &off);
+
+	area = &__get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	if (!pages[1]) {
+		area->vm_addr = kmap_atomic(pages[0], KM_USER0);
+		return area->vm_addr + off + ZS_HANDLE_SIZE;
+	}
+
+	/* The object spans two pages: go through the copy */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_spanning(area->vm_buf, pages, off, class->size, true);
+
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area;
+	struct size_class *class;
+	struct page *pages[2];
+	int off;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER0);
+	} else if (area->vm_mm != ZS_MM_RO) {
+		/* Leave the handle word alone: ZS_MM_WO did not copy it in */
+		class = handle_to_pages(pool, handle, pages, &off);
+		zs_copy_spanning(area->vm_buf + ZS_HANDLE_SIZE, pages,
+				off + ZS_HANDLE_SIZE,
+				class->size - ZS_HANDLE_SIZE, false);
+	}
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Copy an object's data, not its handle word, to another of its class */
+static void zs_object_copy(struct size_class *class, struct zspage *dst,
+			unsigned int dst_idx, struct zspage *src,
+			unsigned int src_idx)
+{
+	unsigned long s_off = obj_offset(class, src_idx) + ZS_HANDLE_SIZE;
+	unsigned long d_off = obj_offset(class, dst_idx) + ZS_HANDLE_SIZE;
+	int remain = class->size - ZS_HANDLE_SIZE;
+	void *s_addr, *d_addr;
+	int len;
+
+	while (remain) {
+		len = min3(remain, (int)(PAGE_SIZE - (s_off & ~PAGE_MASK)),
+			   (int)(PAGE_SIZE - (d_off & ~PAGE_MASK)));
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT], KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT], KM_USER1);
+		memcpy(d_addr + (d_off & ~PAGE_MASK),
+			s_addr + (s_off & ~PAGE_MASK), len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += len;
+		d_off += len;
+		remain -= len;
+	}
+}
+
+/*
+ * Move the objects of src to dst, until src is empty or dst is full.
+ * Called with class->lock held.  Returns -EBUSY if it met an object which
+ * is mapped or being freed, and so cannot be moved now.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src,
+			struct zspage *dst)
+{
+	unsigned long word, handle, obj;
+	unsigned int idx;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		if (dst->inuse == class->objs_per_zspage)
+			break;
+
+		word = get_obj_word(class, src, idx);
+		if (!(word & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = word & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_tag(handle))
+			return -EBUSY;
+
+		obj = obj_malloc(class, dst, handle);
+		zs_object_copy(class, dst, obj & OBJ_INDEX_MASK, src, idx);
+		record_obj(handle, obj);
+		obj_free(class, src, idx);
+		unpin_tag(handle);
+	}
+
+	return 0;
+}
+
+/*
+ * Can the objects of the class be packed into fewer zspages than they
+ * take now?  Called with class->lock held.
+ */
+static bool zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_allocated = class->zspages * class->objs_per_zspage;
+
+	return obj_allocated - class->objs_used >= class->objs_per_zspage;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct list_head *almost_empty, *almost_full;
+	struct zspage *src, *dst;
+	unsigned long freed = 0;
+	int ret;
+
+	almost_empty = &class->fullness_list[ZS_ALMOST_EMPTY];
+	almost_full = &class->fullness_list[ZS_ALMOST_FULL];
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class) && !list_empty(almost_empty)) {
+		/* Empty the last almost empty zspage into the fullest */
+		src = list_entry(almost_empty->prev, struct zspage, list);
+		if (!list_empty(almost_full))
+			dst = list_first_entry(almost_full, struct zspage, list);
+		else if (almost_empty->next != &src->list)
+			dst = list_first_entry(almost_empty, struct zspage,
+						list);
+		else
+			break;
+
+		ret = migrate_zspage(class, src, dst);
+		fix_fullness_group(class, dst);
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			class->zspages--;
+			spin_unlock(&class->lock);
+			free_zspage(pool, class, src);
+			freed += class->pages_per_zspage;
+			cond_resched();
+			spin_lock(&class->lock);
+		}
+		if (ret)
+			break;
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - move objects to free sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Objects which are mapped meanwhile are left where they are.  May sleep.
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		freed += compact_class(pool, &pool->size_class[i]);
+		cond_resched();
+	}
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * objs_used against objs_allocated tells how fragmented the pool is: the
+ * difference is what zs_compact() can try to give back.
+ */
+void zs_get_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	struct size_class *class;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->objs_allocated += class->zspages *
+					class->objs_per_zspage;
+		stats->objs_used += class->objs_used;
+		spin_unlock(&class->lock);
+	}
+	stats->pages_used = atomic_long_read(&pool->pages_allocated);
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pool_stats);
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, for messages
+ * @flags: allocation flags used to allocate the pages of the pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	struct zs_pool *pool;
+	int i, j;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		int size;
+
+		size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (size > ZS_MAX_OBJ_SIZE)
+			size = ZS_MAX_OBJ_SIZE;
+
+		class->size = size;
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / size;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+	}
+
+	pool->name = name;
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	struct zspage *zspage, *tmp;
+	int i, j;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (j = ZS_ALMOST_EMPTY; j < _ZS_NR_FULLNESS_GROUPS; j++) {
+			if (list_empty(&class->fullness_list[j]))
+				continue;
+
+			pr_info("%s: freeing non-empty class of size %d\n",
+				pool->name, class->size);
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[j], list) {
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+static void zs_exit(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).vm_buf);
+		per_cpu(zs_map_area, cpu).vm_buf = NULL;
+	}
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	BUILD_BUG_ON((ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT) /
+			ZS_MIN_ALLOC_SIZE > OBJ_INDEX_MASK + 1);
+
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	if (!zs_handle_cache)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		char *buf = kmalloc_node(ZS_MAX_OBJ_SIZE, GFP_KERNEL,
+					cpu_to_node(cpu));
+
+		if (!buf)
+			goto fail;
+		per_cpu(zs_map_area, cpu).vm_buf = buf;
+	}
+
+	return 0;
+
+fail:
+	zs_exit();
+	return -ENOMEM;
+}
+
+static void __exit zs_module_exit(void)
+{
+	zs_exit();
+}
+
+module_init(zs_init);
+module_exit(zs_module_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("Nitin Gupta <ngupta@vflare.org>");
@@ -0,0 +1,58 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+#include <linux/mm.h>
+
+/*
+ * Largest object zs_malloc() accepts: a page, less the word at the start
+ * of every object which points back to its handle.
+ */
+#define ZS_MAX_ALLOC_SIZE	(PAGE_SIZE - sizeof(unsigned long))
+
+/*
+ * zs_map_object() modes.  They only make a difference for an object which
+ * spans two pages, and so is copied through a per-cpu buffer.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,	/* copied in at map, and out at unmap time */
+	ZS_MM_RO,	/* not copied out at unmap time */
+	ZS_MM_WO,	/* not copied in at map time */
+};
+
+struct zs_pool_stats {
+	unsigned long pages_used;	/* pages backing the pool */
+	unsigned long objs_allocated;	/* object slots in those pages */
+	unsigned long objs_used;	/* slots holding an object */
+	unsigned long pages_compacted;	/* freed by zs_compact() so far */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+void zs_get_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+unsigned long zs_compact(struct zs_pool *pool);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2011  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * A zspage is the unit zsmalloc gets from the page allocator: one to
+ * ZS_MAX_PAGES_PER_ZSPAGE order-0 pages, not necessarily contiguous nor
+ * mapped, carved into objects of a single size class.  The objects are
+ * laid end to end over the pages, so one may start at the end of a page
+ * and finish at the start of the next: that is what lets a class whose
+ * size does not divide PAGE_SIZE waste so little.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * An object is located by the page frame of the first page of its zspage
+ * and its index there, packed into an unsigned long.  The pfn takes the
+ * high bits: whatever _PFN_BITS leaves, less OBJ_TAG_BITS, indexes it.
+ */
+#ifndef MAX_PHYSMEM_BITS
+#ifdef CONFIG_HIGHMEM64G
+#define MAX_PHYSMEM_BITS	36
+#else
+#define MAX_PHYSMEM_BITS	BITS_PER_LONG
+#endif
+#endif
+#define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
+
+/*
+ * Low bit of a handle's word: set while the handle is pinned.  Low bit of
+ * the first word of an object: set while it is allocated, when the rest is
+ * the handle (handles are word aligned); clear while it is free, when the
+ * rest is the index of the next free object of its zspage.
+ */
+#define OBJ_TAG_BITS		1
+#define HANDLE_PIN_BIT		0
+#define OBJ_ALLOCATED_TAG	1UL
+
+#define OBJ_INDEX_BITS		(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
+#define OBJ_INDEX_MASK		((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
+
+/* The first word of each object points back to its handle */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
+/*
+ * Objects are at least 32 bytes, or larger if needed for the index of the
+ * last object of a full size zspage to fit in OBJ_INDEX_BITS.
+ */
+#define _ZS_MIN_SIZE_FOR_INDEX \
+	((ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT) >> OBJ_INDEX_BITS)
+#define ZS_MIN_ALLOC_SIZE \
+	(_ZS_MIN_SIZE_FOR_INDEX > 32 ? _ZS_MIN_SIZE_FOR_INDEX : 32)
+#define ZS_MAX_OBJ_SIZE		PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA bytes apart: 16 bytes with 4K
+ * pages.  The last one is always ZS_MAX_OBJ_SIZE.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		(DIV_ROUND_UP(ZS_MAX_OBJ_SIZE - \
+				ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA) + 1)
+
+/*
+ * zspages of a class are kept on lists by how full they are: allocation
+ * goes to the fullest zspage with room, compaction empties the emptiest
+ * into the others.  A zspage which becomes empty is freed at once.
+ */
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,	/* at most 3/4 of its objects in use */
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+#define ZS_ALMOST_FULL_PERCENT	75
+
+struct zspage {
+	struct list_head list;		/* on a fullness list of its class */
+	unsigned int class_idx;
+	unsigned int inuse;		/* objects allocated */
+	unsigned int freeobj;		/* index of the first free object */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	/* Protects the fullness lists, and objects' first words */
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* of each object, handle word included */
+	unsigned int index;
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	/* Statistics, under lock */
+	unsigned long zspages;
+	unsigned long objs_used;
+};
+
+/* Where zs_map_object() mapped, or copied, the object of this cpu */
+struct mapping_area {
+	char *vm_buf;		/* copy of an object spanning two pages */
+	char *vm_addr;		/* kmap_atomic() address, if it did not */
+	enum zs_mapmode vm_mm;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;		/* for the pages of zspages */
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+
+	struct size_class size_class[ZS_SIZE_CLASSES];
+};
+
+#endif
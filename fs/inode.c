@@ -275,6 +275,7 @@ void address_space_init_once(struct address_space *mapping)
 	spin_lock_init(&mapping->tree_lock);
 	mutex_init(&mapping->i_mmap_mutex);
 	INIT_LIST_HEAD(&mapping->private_list);
+	INIT_LIST_HEAD(&mapping->shadow_list);
 	spin_lock_init(&mapping->private_lock);
 	INIT_RAW_PRIO_TREE_ROOT(&mapping->i_mmap);
 	INIT_LIST_HEAD(&mapping->i_mmap_nonlinear);
@@ -418,6 +419,16 @@ EXPORT_SYMBOL(__remove_inode_hash);
 void end_writeback(struct inode *inode)
 {
 	might_sleep();
+	/*
+	 * Reclaim that checked AS_EXITING before evict() set it can still be
+	 * leaving a shadow under tree_lock: cycle the lock so that is done
+	 * before workingset_clear_shadows() looks at nrshadows without it.
+	 * Reclaim taking tree_lock after this sees AS_EXITING and leaves none.
+	 */
+	spin_lock_irq(&inode->i_data.tree_lock);
+	spin_unlock_irq(&inode->i_data.tree_lock);
+	/* Whatever shadow entries truncation left, the mapping must lose */
+	workingset_clear_shadows(&inode->i_data, 0, ULONG_MAX);
 	/*
 	 * We have to cycle tree_lock here because reclaim can be still in the
 	 * process of removing the last page (in __delete_from_page_cache())
@@ -425,6 +436,7 @@ void end_writeback(struct inode *inode)
 	 */
 	spin_lock_irq(&inode->i_data.tree_lock);
 	BUG_ON(inode->i_data.nrpages);
+	BUG_ON(inode->i_data.nrshadows);
 	spin_unlock_irq(&inode->i_data.tree_lock);
 	BUG_ON(!list_empty(&inode->i_data.private_list));
 	BUG_ON(!(inode->i_state & I_FREEING));
@@ -460,6 +472,12 @@ static void evict(struct inode *inode)
 
 	inode_sb_list_del(inode);
 
+	/*
+	 * Tell reclaim to stop leaving shadow entries behind the pages it
+	 * takes from the mapping: the final truncate has to empty it.
+	 */
+	mapping_set_exiting(&inode->i_data);
+
 	if (op->evict_inode) {
 		op->evict_inode(inode);
 	} else {
@@ -47,6 +47,16 @@ enum bdi_stat_item {
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/*
+ * Reads completed by a request based queue, counted per cpu at completion
+ * time, for the readahead window of bdis with read_ahead_adaptive set.
+ */
+struct bdi_read_stat {
+	unsigned long sectors;
+	unsigned long ios;
+	unsigned long ticks;	/* jiffies from queueing to completion */
+};
+
 struct bdi_writeback {
 	struct backing_dev_info *bdi;	/* our parent bdi */
 	unsigned int nr;
@@ -80,6 +90,17 @@ struct backing_dev_info {
 	unsigned long write_bandwidth;	/* the estimated write bandwidth */
 	unsigned long avg_write_bandwidth; /* further smoothed write bw */
 
+	/*
+	 * The read bandwidth (pages/s) and latency (us) estimated from
+	 * read_stat on every 200ms, for adaptive readahead only.
+	 */
+	unsigned int read_ahead_adaptive;
+	struct bdi_read_stat __percpu *read_stat;
+	struct bdi_read_stat read_stamp; /* read_stat at read_time_stamp */
+	unsigned long read_time_stamp;
+	unsigned long read_bandwidth;
+	unsigned long read_latency;
+
 	/*
 	 * The base dirty throttle rate, re-calculated on every 200ms.
 	 * All the bdi tasks' dirty rate will be curbed under it.
@@ -131,6 +152,23 @@ extern spinlock_t bdi_lock;
 extern struct list_head bdi_list;
 extern struct list_head bdi_pending_list;
 
+/* Called at interrupt time, as a request based queue completes reads */
+static inline void bdi_account_read(struct backing_dev_info *bdi,
+				    unsigned int bytes)
+{
+	if (bdi->read_stat)
+		this_cpu_add(bdi->read_stat->sectors, bytes >> 9);
+}
+
+static inline void bdi_account_read_done(struct backing_dev_info *bdi,
+					 unsigned long ticks)
+{
+	if (bdi->read_stat) {
+		this_cpu_inc(bdi->read_stat->ios);
+		this_cpu_add(bdi->read_stat->ticks, ticks);
+	}
+}
+
 static inline int wb_has_dirty_io(struct bdi_writeback *wb)
 {
 	return !list_empty(&wb->b_dirty) ||
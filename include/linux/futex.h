@@ -124,6 +124,8 @@ struct robust_list_head {
 #define FUTEX_BITSET_MATCH_ANY	0xffffffff
 
 #ifdef __KERNEL__
+#include <linux/errno.h>
+
 struct inode;
 struct mm_struct;
 struct task_struct;
@@ -177,6 +179,9 @@ union futex_key {
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
 extern int futex_cmpxchg_enabled;
+extern int futex_hash_dup(struct mm_struct *mm, struct mm_struct *oldmm);
+extern void futex_hash_free(struct mm_struct *mm);
+extern int futex_hash_prctl(unsigned long cmd, unsigned long arg);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
@@ -184,6 +189,18 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline int futex_hash_dup(struct mm_struct *mm,
+				 struct mm_struct *oldmm)
+{
+	return 0;
+}
+static inline void futex_hash_free(struct mm_struct *mm)
+{
+}
+static inline int futex_hash_prctl(unsigned long cmd, unsigned long arg)
+{
+	return -EINVAL;
+}
 #endif
 #endif /* __KERNEL__ */
 
@@ -12,7 +12,7 @@ extern int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			       unsigned long address, pmd_t *pmd,
 			       pmd_t orig_pmd);
 extern pgtable_t get_pmd_huge_pte(struct mm_struct *mm);
-extern struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+extern struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 					  unsigned long addr,
 					  pmd_t *pmd,
 					  unsigned int flags);
@@ -87,12 +87,23 @@ extern int handle_pte_fault(struct mm_struct *mm,
 			    struct vm_area_struct *vma, unsigned long address,
 			    pte_t *pte, pmd_t *pmd, unsigned int flags);
 extern int split_huge_page(struct page *page);
-extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd);
-#define split_huge_page_pmd(__mm, __pmd)				\
+extern void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+				  pmd_t *pmd);
+#define split_huge_page_pmd(__mm, __address, __pmd)			\
 	do {								\
 		pmd_t *____pmd = (__pmd);				\
 		if (unlikely(pmd_trans_huge(*____pmd)))			\
-			__split_huge_page_pmd(__mm, ____pmd);		\
+			__split_huge_page_pmd(__mm, __address, ____pmd);\
+	}  while (0)
+extern void __split_huge_page_pmd_vma(struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd);
+/* for callers that may not hold mmap_sem, like truncation */
+#define split_huge_page_pmd_vma(__vma, __address, __pmd)		\
+	do {								\
+		pmd_t *____pmd = (__pmd);				\
+		if (unlikely(pmd_trans_huge(*____pmd)))			\
+			__split_huge_page_pmd_vma(__vma, __address,	\
+						  ____pmd);		\
 	}  while (0)
 #define wait_split_huge_page(__anon_vma, __pmd)				\
 	do {								\
@@ -118,10 +129,25 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long end,
 					 long adjust_next)
 {
-	if (!vma->anon_vma || vma->vm_ops)
+	if ((!vma->anon_vma || vma->vm_ops) &&
+	    !(vma->vm_ops && vma->vm_ops->pmd_fault))
 		return;
 	__vma_adjust_trans_huge(vma, start, end, adjust_next);
 }
+extern int map_file_huge_extent(struct vm_area_struct *vma,
+				unsigned long address, pmd_t *pmd,
+				pgoff_t hindex, unsigned int flags);
+extern unsigned long thp_get_unmapped_area(struct file *file,
+				unsigned long addr, unsigned long len,
+				unsigned long pgoff, unsigned long flags);
+extern pmd_t *page_check_file_huge_pmd(struct page *page,
+				       struct vm_area_struct *vma,
+				       unsigned long address);
+extern int file_huge_pmd_referenced(struct page *page,
+				    struct vm_area_struct *vma,
+				    unsigned long address, pmd_t *pmd);
+extern void split_file_huge_pmd(struct vm_area_struct *vma,
+				unsigned long address, pmd_t *pmd);
 static inline int hpage_nr_pages(struct page *page)
 {
 	if (unlikely(PageTransHuge(page)))
@@ -149,17 +175,21 @@ static inline struct page *compound_trans_head(struct page *page)
 #define HPAGE_PMD_SHIFT ({ BUG(); 0; })
 #define HPAGE_PMD_MASK ({ BUG(); 0; })
 #define HPAGE_PMD_SIZE ({ BUG(); 0; })
+#define HPAGE_PMD_NR ({ BUG(); 0; })
 
 #define hpage_nr_pages(x) 1
 
 #define transparent_hugepage_enabled(__vma) 0
 
 #define transparent_hugepage_flags 0UL
+#define thp_get_unmapped_area NULL
 static inline int split_huge_page(struct page *page)
 {
 	return 0;
 }
-#define split_huge_page_pmd(__mm, __pmd)	\
+#define split_huge_page_pmd(__mm, __address, __pmd)	\
+	do { } while (0)
+#define split_huge_page_pmd_vma(__vma, __address, __pmd)	\
 	do { } while (0)
 #define wait_split_huge_page(__anon_vma, __pmd)	\
 	do { } while (0)
@@ -176,6 +206,22 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 long adjust_next)
 {
 }
+static inline pmd_t *page_check_file_huge_pmd(struct page *page,
+					      struct vm_area_struct *vma,
+					      unsigned long address)
+{
+	return NULL;
+}
+static inline int file_huge_pmd_referenced(struct page *page,
+					   struct vm_area_struct *vma,
+					   unsigned long address, pmd_t *pmd)
+{
+	return 0;
+}
+static inline void split_file_huge_pmd(struct vm_area_struct *vma,
+				       unsigned long address, pmd_t *pmd)
+{
+}
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
 #endif /* _LINUX_HUGE_MM_H */
@@ -125,6 +125,23 @@ static inline void init_llist_head(struct llist_head *list)
 	     &(pos)->member != NULL;					\
 	     (pos) = llist_entry((pos)->member.next, typeof(*(pos)), member))
 
+/**
+ * llist_for_each_entry_safe - iterate over some deleted entries of lock-less list of given type
+ *			       safe against removal of list entry
+ * @pos:	the type * to use as a loop cursor.
+ * @n:		another type * to use as temporary storage
+ * @node:	the first entry of deleted list entries.
+ * @member:	the name of the llist_node with the struct.
+ *
+ * Like llist_for_each_entry(), but the next entry is looked up before
+ * the loop body runs, so the body may reuse or free @pos.
+ */
+#define llist_for_each_entry_safe(pos, n, node, member)			\
+	for ((pos) = llist_entry((node), typeof(*(pos)), member);	\
+	     &(pos)->member != NULL &&					\
+	        ((n) = llist_entry((pos)->member.next, typeof(*(n)), member), true); \
+	     (pos) = (n))
+
 /**
  * llist_empty - tests whether a lock-less list is empty
  * @head:	the list to test
@@ -184,4 +201,6 @@ extern bool llist_add_batch(struct llist_node *new_first,
 			    struct llist_head *head);
 extern struct llist_node *llist_del_first(struct llist_head *head);
 
+struct llist_node *llist_reverse_order(struct llist_node *head);
+
 #endif /* LLIST_H */
@@ -21,6 +21,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 struct address_space;
+struct futex_hash_bucket;
 
 #define USE_SPLIT_PTLOCKS	(NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS)
 
@@ -253,6 +254,14 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_KSM
+	/* ksmd's view of how volatile a VM_MERGEABLE area is: see mm/ksm.c */
+	unsigned long ksm_seqnr;	/* last full scan which scanned us */
+	unsigned int ksm_scanned;	/* pages scanned in this full scan */
+	unsigned int ksm_volatile;	/* of which changed in the last one */
+	unsigned short ksm_skip;	/* full scans still to skip us */
+	unsigned short ksm_backoff;	/* full scans we were skipped last */
+#endif
 };
 
 struct core_thread {
@@ -385,6 +394,29 @@ struct mm_struct {
 #endif
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
+	/* khugepaged collapses into huge pages, successful and failed */
+	unsigned long thp_collapsed;
+	unsigned long thp_collapse_failed;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* jiffies after which the next chunk is made PROT_NONE */
+	unsigned long numa_next_scan;
+	/* where the next chunk starts */
+	unsigned long numa_scan_offset;
+	/* bumped at each pass over the address space */
+	int numa_scan_seq;
+#endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/*
+	 * Reclaim cleared ptes of this mm without flushing the TLB yet, see
+	 * flush_tlb_batched_pending().  Set and cleared under the pte lock.
+	 */
+	bool tlb_flush_batched;
+#endif
+#ifdef CONFIG_FUTEX
+	/* private futexes hash here rather than globally, see PR_FUTEX_HASH */
+	struct futex_hash_bucket *futex_hash;
+	unsigned long futex_hash_mask;
 #endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
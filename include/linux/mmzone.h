@@ -107,6 +107,8 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	WORKINGSET_REFAULT,	/* evicted pages faulted back in */
+	WORKINGSET_ACTIVATE,	/* of which were activated on refault */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -197,8 +199,17 @@ struct per_cpu_pages {
 	struct list_head lists[MIGRATE_PCPTYPES];
 };
 
+/*
+ * Small high-order pages (slab pages, skb heads, kernel stacks) are also
+ * cached on per-cpu lists so that they can be allocated and freed without
+ * taking zone->lock.  For these lists count, high and batch are in units
+ * of blocks of the list's order, not in base pages.
+ */
+#define PCP_MAX_ORDER		3
+
 struct per_cpu_pageset {
 	struct per_cpu_pages pcp;
+	struct per_cpu_pages pcp_order[PCP_MAX_ORDER];	/* orders 1..PCP_MAX_ORDER */
 #ifdef CONFIG_NUMA
 	s8 expire;
 #endif
@@ -208,6 +219,18 @@ struct per_cpu_pageset {
 #endif
 };
 
+static inline int pageset_has_pages(struct per_cpu_pageset *p)
+{
+	int i;
+
+	if (p->pcp.count)
+		return 1;
+	for (i = 0; i < PCP_MAX_ORDER; i++)
+		if (p->pcp_order[i].count)
+			return 1;
+	return 0;
+}
+
 #endif /* !__GENERATING_BOUNDS.H */
 
 enum zone_type {
@@ -281,6 +304,15 @@ enum zone_type {
 #error ZONES_SHIFT -- too many zones configured adjust calculation
 #endif
 
+/*
+ * A set of LRU lists.  With the memory controller, every memcg has one per
+ * zone and a page is only ever on that of the memcg it is charged to;
+ * without, the zone's own is used.
+ */
+struct lruvec {
+	struct list_head lists[NR_LRU_LISTS];
+};
+
 struct zone_reclaim_stat {
 	/*
 	 * The pageout code in vmscan.c keeps track of how many of the
@@ -353,15 +385,25 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+
+	/*
+	 * Where the migrate and free scanners stopped last time, so that
+	 * the next compaction of the zone resumes there instead of
+	 * rescanning the same pageblocks.
+	 */
+	unsigned long		compact_cached_migrate_pfn;
+	unsigned long		compact_cached_free_pfn;
+
+	/* Compaction runs for a high-order page, and how many succeeded */
+	unsigned long		compact_attempts;
+	unsigned long		compact_success;
 #endif
 
 	ZONE_PADDING(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
 	spinlock_t		lru_lock;	
-	struct zone_lru {
-		struct list_head list;
-	} lru[NR_LRU_LISTS];
+	struct lruvec		lruvec;
 
 	struct zone_reclaim_stat reclaim_stat;
 
@@ -371,6 +413,12 @@ struct zone {
 	/* Zone statistics */
 	atomic_long_t		vm_stat[NR_VM_ZONE_STAT_ITEMS];
 
+	/*
+	 * Ticks once for every page evicted from, or activated out of, the
+	 * inactive file list: the clock refault distances are measured by.
+	 */
+	atomic_long_t		inactive_age;
+
 	/*
 	 * The target ratio of ACTIVE_ANON to INACTIVE_ANON pages on
 	 * this zone's LRU.  Maintained by the pageout code.
@@ -622,6 +670,13 @@ extern struct page *mem_map;
  * Memory statistics and page replacement data structures are maintained on a
  * per-zone basis.
  */
+
+/*
+ * Upper limit for vm.kswapd_threads.  Keep in sync with
+ * FOR_ALL_KSWAPD_THREADS() in vm_event_item.h.
+ */
+#define MAX_KSWAPD_THREADS	8
+
 struct bootmem_data;
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
@@ -652,9 +707,16 @@ typedef struct pglist_data {
 					     range, including holes */
 	int node_id;
 	wait_queue_head_t kswapd_wait;
-	struct task_struct *kswapd;
+	struct task_struct *kswapd[MAX_KSWAPD_THREADS];
+	int nr_kswapd;			/* running kswapd threads */
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -792,6 +854,9 @@ int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
 int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
+extern int percpu_pagelist_max_order;
+int percpu_pagelist_max_order_sysctl_handler(struct ctl_table *, int,
+					void __user *, size_t *, loff_t *);
 int sysctl_min_unmapped_ratio_sysctl_handler(struct ctl_table *, int,
 			void __user *, size_t *, loff_t *);
 int sysctl_min_slab_ratio_sysctl_handler(struct ctl_table *, int,
@@ -102,4 +102,13 @@
 
 #define PR_MCE_KILL_GET 34
 
+/*
+ * Give the process a hash table of its own for its private futexes,
+ * of arg3 buckets (a power of two, 0 for the global table again); only
+ * while it is single threaded.
+ */
+#define PR_FUTEX_HASH	35
+# define PR_FUTEX_HASH_SET_SLOTS	1
+# define PR_FUTEX_HASH_GET_SLOTS	2
+
 #endif /* _LINUX_PRCTL_H */
@@ -170,6 +170,7 @@ enum ttu_flags {
 	TTU_IGNORE_MLOCK = (1 << 8),	/* ignore mlock */
 	TTU_IGNORE_ACCESS = (1 << 9),	/* don't age */
 	TTU_IGNORE_HWPOISON = (1 << 10),/* corrupted page is recoverable */
+	TTU_BATCH_FLUSH = (1 << 11),	/* batch TLB flushes where possible */
 };
 #define TTU_ACTION(x) ((x) & TTU_ACTION_MASK)
 
@@ -179,6 +180,37 @@ int try_to_unmap(struct page *, enum ttu_flags flags);
 int try_to_unmap_one(struct page *, struct vm_area_struct *,
 			unsigned long address, enum ttu_flags flags);
 
+/*
+ * With TTU_BATCH_FLUSH, try_to_unmap() clears the ptes without flushing
+ * the TLB and records the mm in current->tlb_ubc instead.  The caller must
+ * call try_to_unmap_flush() before the unmapped pages can be freed, and
+ * try_to_unmap_flush_dirty() before they are written back.
+ */
+#define TLB_UBC_NR_MM	8
+
+struct tlbflush_unmap_batch {
+	struct mm_struct *mm[TLB_UBC_NR_MM];
+	unsigned int nr_pages[TLB_UBC_NR_MM];
+	int nr_mm;
+	bool writable;		/* a dirty pte was cleared */
+};
+
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+void try_to_unmap_flush(void);
+void try_to_unmap_flush_dirty(void);
+void flush_tlb_batched_pending(struct mm_struct *mm);
+#else
+static inline void try_to_unmap_flush(void)
+{
+}
+static inline void try_to_unmap_flush_dirty(void)
+{
+}
+static inline void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+}
+#endif
+
 /*
  * Called from mm/filemap_xip.c to unmap empty zero page
  */
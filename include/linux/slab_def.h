@@ -68,6 +68,8 @@ struct kmem_cache {
 	unsigned long node_allocs;
 	unsigned long node_frees;
 	unsigned long node_overflow;
+	unsigned long remote_flushes;
+	unsigned long remote_flush_objs;
 	atomic_t allochit;
 	atomic_t allocmiss;
 	atomic_t freehit;
@@ -91,6 +93,9 @@ struct kmem_cache {
 	 * We still use [NR_CPUS] and not [1] or [0] because cache_cache
 	 * is statically defined, so we reserve the max number of cpus.
 	 */
+#ifdef CONFIG_NUMA
+	struct remote_free __percpu *remote_free;	/* cross-node frees */
+#endif
 	struct kmem_list3 **nodelists;
 	struct array_cache *array[NR_CPUS];
 	/*
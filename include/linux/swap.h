@@ -8,6 +8,7 @@
 #include <linux/memcontrol.h>
 #include <linux/sched.h>
 #include <linux/node.h>
+#include <linux/workqueue.h>
 
 #include <linux/atomic.h>
 #include <asm/page.h>
@@ -144,7 +145,6 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_DISCARDABLE = (1 << 2),	/* swapon+blkdev support discard */
-	SWP_DISCARDING	= (1 << 3),	/* now discarding a free cluster */
 	SWP_SOLIDSTATE	= (1 << 4),	/* blkdev seeks are cheap */
 	SWP_CONTINUED	= (1 << 5),	/* swap_map has count continuation */
 	SWP_BLKDEV	= (1 << 6),	/* its a block device */
@@ -171,6 +171,24 @@ enum {
 #define COUNT_CONTINUED	0x80	/* See swap_map continuation for full count */
 #define SWAP_MAP_SHMEM	0xbf	/* Owned by shmem/tmpfs, in first swap_map */
 
+/*
+ * A swap cluster is SWAPFILE_CLUSTER aligned pages of a swap device.  On
+ * a solid state device, free clusters are kept on a list linked through
+ * their swap_cluster_info, and each cpu allocates sequentially from a
+ * cluster of its own, instead of scanning swap_map for a free range.
+ */
+struct swap_cluster_info {
+	unsigned int data:24;	/* next free cluster, or count of used pages */
+	unsigned int flags:8;
+};
+#define CLUSTER_FLAG_FREE	1	/* cluster is on a free or discard list */
+#define CLUSTER_NULL		((1U << 24) - 1)	/* end of cluster list */
+
+struct percpu_cluster {
+	unsigned int index;	/* current cluster, or CLUSTER_NULL */
+	unsigned int next;	/* likely next allocation offset in it */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -187,13 +205,22 @@ struct swap_info_struct {
 	unsigned int inuse_pages;	/* number of those currently in use */
 	unsigned int cluster_next;	/* likely index for next allocation */
 	unsigned int cluster_nr;	/* countdown to next cluster search */
-	unsigned int lowest_alloc;	/* while preparing discard cluster */
-	unsigned int highest_alloc;	/* while preparing discard cluster */
+	struct swap_cluster_info *cluster_info; /* solid state devices only */
+	unsigned int free_cluster_head;	/* free clusters, linked through */
+	unsigned int free_cluster_tail;	/* cluster_info: CLUSTER_NULL if none */
+	unsigned int discard_cluster_head; /* free clusters still to be */
+	unsigned int discard_cluster_tail; /* discarded before reuse */
+	struct percpu_cluster __percpu *percpu_cluster;
 	struct swap_extent *curr_swap_extent;
 	struct swap_extent first_swap_extent;
 	struct block_device *bdev;	/* swap device or bdev of swap file */
 	struct file *swap_file;		/* seldom referenced */
 	unsigned int old_block_size;	/* seldom referenced */
+	struct work_struct discard_work; /* discards freed clusters */
+	spinlock_t lock;		/* protects swap_map, the counts above
+					 * and the cluster lists: nests inside
+					 * swap_lock, which only protects the
+					 * swap_list and swapon/swapoff */
 };
 
 struct swap_list_t {
@@ -202,7 +229,7 @@ struct swap_list_t {
 };
 
 /* Swap 50% full? Release swapcache more aggressively.. */
-#define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
+#define vm_swap_full() (get_nr_swap_pages()*2 < total_swap_pages)
 
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
@@ -214,6 +241,15 @@ extern unsigned int nr_free_pagecache_pages(void);
 #define nr_free_pages() global_page_state(NR_FREE_PAGES)
 
 
+/* linux/mm/workingset.c */
+void *workingset_eviction(struct address_space *mapping, struct page *page);
+bool workingset_refault(void *shadow);
+void workingset_activation(struct page *page);
+void workingset_add_shadow(struct address_space *mapping);
+void workingset_del_shadow(struct address_space *mapping);
+void workingset_clear_shadows(struct address_space *mapping,
+			      pgoff_t start, pgoff_t end);
+
 /* linux/mm/swap.c */
 extern void __lru_cache_add(struct page *, enum lru_list lru);
 extern void lru_cache_add_lru(struct page *, enum lru_list lru);
@@ -290,6 +326,9 @@ static inline void scan_unevictable_unregister_node(struct node *node)
 }
 #endif
 
+extern int kswapd_threads;
+extern int kswapd_threads_sysctl_handler(struct ctl_table *, int,
+					void __user *, size_t *, loff_t *);
 extern int kswapd_run(int nid);
 extern void kswapd_stop(int nid);
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
@@ -323,10 +362,19 @@ extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 
 /* linux/mm/swapfile.c */
-extern long nr_swap_pages;
+extern atomic_long_t nr_swap_pages;
 extern long total_swap_pages;
+
+/* Free swap pages, not counting those held in per-cpu swap slot caches */
+static inline long get_nr_swap_pages(void)
+{
+	return atomic_long_read(&nr_swap_pages);
+}
+
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int, swp_entry_t *);
+extern void swapcache_free_entries(swp_entry_t *, int);
 extern swp_entry_t get_swap_page_of_type(int);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
 extern int add_swap_count_continuation(swp_entry_t, gfp_t);
@@ -381,7 +429,7 @@ static inline void mem_cgroup_uncharge_swap(swp_entry_t ent)
 
 #else /* CONFIG_SWAP */
 
-#define nr_swap_pages				0L
+#define get_nr_swap_pages()			0L
 #define total_swap_pages			0L
 #define total_swapcache_pages			0UL
 
@@ -0,0 +1,33 @@
+#ifndef _LINUX_SWAP_SLOTS_H
+#define _LINUX_SWAP_SLOTS_H
+
+#include <linux/swap.h>
+#include <linux/mutex.h>
+
+/*
+ * Per-cpu cache of swap entries, refilled a batch at a time from
+ * get_swap_pages(), so that get_swap_page() takes neither swap_lock nor
+ * a swap device's lock for most allocations.
+ */
+#define SWAP_SLOTS_CACHE_SIZE			64
+
+/*
+ * Stop caching when free swap falls below this many batches per online
+ * cpu, so that entries are not left idle in caches while others fail;
+ * start again once it is back above the higher mark.
+ */
+#define THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE	5
+#define THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE	2
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr and cur */
+	swp_entry_t	*slots;
+	int		nr;		/* number of entries left in slots */
+	int		cur;		/* index of the next one to hand out */
+};
+
+extern void enable_swap_slots_cache(void);
+extern void disable_swap_slots_cache_lock(void);
+extern void reenable_swap_slots_cache_unlock(void);
+
+#endif /* _LINUX_SWAP_SLOTS_H */
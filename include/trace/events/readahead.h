@@ -0,0 +1,77 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/backing-dev.h>
+
+/* Why ondemand_readahead() chose the window it did */
+#define RA_PATTERN_INITIAL	0	/* start of file or of a stream */
+#define RA_PATTERN_SUBSEQUENT	1	/* reached the expected offset */
+#define RA_PATTERN_MARKER	2	/* hit PG_readahead, without state */
+#define RA_PATTERN_CONTEXT	3	/* stream found in the page cache */
+#define RA_PATTERN_OVERSIZE	4	/* read larger than the max window */
+
+#define show_ra_pattern(pattern)				\
+	__print_symbolic(pattern,				\
+		{RA_PATTERN_INITIAL,	"initial"},		\
+		{RA_PATTERN_SUBSEQUENT,	"subsequent"},		\
+		{RA_PATTERN_MARKER,	"marker"},		\
+		{RA_PATTERN_CONTEXT,	"context"},		\
+		{RA_PATTERN_OVERSIZE,	"oversize"})
+
+TRACE_EVENT(readahead_window,
+
+	TP_PROTO(struct address_space *mapping, struct file_ra_state *ra,
+		 pgoff_t offset, unsigned long req_size, unsigned long max,
+		 int pattern),
+
+	TP_ARGS(mapping, ra, offset, req_size, max, pattern),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	ino_t,		ino		)
+		__field(	pgoff_t,	offset		)
+		__field(	unsigned long,	req_size	)
+		__field(	pgoff_t,	start		)
+		__field(	unsigned int,	size		)
+		__field(	unsigned int,	async_size	)
+		__field(	unsigned long,	max		)
+		__field(	unsigned long,	read_bandwidth	)
+		__field(	unsigned long,	read_latency	)
+		__field(	int,		pattern		)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+		__entry->async_size	= ra->async_size;
+		__entry->max		= max;
+		__entry->read_bandwidth	= mapping->backing_dev_info->read_bandwidth;
+		__entry->read_latency	= mapping->backing_dev_info->read_latency;
+		__entry->pattern	= pattern;
+	),
+
+	TP_printk("dev=%d:%d ino=%lx offset=%lu req_size=%lu pattern=%s "
+		  "start=%lu size=%u async_size=%u max=%lu "
+		  "read_bandwidth=%lu read_latency=%lu",
+		MAJOR(__entry->dev), MINOR(__entry->dev),
+		(unsigned long)__entry->ino,
+		__entry->offset, __entry->req_size,
+		show_ra_pattern(__entry->pattern),
+		__entry->start, __entry->size, __entry->async_size,
+		__entry->max, __entry->read_bandwidth, __entry->read_latency)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -471,6 +471,25 @@ TRACE_EVENT_CONDITION(update_swap_token_priority,
 		  __entry->swap_token_mm, __entry->swap_token_prio)
 );
 
+TRACE_EVENT(mm_vmscan_unmap_tlb_flush,
+
+	TP_PROTO(struct mm_struct *mm, unsigned int nr_pages),
+
+	TP_ARGS(mm, nr_pages),
+
+	TP_STRUCT__entry(
+		__field(struct mm_struct *, mm)
+		__field(unsigned int, nr_pages)
+	),
+
+	TP_fast_assign(
+		__entry->mm		= mm;
+		__entry->nr_pages	= nr_pages;
+	),
+
+	TP_printk("mm=%p nr_pages=%u", __entry->mm, __entry->nr_pages)
+);
+
 #endif /* _TRACE_VMSCAN_H */
 
 /* This part must be outside protection */
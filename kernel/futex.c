@@ -59,6 +59,10 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/prctl.h>
 
 #include <asm/futex.h>
 
@@ -66,7 +70,8 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+/* Largest private hash a process may ask for, in buckets */
+#define FUTEX_PRIVATE_HASH_MAX	(1UL << 16)
 
 /*
  * Futex flags used to encode options to functions and preserve them across
@@ -140,24 +145,165 @@ static const struct futex_q futex_q_init = {
 /*
  * Hash buckets are shared by all the futex_keys that hash to the same
  * location.  Each key may have multiple futex_q structures, one for each task
- * waiting on a futex.
+ * waiting on a futex.  A bucket per cacheline, so that the locks of busy
+ * buckets next to each other do not bounce the same line between cpus.
  */
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
-};
+} ____cacheline_aligned_in_smp;
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global hash, sized by the number of possible cpus at boot, and
+ * spread over the NUMA nodes (see alloc_large_system_hash()).
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashmask __read_mostly;
+
+static inline int futex_key_private(union futex_key *key)
+{
+	return !(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED));
+}
 
 /*
- * We hash on the keys returned from get_futex_key (see below).
+ * We hash on the keys returned from get_futex_key (see below).  Private
+ * keys go to their process' own hash, if it has set one up.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (futex_key_private(key) && key->private.mm->futex_hash) {
+		struct mm_struct *mm = key->private.mm;
+
+		return &mm->futex_hash[hash & mm->futex_hash_mask];
+	}
+	return &futex_queues[hash & futex_hashmask];
+}
+
+static void futex_hash_init(struct futex_hash_bucket *hb, unsigned long nr)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr; i++) {
+		plist_head_init(&hb[i].chain);
+		spin_lock_init(&hb[i].lock);
+	}
+}
+
+static struct futex_hash_bucket *futex_hash_alloc(unsigned long nr)
+{
+	size_t size = nr * sizeof(struct futex_hash_bucket);
+	struct futex_hash_bucket *hb;
+
+	if (size > PAGE_SIZE)
+		hb = vmalloc(size);
+	else
+		hb = kmalloc(size, GFP_KERNEL);
+	if (hb)
+		futex_hash_init(hb, nr);
+	return hb;
+}
+
+static void futex_hash_release(struct futex_hash_bucket *hb)
+{
+	if (is_vmalloc_addr(hb))
+		vfree(hb);
+	else
+		kfree(hb);
+}
+
+/**
+ * futex_hash_dup() - give a forked mm a private hash like its parent's
+ * @mm:		the new mm
+ * @oldmm:	the mm it is a copy of
+ *
+ * The new hash is empty: no futex of the child can have waiters yet.
+ */
+int futex_hash_dup(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (!oldmm->futex_hash)
+		return 0;
+	mm->futex_hash = futex_hash_alloc(oldmm->futex_hash_mask + 1);
+	if (!mm->futex_hash)
+		return -ENOMEM;
+	mm->futex_hash_mask = oldmm->futex_hash_mask;
+	return 0;
+}
+
+/**
+ * futex_hash_free() - free the private hash of an mm going away
+ * @mm:		the mm
+ */
+void futex_hash_free(struct mm_struct *mm)
+{
+	if (mm->futex_hash)
+		futex_hash_release(mm->futex_hash);
+}
+
+/*
+ * Every waiter on a private futex is queued in whichever hash its key
+ * hashed to at the time, so the hash of a process can only be switched
+ * while it cannot have any waiters: while it has a single thread, and
+ * that one is in here.
+ */
+static int futex_hash_set_slots(unsigned long slots)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *hb = NULL, *old;
+
+	if (slots && (slots > FUTEX_PRIVATE_HASH_MAX || !is_power_of_2(slots)))
+		return -EINVAL;
+	if (!mm)
+		return -EINVAL;
+	if (atomic_read(&mm->mm_users) != 1)
+		return -EBUSY;
+
+	if (slots) {
+		hb = futex_hash_alloc(slots);
+		if (!hb)
+			return -ENOMEM;
+	}
+	old = mm->futex_hash;
+	mm->futex_hash = hb;
+	mm->futex_hash_mask = slots ? slots - 1 : 0;
+	if (old)
+		futex_hash_release(old);
+	return 0;
+}
+
+static int futex_hash_get_slots(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	if (!mm || !mm->futex_hash)
+		return 0;
+	return mm->futex_hash_mask + 1;
+}
+
+/**
+ * futex_hash_prctl() - PR_FUTEX_HASH
+ * @cmd:	PR_FUTEX_HASH_SET_SLOTS or PR_FUTEX_HASH_GET_SLOTS
+ * @arg:	for PR_FUTEX_HASH_SET_SLOTS, the number of buckets for the
+ *		process' private futexes, a power of two; 0 to go back to
+ *		the global hash
+ *
+ * Returns the number of private buckets for PR_FUTEX_HASH_GET_SLOTS,
+ * 0 if the process uses the global hash.
+ */
+int futex_hash_prctl(unsigned long cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case PR_FUTEX_HASH_SET_SLOTS:
+		return futex_hash_set_slots(arg);
+	case PR_FUTEX_HASH_GET_SLOTS:
+		if (arg)
+			return -EINVAL;
+		return futex_hash_get_slots();
+	}
+	return -EINVAL;
 }
 
 /*
@@ -2722,8 +2868,9 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned long futex_hashsize;
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2738,10 +2885,18 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+	futex_hashmask = futex_hashsize - 1;
+	futex_hash_init(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -0,0 +1,429 @@
+/*
+ * Module-based torture test facility for locking
+ *
+ * Hammers a single lock from nwriters_stress kernel threads, checking
+ * that no two of them ever hold it at once, and reports how many times
+ * each thread got it.  Loading it with increasing nwriters_stress shows
+ * how a lock implementation's throughput holds up under contention, for
+ * instance with and without QUEUED_SPINLOCKS.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Based on kernel/rcutorture.c.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/moduleparam.h>
+#include <linux/notifier.h>
+#include <linux/reboot.h>
+#include <linux/delay.h>
+#include <linux/stat.h>
+#include <linux/slab.h>
+
+MODULE_LICENSE("GPL");
+
+static int nwriters_stress = -1; /* # writer threads, defaults to 2*ncpus */
+static int stat_interval;	/* Interval between stats, in seconds. */
+				/*  Defaults to "only at end of test". */
+static int verbose;		/* Print more debug info. */
+static int hold_loops;		/* Busy loops with the lock held. */
+static int delay_loops;		/* Busy loops between acquisitions. */
+static char *torture_type = "spin_lock"; /* What lock to torture. */
+
+module_param(nwriters_stress, int, 0444);
+MODULE_PARM_DESC(nwriters_stress, "Number of write-locking stress-test threads");
+module_param(stat_interval, int, 0644);
+MODULE_PARM_DESC(stat_interval, "Number of seconds between stats printk()s");
+module_param(verbose, bool, 0444);
+MODULE_PARM_DESC(verbose, "Enable verbose debugging printk()s");
+module_param(hold_loops, int, 0444);
+MODULE_PARM_DESC(hold_loops, "Busy loop iterations with the lock held");
+module_param(delay_loops, int, 0444);
+MODULE_PARM_DESC(delay_loops, "Busy loop iterations between acquisitions");
+module_param(torture_type, charp, 0444);
+MODULE_PARM_DESC(torture_type, "Type of lock to torture (spin_lock, spin_lock_irq)");
+
+#define TORTURE_FLAG "-torture:"
+#define VERBOSE_PRINTK_STRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG s "\n", torture_type); } while (0)
+#define VERBOSE_PRINTK_ERRSTRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG "!!! " s "\n", torture_type); } while (0)
+
+static int nrealwriters_stress;
+static struct task_struct **writer_tasks;
+static struct task_struct *stats_task;
+
+struct lock_writer_stress_stats {
+	long n_write_lock_fail;
+	long n_write_lock_acquired;
+};
+static struct lock_writer_stress_stats *lwsa;
+
+static int lock_is_write_held;
+/* Protected by the tortured lock, and deliberately not atomic */
+static long lock_write_counter;
+static unsigned long lock_torture_starttime;
+static atomic_t n_lock_torture_errors;
+
+/* Mediate rmmod and system shutdown.  Concurrent rmmod & shutdown illegal! */
+
+#define FULLSTOP_DONTSTOP 0	/* Normal operation. */
+#define FULLSTOP_SHUTDOWN 1	/* System shutdown with locktorture running. */
+#define FULLSTOP_RMMOD    2	/* Normal rmmod of locktorture. */
+static int fullstop = FULLSTOP_RMMOD;
+/*
+ * Protect fullstop transitions and spawning of kthreads.
+ */
+static DEFINE_MUTEX(fullstop_mutex);
+
+/*
+ * Detect and respond to a system shutdown.
+ */
+static int
+locktorture_shutdown_notify(struct notifier_block *unused1,
+			    unsigned long unused2, void *unused3)
+{
+	mutex_lock(&fullstop_mutex);
+	if (fullstop == FULLSTOP_DONTSTOP)
+		fullstop = FULLSTOP_SHUTDOWN;
+	else
+		printk(KERN_WARNING /* but going down anyway, so... */
+		       "Concurrent 'rmmod locktorture' and shutdown illegal!\n");
+	mutex_unlock(&fullstop_mutex);
+	return NOTIFY_DONE;
+}
+
+/*
+ * Absorb kthreads into a kernel function that won't return, so that
+ * they won't ever access module text or data again.
+ */
+static void locktorture_shutdown_absorb(char *title)
+{
+	if (ACCESS_ONCE(fullstop) == FULLSTOP_SHUTDOWN) {
+		printk(KERN_NOTICE
+		       "locktorture thread %s parking due to system shutdown\n",
+		       title);
+		schedule_timeout_uninterruptible(MAX_SCHEDULE_TIMEOUT);
+	}
+}
+
+static noinline void lock_torture_spin(int loops)
+{
+	int i;
+
+	for (i = 0; i < loops; i++)
+		cpu_relax();
+}
+
+/*
+ * Operations vector for selecting different types of tests.
+ */
+
+struct lock_torture_ops {
+	void (*writelock)(void);
+	void (*writeunlock)(void);
+	char *name;
+};
+
+static struct lock_torture_ops *cur_ops;
+
+static DEFINE_SPINLOCK(torture_spinlock);
+
+static void torture_spin_lock_write_lock(void) __acquires(torture_spinlock)
+{
+	spin_lock(&torture_spinlock);
+}
+
+static void torture_spin_lock_write_unlock(void) __releases(torture_spinlock)
+{
+	spin_unlock(&torture_spinlock);
+}
+
+static struct lock_torture_ops spin_lock_ops = {
+	.writelock	= torture_spin_lock_write_lock,
+	.writeunlock	= torture_spin_lock_write_unlock,
+	.name		= "spin_lock"
+};
+
+/* Only touched with torture_spinlock held */
+static unsigned long torture_spinlock_flags;
+
+static void torture_spin_lock_write_lock_irq(void) __acquires(torture_spinlock)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&torture_spinlock, flags);
+	torture_spinlock_flags = flags;
+}
+
+static void torture_spin_lock_write_unlock_irq(void) __releases(torture_spinlock)
+{
+	spin_unlock_irqrestore(&torture_spinlock, torture_spinlock_flags);
+}
+
+static struct lock_torture_ops spin_lock_irq_ops = {
+	.writelock	= torture_spin_lock_write_lock_irq,
+	.writeunlock	= torture_spin_lock_write_unlock_irq,
+	.name		= "spin_lock_irq"
+};
+
+/*
+ * Lock torture writer kthread.  Repeatedly acquires and releases
+ * the lock, checking for duplicate acquisitions.
+ */
+static int
+lock_torture_writer(void *arg)
+{
+	struct lock_writer_stress_stats *lwsp = arg;
+
+	VERBOSE_PRINTK_STRING("lock_torture_writer task started");
+
+	do {
+		cur_ops->writelock();
+		if (lock_is_write_held)
+			lwsp->n_write_lock_fail++;
+		lock_is_write_held = 1;
+		lock_write_counter++;
+		lwsp->n_write_lock_acquired++;
+		lock_torture_spin(hold_loops);
+		lock_is_write_held = 0;
+		cur_ops->writeunlock();
+
+		lock_torture_spin(delay_loops);
+		if (!(lwsp->n_write_lock_acquired & 1023))
+			cond_resched();
+	} while (!kthread_should_stop() && fullstop == FULLSTOP_DONTSTOP);
+	VERBOSE_PRINTK_STRING("lock_torture_writer task stopping");
+	locktorture_shutdown_absorb("lock_torture_writer");
+	while (!kthread_should_stop())
+		schedule_timeout_uninterruptible(1);
+	return 0;
+}
+
+/*
+ * Print torture statistics.  Caller must ensure that there is only
+ * one call to this function at a given time: the lock_torture_stats
+ * kthread while it runs, the init/cleanup functions otherwise.
+ */
+static void
+lock_torture_stats_print(void)
+{
+	long max = 0, min = 0, sum = 0, fail = 0;
+	unsigned long secs;
+	int i;
+
+	for (i = 0; i < nrealwriters_stress; i++) {
+		if (lwsa[i].n_write_lock_fail)
+			fail++;
+		sum += lwsa[i].n_write_lock_acquired;
+		if (max < lwsa[i].n_write_lock_acquired)
+			max = lwsa[i].n_write_lock_acquired;
+		if (i == 0 || min > lwsa[i].n_write_lock_acquired)
+			min = lwsa[i].n_write_lock_acquired;
+	}
+	secs = (jiffies - lock_torture_starttime) / HZ;
+	printk(KERN_ALERT "%s" TORTURE_FLAG
+	       " Writes:  Total: %ld  Max/Min: %ld/%ld %s  Per second: %ld"
+	       "  Fail: %ld %s\n",
+	       torture_type, sum, max, min,
+	       max / 2 > min ? "???" : "",
+	       secs ? sum / (long)secs : 0,
+	       fail, fail ? "!!!" : "");
+	if (fail) {
+		atomic_inc(&n_lock_torture_errors);
+		WARN_ON_ONCE(1);
+	}
+}
+
+/*
+ * Periodically prints torture statistics, if periodic statistics printing
+ * was specified via the stat_interval module parameter.
+ *
+ * No need to worry about fullstop here, since this one doesn't reference
+ * volatile state.
+ */
+static int
+lock_torture_stats(void *arg)
+{
+	VERBOSE_PRINTK_STRING("lock_torture_stats task started");
+	do {
+		schedule_timeout_interruptible(stat_interval * HZ);
+		lock_torture_stats_print();
+		locktorture_shutdown_absorb("lock_torture_stats");
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("lock_torture_stats task stopping");
+	return 0;
+}
+
+static inline void
+lock_torture_print_module_parms(struct lock_torture_ops *cur_ops, char *tag)
+{
+	printk(KERN_ALERT "%s" TORTURE_FLAG
+	       "--- %s: nwriters_stress=%d stat_interval=%d verbose=%d "
+	       "hold_loops=%d delay_loops=%d\n",
+	       torture_type, tag, nrealwriters_stress, stat_interval, verbose,
+	       hold_loops, delay_loops);
+}
+
+static struct notifier_block locktorture_shutdown_nb = {
+	.notifier_call = locktorture_shutdown_notify,
+};
+
+static void
+lock_torture_cleanup(void)
+{
+	long sum = 0;
+	int i;
+
+	mutex_lock(&fullstop_mutex);
+	if (fullstop == FULLSTOP_SHUTDOWN) {
+		printk(KERN_WARNING /* but going down anyway, so... */
+		       "Concurrent 'rmmod locktorture' and shutdown illegal!\n");
+		mutex_unlock(&fullstop_mutex);
+		return;
+	}
+	fullstop = FULLSTOP_RMMOD;
+	mutex_unlock(&fullstop_mutex);
+	unregister_reboot_notifier(&locktorture_shutdown_nb);
+
+	if (writer_tasks) {
+		for (i = 0; i < nrealwriters_stress; i++) {
+			if (writer_tasks[i]) {
+				VERBOSE_PRINTK_STRING(
+					"Stopping lock_torture_writer task");
+				kthread_stop(writer_tasks[i]);
+			}
+			writer_tasks[i] = NULL;
+		}
+		kfree(writer_tasks);
+		writer_tasks = NULL;
+	}
+
+	if (stats_task) {
+		VERBOSE_PRINTK_STRING("Stopping lock_torture_stats task");
+		kthread_stop(stats_task);
+	}
+	stats_task = NULL;
+
+	if (!lwsa)
+		return;	/* Failed before the statistics were set up. */
+
+	lock_torture_stats_print();  /* -After- the stats thread is stopped! */
+
+	/* Lost updates to the unprotected counter mean exclusion failed. */
+	for (i = 0; i < nrealwriters_stress; i++)
+		sum += lwsa[i].n_write_lock_acquired;
+	if (sum != lock_write_counter)
+		atomic_inc(&n_lock_torture_errors);
+	if (atomic_read(&n_lock_torture_errors))
+		lock_torture_print_module_parms(cur_ops, "End of test: FAILURE");
+	else
+		lock_torture_print_module_parms(cur_ops, "End of test: SUCCESS");
+	kfree(lwsa);
+	lwsa = NULL;
+}
+
+static int __init
+lock_torture_init(void)
+{
+	int i;
+	int firsterr = 0;
+	static struct lock_torture_ops *torture_ops[] = {
+		&spin_lock_ops, &spin_lock_irq_ops,
+	};
+
+	mutex_lock(&fullstop_mutex);
+
+	/* Process args and tell the world that the torturer is on the job. */
+	for (i = 0; i < ARRAY_SIZE(torture_ops); i++) {
+		cur_ops = torture_ops[i];
+		if (strcmp(torture_type, cur_ops->name) == 0)
+			break;
+	}
+	if (i == ARRAY_SIZE(torture_ops)) {
+		printk(KERN_ALERT "lock-torture: invalid torture type: \"%s\"\n",
+		       torture_type);
+		printk(KERN_ALERT "lock-torture types:");
+		for (i = 0; i < ARRAY_SIZE(torture_ops); i++)
+			printk(KERN_ALERT " %s", torture_ops[i]->name);
+		printk(KERN_ALERT "\n");
+		mutex_unlock(&fullstop_mutex);
+		return -EINVAL;
+	}
+	if (hold_loops < 0)
+		hold_loops = 0;
+	if (delay_loops < 0)
+		delay_loops = 0;
+
+	if (nwriters_stress >= 0)
+		nrealwriters_stress = nwriters_stress;
+	else
+		nrealwriters_stress = 2 * num_online_cpus();
+	lock_torture_print_module_parms(cur_ops, "Start of test");
+	fullstop = FULLSTOP_DONTSTOP;
+
+	/* Initialize the statistics so that each run gets its own numbers. */
+
+	lock_is_write_held = 0;
+	lock_write_counter = 0;
+	lock_torture_starttime = jiffies;
+	atomic_set(&n_lock_torture_errors, 0);
+	lwsa = kzalloc(nrealwriters_stress * sizeof(*lwsa), GFP_KERNEL);
+	if (lwsa == NULL) {
+		VERBOSE_PRINTK_ERRSTRING("lwsa: Out of memory");
+		firsterr = -ENOMEM;
+		goto unwind;
+	}
+
+	/* Start up the kthreads. */
+
+	writer_tasks = kzalloc(nrealwriters_stress * sizeof(writer_tasks[0]),
+			       GFP_KERNEL);
+	if (writer_tasks == NULL) {
+		VERBOSE_PRINTK_ERRSTRING("writer_tasks: Out of memory");
+		firsterr = -ENOMEM;
+		goto unwind;
+	}
+	for (i = 0; i < nrealwriters_stress; i++) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_writer task");
+		writer_tasks[i] = kthread_run(lock_torture_writer, &lwsa[i],
+					      "lock_torture_writer");
+		if (IS_ERR(writer_tasks[i])) {
+			firsterr = PTR_ERR(writer_tasks[i]);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create writer");
+			writer_tasks[i] = NULL;
+			goto unwind;
+		}
+	}
+	if (stat_interval > 0) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_stats task");
+		stats_task = kthread_run(lock_torture_stats, NULL,
+					 "lock_torture_stats");
+		if (IS_ERR(stats_task)) {
+			firsterr = PTR_ERR(stats_task);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create stats");
+			stats_task = NULL;
+			goto unwind;
+		}
+	}
+	register_reboot_notifier(&locktorture_shutdown_nb);
+	mutex_unlock(&fullstop_mutex);
+	return 0;
+
+unwind:
+	mutex_unlock(&fullstop_mutex);
+	lock_torture_cleanup();
+	return firsterr;
+}
+
+module_init(lock_torture_init);
+module_exit(lock_torture_cleanup);
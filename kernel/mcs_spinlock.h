@@ -0,0 +1,108 @@
+/*
+ * kernel/mcs_spinlock.h
+ *
+ * MCS queue nodes: a waiter links its own node in behind the previous
+ * one and spins on the node's locked field, so every waiter spins on a
+ * cacheline of its own, and the waiter ahead of it hands over by writing
+ * that field.
+ *
+ * mcs_spin_lock() and mcs_spin_unlock() make a lock of just that, with a
+ * pointer to the queue tail for the lock word; the queued spinlocks only
+ * use the nodes, with a tail of their own.
+ */
+#ifndef __LINUX_MCS_SPINLOCK_H
+#define __LINUX_MCS_SPINLOCK_H
+
+#include <linux/compiler.h>
+#include <asm/system.h>
+#include <asm/processor.h>
+
+struct mcs_spinlock {
+	struct mcs_spinlock *next;
+	int locked;		/* 1 once the lock has been handed to us */
+	int count;		/* nesting count, see qspinlock.c */
+};
+
+/* Architectures without their own get full barriers */
+#ifndef smp_load_acquire
+#define smp_load_acquire(p)						\
+({									\
+	typeof(*p) ___p1 = ACCESS_ONCE(*p);				\
+	smp_mb();							\
+	___p1;								\
+})
+#endif
+
+#ifndef smp_store_release
+#define smp_store_release(p, v)						\
+do {									\
+	smp_mb();							\
+	ACCESS_ONCE(*p) = (v);						\
+} while (0)
+#endif
+
+/*
+ * Wait for the node ahead to hand over; the acquire keeps the critical
+ * section from leaking out in front of the handover.
+ */
+#define mcs_spin_lock_contended(l)					\
+do {									\
+	while (!(smp_load_acquire(l)))					\
+		cpu_relax();						\
+} while (0)
+
+/* Hand over to the node behind, after the critical section is done */
+#define mcs_spin_unlock_contended(l)					\
+	smp_store_release((l), 1)
+
+/*
+ * Queue @node up on @lock, and spin until it reaches the head.  Callers
+ * keep preemption disabled until mcs_spin_unlock(), the waiters behind
+ * them spin until then.
+ */
+static inline
+void mcs_spin_lock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *prev;
+
+	node->locked = 0;
+	node->next = NULL;
+
+	/* xchg() orders the node's initialisation before its publication */
+	prev = xchg(lock, node);
+	if (likely(prev == NULL)) {
+		/*
+		 * The queue was empty, the lock is ours: nobody looks at
+		 * node->locked of the head of the queue.
+		 */
+		return;
+	}
+	ACCESS_ONCE(prev->next) = node;
+
+	/* Wait until the lock holder passes the lock down */
+	mcs_spin_lock_contended(&node->locked);
+}
+
+/*
+ * Pass the lock on to the next node in the queue, or empty the queue if
+ * @node is the last one.
+ */
+static inline
+void mcs_spin_unlock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next = ACCESS_ONCE(node->next);
+
+	if (likely(!next)) {
+		/* Release the lock by setting it to NULL */
+		if (likely(cmpxchg(lock, node, NULL) == node))
+			return;
+		/* Someone is queueing up behind us, wait for the link */
+		while (!(next = ACCESS_ONCE(node->next)))
+			cpu_relax();
+	}
+
+	/* Pass the lock to the next waiter */
+	mcs_spin_unlock_contended(&next->locked);
+}
+
+#endif /* __LINUX_MCS_SPINLOCK_H */
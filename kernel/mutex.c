@@ -23,6 +23,12 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/debug_locks.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/init.h>
+
+#include "mcs_spinlock.h"
 
 /*
  * In the DEBUG case we are using the "NULL fastpath" for mutexes,
@@ -43,6 +49,9 @@ __mutex_init(struct mutex *lock, const char *name, struct lock_class_key *key)
 	spin_lock_init(&lock->wait_lock);
 	INIT_LIST_HEAD(&lock->wait_list);
 	mutex_clear_owner(lock);
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+	lock->mcs_lock = NULL;
+#endif
 
 	debug_mutex_init(lock, name, key);
 }
@@ -126,6 +135,96 @@ void __sched mutex_unlock(struct mutex *lock)
 
 EXPORT_SYMBOL(mutex_unlock);
 
+#ifdef CONFIG_MUTEX_SPIN_STATS
+/*
+ * How optimistic spinning fares, summed over all mutexes: acquired while
+ * spinning, gave up spinning, or did not even start because the owner
+ * was not running.
+ */
+enum mutex_spin_item {
+	MUTEX_SPIN_ACQUIRED,
+	MUTEX_SPIN_FAILED,
+	MUTEX_SPIN_SKIPPED,
+	NR_MUTEX_SPIN_ITEMS
+};
+
+struct mutex_spin_stats {
+	unsigned long item[NR_MUTEX_SPIN_ITEMS];
+};
+
+static DEFINE_PER_CPU(struct mutex_spin_stats, mutex_spin_stats);
+
+static const char * const mutex_spin_item_names[] = {
+	"spin_acquired",
+	"spin_failed",
+	"spin_skipped",
+};
+
+#define mutex_spin_stat(i)	this_cpu_inc(mutex_spin_stats.item[i])
+
+static int mutex_spin_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long sum;
+	int i, cpu;
+
+	for (i = 0; i < NR_MUTEX_SPIN_ITEMS; i++) {
+		sum = 0;
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(mutex_spin_stats, cpu).item[i];
+		seq_printf(m, "%s %lu\n", mutex_spin_item_names[i], sum);
+	}
+	return 0;
+}
+
+static int mutex_spin_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mutex_spin_stats_show, NULL);
+}
+
+static const struct file_operations mutex_spin_stats_fops = {
+	.open		= mutex_spin_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init mutex_spin_stats_init(void)
+{
+	debugfs_create_file("mutex_spin_stats", 0444, NULL, NULL,
+			    &mutex_spin_stats_fops);
+	return 0;
+}
+late_initcall(mutex_spin_stats_init);
+#else
+#define mutex_spin_stat(i)	do { } while (0)
+#endif
+
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+/*
+ * Initial check for entering the spin loop: not worth it if the owner is
+ * not running, or if we should be rescheduling anyway.
+ */
+static inline int mutex_can_spin_on_owner(struct mutex *lock)
+{
+	struct task_struct *owner;
+	int retval = 1;
+
+	if (need_resched())
+		return 0;
+
+	rcu_read_lock();
+	owner = ACCESS_ONCE(lock->owner);
+	if (owner)
+		retval = owner->on_cpu;
+	rcu_read_unlock();
+	/*
+	 * If lock->owner is not set, the mutex owner may have just acquired
+	 * it and not set the owner yet, or the mutex has been released.
+	 */
+	return retval;
+}
+#endif
+
 /*
  * Lock a mutex (possibly interruptible), slowpath:
  */
@@ -157,25 +256,43 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 	 *
 	 * We can't do this for DEBUG_MUTEXES because that relies on wait_lock
 	 * to serialize everything.
+	 *
+	 * The spinners queue up on an MCS lock, so that only the one at
+	 * the head of the queue polls the owner and the count, instead of
+	 * all of them hammering the mutex's cacheline at once.
 	 */
+	if (!mutex_can_spin_on_owner(lock)) {
+		mutex_spin_stat(MUTEX_SPIN_SKIPPED);
+		goto slowpath;
+	}
 
 	for (;;) {
 		struct task_struct *owner;
+		struct mcs_spinlock node;
+
+		mcs_spin_lock(&lock->mcs_lock, &node);
 
 		/*
 		 * If there's an owner, wait for it to either
 		 * release the lock or go to sleep.
 		 */
 		owner = ACCESS_ONCE(lock->owner);
-		if (owner && !mutex_spin_on_owner(lock, owner))
+		if (owner && !mutex_spin_on_owner(lock, owner)) {
+			mcs_spin_unlock(&lock->mcs_lock, &node);
 			break;
+		}
 
-		if (atomic_cmpxchg(&lock->count, 1, 0) == 1) {
+		/* Only cmpxchg when the mutex looks free, to save bouncing */
+		if (atomic_read(&lock->count) == 1 &&
+		    atomic_cmpxchg(&lock->count, 1, 0) == 1) {
 			lock_acquired(&lock->dep_map, ip);
 			mutex_set_owner(lock);
+			mcs_spin_unlock(&lock->mcs_lock, &node);
+			mutex_spin_stat(MUTEX_SPIN_ACQUIRED);
 			preempt_enable();
 			return 0;
 		}
+		mcs_spin_unlock(&lock->mcs_lock, &node);
 
 		/*
 		 * When there's no owner, we might have preempted between the
@@ -194,6 +311,8 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 		 */
 		arch_mutex_cpu_relax();
 	}
+	mutex_spin_stat(MUTEX_SPIN_FAILED);
+slowpath:
 #endif
 	spin_lock_mutex(&lock->wait_lock, flags);
 
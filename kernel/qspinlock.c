@@ -0,0 +1,296 @@
+/*
+ * kernel/qspinlock.c
+ *
+ * Queued spinlocks: the contended path.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A queued spinlock is a 32-bit word holding the locked byte, a pending
+ * bit and the tail of a queue of MCS nodes, one per waiting cpu.  The
+ * owner never needs to know about the waiters: it takes the lock with a
+ * cmpxchg of the whole word and drops it by clearing the locked byte.
+ *
+ * The first contender does not queue, it sets the pending bit and spins
+ * on the lock word until the owner is gone; that saves touching a queue
+ * node, which is another cacheline, when there is only the one.  Anyone
+ * contending beyond that queues: it takes an MCS node of its cpu's, swaps
+ * its (cpu, index) encoding into the tail, links the node behind the
+ * previous tail's and spins on its own node's locked field until that
+ * one hands over.  At the head of the queue it spins on the lock word
+ * until both owner and pending are gone, takes the lock and passes the
+ * head on to the next node.  So whatever the number of waiters, at most
+ * two cpus spin on the lock word, and everybody else on their own line.
+ *
+ * A cpu can hold a queue node in each of task, softirq, hardirq and NMI
+ * context at once, so it has four; which one is in use is in the tail
+ * encoding.  The cpu number is stored plus one, so that a zero tail
+ * means no queue.
+ */
+
+#include <linux/smp.h>
+#include <linux/bug.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/hardirq.h>
+#include <linux/export.h>
+#include <linux/spinlock.h>
+#include <asm/byteorder.h>
+
+#include "mcs_spinlock.h"
+
+#define MAX_NODES	4
+
+static DEFINE_PER_CPU_ALIGNED(struct mcs_spinlock, mcs_nodes[MAX_NODES]);
+
+/*
+ * The lock word as bytes and halfwords.  The pending bit and the tail
+ * each have a byte and a halfword to themselves, which lets a waiter
+ * clear pending and set locked in one store, and swap the tail without
+ * a cmpxchg loop.
+ */
+struct __qspinlock {
+	union {
+		atomic_t val;
+#ifdef __LITTLE_ENDIAN
+		struct {
+			u8	locked;
+			u8	pending;
+		};
+		struct {
+			u16	locked_pending;
+			u16	tail;
+		};
+#else
+		struct {
+			u16	tail;
+			u16	locked_pending;
+		};
+		struct {
+			u8	reserved[2];
+			u8	pending;
+			u8	locked;
+		};
+#endif
+	};
+};
+
+static inline u32 encode_tail(int cpu, int idx)
+{
+	u32 tail;
+
+	tail  = (cpu + 1) << _Q_TAIL_CPU_OFFSET;
+	tail |= idx << _Q_TAIL_IDX_OFFSET;	/* assume < 4 */
+
+	return tail;
+}
+
+static inline struct mcs_spinlock *decode_tail(u32 tail)
+{
+	int cpu = (tail >> _Q_TAIL_CPU_OFFSET) - 1;
+	int idx = (tail &  _Q_TAIL_IDX_MASK) >> _Q_TAIL_IDX_OFFSET;
+
+	return per_cpu_ptr(&mcs_nodes[idx], cpu);
+}
+
+/*
+ * *,1,0 -> *,0,1
+ *
+ * The triplets are (tail, pending, locked).  Only the pending waiter gets
+ * here, and nobody else writes the low halfword while pending is set.
+ */
+static __always_inline void clear_pending_set_locked(struct qspinlock *lock)
+{
+	struct __qspinlock *l = (void *)lock;
+
+	ACCESS_ONCE(l->locked_pending) = _Q_LOCKED_VAL;
+}
+
+/*
+ * xchg(lock, tail)
+ *
+ * p,*,* -> n,*,* ; returns the previous tail, in the lock word's position
+ */
+static __always_inline u32 xchg_tail(struct qspinlock *lock, u32 tail)
+{
+	struct __qspinlock *l = (void *)lock;
+
+	return (u32)xchg(&l->tail, tail >> _Q_TAIL_OFFSET) << _Q_TAIL_OFFSET;
+}
+
+/*
+ * *,*,0 -> *,*,1
+ *
+ * Only the queue head gets here, once owner and pending are gone.
+ */
+static __always_inline void set_locked(struct qspinlock *lock)
+{
+	struct __qspinlock *l = (void *)lock;
+
+	ACCESS_ONCE(l->locked) = _Q_LOCKED_VAL;
+}
+
+/**
+ * queued_spin_lock_slowpath - acquire a queued spinlock under contention
+ * @lock: the lock
+ * @val: the lock word the fast path's cmpxchg found
+ *
+ * (queue tail, pending bit, lock value)
+ *
+ *              fast     :    slow                                  :    unlock
+ *                       :                                          :
+ * uncontended  (0,0,0) -:--> (0,0,1) ------------------------------:--> (*,*,0)
+ *                       :       | ^--------.------.             /  :
+ *                       :       v           \      \            |  :
+ * pending               :    (0,1,1) +--> (0,1,0)   \           |  :
+ *                       :       | ^--'              |           |  :
+ *                       :       v                   |           |  :
+ * uncontended           :    (n,x,y) +--> (n,0,0) --'           |  :
+ *   queue               :       | ^--'                          |  :
+ *                       :       v                               |  :
+ * contended             :    (*,x,y) +--> (*,0,0) ---> (*,0,1) -'  :
+ *   queue               :         ^--'                             :
+ */
+void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
+{
+	struct mcs_spinlock *prev, *next, *node;
+	u32 new, old, tail;
+	int idx;
+
+	BUILD_BUG_ON(CONFIG_NR_CPUS >= (1U << _Q_TAIL_CPU_BITS));
+
+	/*
+	 * Wait for an in-progress pending->locked handover.
+	 *
+	 * 0,1,0 -> 0,0,1
+	 */
+	if (val == _Q_PENDING_VAL) {
+		while ((val = atomic_read(&lock->val)) == _Q_PENDING_VAL)
+			cpu_relax();
+	}
+
+	/*
+	 * trylock || pending
+	 *
+	 * 0,0,0 -> 0,0,1 ; trylock
+	 * 0,0,1 -> 0,1,1 ; pending
+	 */
+	for (;;) {
+		/* Anybody waiting already: queue behind them */
+		if (val & ~_Q_LOCKED_MASK)
+			goto queue;
+
+		new = _Q_LOCKED_VAL;
+		if (val == new)
+			new |= _Q_PENDING_VAL;
+
+		old = atomic_cmpxchg(&lock->val, val, new);
+		if (old == val)
+			break;
+
+		val = old;
+	}
+
+	/* We won the trylock */
+	if (new == _Q_LOCKED_VAL)
+		return;
+
+	/*
+	 * We are pending, wait for the owner to go away.
+	 *
+	 * *,1,1 -> *,1,0
+	 */
+	while ((val = smp_load_acquire(&lock->val.counter)) & _Q_LOCKED_MASK)
+		cpu_relax();
+
+	/*
+	 * Take ownership and clear the pending bit.
+	 *
+	 * *,1,0 -> *,0,1
+	 */
+	clear_pending_set_locked(lock);
+	return;
+
+	/*
+	 * End of pending bit optimistic spinning and beginning of MCS
+	 * queuing.
+	 */
+queue:
+	node = this_cpu_ptr(&mcs_nodes[0]);
+	idx = node->count++;
+	tail = encode_tail(smp_processor_id(), idx);
+
+	node += idx;
+	node->locked = 0;
+	node->next = NULL;
+
+	/*
+	 * The owner may have gone while we set the node up, in which case
+	 * there is no point queueing.
+	 */
+	if (queued_spin_trylock(lock))
+		goto release;
+
+	/*
+	 * Publish the updated tail.  The node must be initialised before
+	 * anybody can find it through the tail; xchg() is a full barrier.
+	 *
+	 * p,*,* -> n,*,*
+	 */
+	old = xchg_tail(lock, tail);
+
+	/*
+	 * If there was a previous node, link it and wait until reaching
+	 * the head of the queue.
+	 */
+	if (old & _Q_TAIL_MASK) {
+		prev = decode_tail(old);
+		ACCESS_ONCE(prev->next) = node;
+
+		mcs_spin_lock_contended(&node->locked);
+	}
+
+	/*
+	 * We are at the head of the queue: wait for the owner and the
+	 * pending waiter to go away.
+	 *
+	 * *,x,y -> *,0,0
+	 */
+	while ((val = smp_load_acquire(&lock->val.counter)) &
+			_Q_LOCKED_PENDING_MASK)
+		cpu_relax();
+
+	/*
+	 * Claim the lock.  If we are the tail as well, the queue goes away
+	 * with the same cmpxchg; if someone queued behind us meanwhile,
+	 * only the locked byte is ours to set, and the tail stays theirs.
+	 *
+	 * n,0,0 -> 0,0,1 : lock, uncontended
+	 * *,0,0 -> *,0,1 : lock, contended
+	 */
+	for (;;) {
+		if (val != tail) {
+			set_locked(lock);
+			break;
+		}
+		old = atomic_cmpxchg(&lock->val, val, _Q_LOCKED_VAL);
+		if (old == val)
+			goto release;	/* No contention */
+
+		val = old;
+	}
+
+	/* Contended: wait for the next node to link in, and hand over */
+	while (!(next = ACCESS_ONCE(node->next)))
+		cpu_relax();
+
+	mcs_spin_unlock_contended(&next->locked);
+
+release:
+	/*
+	 * Release the node.
+	 */
+	this_cpu_dec(mcs_nodes[0].count);
+}
+EXPORT_SYMBOL(queued_spin_lock_slowpath);
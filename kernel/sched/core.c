@@ -1697,6 +1697,18 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->numa_scan_seq = p->mm ? p->mm->numa_scan_seq : 0;
+	p->numa_preferred_nid = -1;
+	p->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+	p->numa_work_pending = 0;
+	p->node_stamp = 0;
+	p->numa_faults_local = 0;
+	p->numa_faults_remote = 0;
+	p->numa_pages_migrated = 0;
+	p->numa_migrated_seen = 0;
+#endif
 }
 
 /*
@@ -2535,6 +2547,20 @@ unlock:
 	raw_spin_unlock_irqrestore(&p->pi_lock, flags);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Move the current task to @dest_cpu, on the node NUMA balancing found
+ * most of its memory on.
+ */
+void migrate_current_to(int dest_cpu)
+{
+	struct migration_arg arg = { current, dest_cpu };
+
+	if (dest_cpu != task_cpu(current) && cpu_active(dest_cpu))
+		stop_one_cpu(task_cpu(current), migration_cpu_stop, &arg);
+}
+#endif
+
 #endif
 
 DEFINE_PER_CPU(struct kernel_stat, kstat);
@@ -486,6 +486,13 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_preferred_nid);
+	P(numa_scan_period);
+	P(numa_faults_local);
+	P(numa_faults_remote);
+	P(numa_pages_migrated);
+#endif
 #undef PN
 #undef __PN
 #undef P
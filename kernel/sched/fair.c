@@ -26,6 +26,7 @@
 #include <linux/slab.h>
 #include <linux/profile.h>
 #include <linux/interrupt.h>
+#include <linux/mempolicy.h>
 
 #include <trace/events/sched.h>
 
@@ -2328,6 +2329,238 @@ static unsigned long target_load(int cpu, int type)
 	return max(rq->cpu_load[type-1], total);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing: the address space of a task is made PROT_NONE
+ * a chunk at a time, and the hinting faults taken when the task touches
+ * it again tell which nodes its memory is on.  The task is moved to the
+ * node it faults on most, and the pages it then faults on from that node
+ * are migrated to it.
+ */
+int sysctl_numa_balancing;
+
+/* delay before the first scan of a new address space */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+/* bounds of the per-task period between two scanned chunks */
+unsigned int sysctl_numa_balancing_scan_period_min = 100;
+unsigned int sysctl_numa_balancing_scan_period_max = 100*16;
+
+/* size of a chunk, in MB */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/*
+ * Would moving @p from @src_cpu to @dst_cpu take it off the node its
+ * memory is on?
+ */
+static inline int numa_leaves_preferred(struct task_struct *p,
+					int src_cpu, int dst_cpu)
+{
+	int nid = p->numa_preferred_nid;
+
+	return sysctl_numa_balancing && nid != -1 &&
+	       cpu_to_node(src_cpu) == nid && cpu_to_node(dst_cpu) != nid;
+}
+
+/*
+ * Move @p, which must be current, to the least loaded cpu of @nid, as
+ * long as that does not leave it busier than the cpu @p runs on now.
+ */
+static void task_numa_migrate(struct task_struct *p, int nid)
+{
+	unsigned long load, min_load = ULONG_MAX;
+	int cpu, dest_cpu = -1;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), tsk_cpus_allowed(p)) {
+		if (!cpu_active(cpu))
+			continue;
+		load = weighted_cpuload(cpu);
+		if (load < min_load) {
+			min_load = load;
+			dest_cpu = cpu;
+		}
+	}
+
+	if (dest_cpu == -1 ||
+	    min_load + p->se.load.weight > weighted_cpuload(task_cpu(p)))
+		return;
+
+	migrate_current_to(dest_cpu);
+}
+
+/*
+ * Called from the first hinting fault of each pass over the address
+ * space: pick the node with the most (decayed) faults as the preferred
+ * one, and adapt the scan period.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	int seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	unsigned long faults, max_faults = 0;
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid];
+		p->numa_faults[nid] = faults / 2;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	/*
+	 * Scan faster while pages are still being moved, and back off once
+	 * the placement has settled.
+	 */
+	if (p->numa_pages_migrated != p->numa_migrated_seen) {
+		p->numa_migrated_seen = p->numa_pages_migrated;
+		p->numa_scan_period = max(p->numa_scan_period / 2,
+				sysctl_numa_balancing_scan_period_min);
+	} else {
+		p->numa_scan_period = min(p->numa_scan_period * 2,
+				sysctl_numa_balancing_scan_period_max);
+	}
+
+	if (max_nid != -1)
+		p->numa_preferred_nid = max_nid;
+	if (p->numa_preferred_nid != -1 &&
+	    cpu_to_node(task_cpu(p)) != p->numa_preferred_nid)
+		task_numa_migrate(p, p->numa_preferred_nid);
+}
+
+/*
+ * Account a hinting fault of the current task on @pages pages, which are
+ * now on @node: @migrated if they were just moved there.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	/* kernel threads faulting through get_user_pages() have no placement */
+	if (!sysctl_numa_balancing || !p->mm)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL);
+		if (!p->numa_faults)
+			return;
+	}
+
+	task_numa_placement(p);
+
+	if (migrated || node != numa_node_id())
+		p->numa_faults_remote += pages;
+	else
+		p->numa_faults_local += pages;
+	if (migrated)
+		p->numa_pages_migrated += pages;
+	p->numa_faults[node] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+/*
+ * Called on the way back to user mode when task_tick_numa() asked for it:
+ * make the next sysctl_numa_balancing_scan_size MB of the address space
+ * PROT_NONE.  Only one thread of an mm scans in each period.
+ */
+void task_numa_work(void)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages;
+
+	p->numa_work_pending = 0;
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size << (20 - PAGE_SHIFT);
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		mm->numa_scan_seq++;
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) ||
+		    !(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			pages -= change_prot_numa(vma, start, end);
+			start = end;
+			if (pages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+out:
+	/* start the next pass from the beginning once past the last vma */
+	if (vma) {
+		mm->numa_scan_offset = start;
+	} else {
+		mm->numa_scan_offset = 0;
+		mm->numa_scan_seq++;
+	}
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Ask for the next chunk to be scanned once @curr has run for its scan
+ * period since the last request.  The scan itself needs mmap_sem, so it
+ * is done by task_numa_work() on the way back to user mode.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	if (!curr->mm || (curr->flags & PF_EXITING) || curr->numa_work_pending)
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+
+	if (now - curr->node_stamp > period) {
+		curr->node_stamp = now;
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			curr->numa_work_pending = 1;
+			set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+		}
+	}
+}
+#else
+static inline int numa_leaves_preferred(struct task_struct *p,
+					int src_cpu, int dst_cpu)
+{
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 static unsigned long power_of(int cpu)
 {
 	return cpu_rq(cpu)->cpu_power;
@@ -2724,7 +2957,8 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 		return prev_cpu;
 
 	if (sd_flag & SD_BALANCE_WAKE) {
-		if (cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+		if (cpumask_test_cpu(cpu, tsk_cpus_allowed(p)) &&
+		    !numa_leaves_preferred(p, prev_cpu, cpu))
 			want_affine = 1;
 		new_cpu = prev_cpu;
 	}
@@ -2779,7 +3013,9 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 	}
 
 	if (affine_sd) {
-		if (cpu == prev_cpu || wake_affine(affine_sd, p, sync))
+		/* pull a task back to the node its memory is on */
+		if (cpu == prev_cpu || numa_leaves_preferred(p, cpu, prev_cpu) ||
+		    wake_affine(affine_sd, p, sync))
 			prev_cpu = cpu;
 
 		new_cpu = select_idle_sibling(p, prev_cpu);
@@ -3159,6 +3395,14 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		return 0;
 	}
 
+	/*
+	 * Leave a task on the node its memory is on, unless balancing keeps
+	 * failing without moving it.
+	 */
+	if (numa_leaves_preferred(p, task_cpu(p), this_cpu) &&
+	    sd->nr_balance_failed <= sd->cache_nice_tries)
+		return 0;
+
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
@@ -5179,6 +5423,11 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+#ifdef CONFIG_NUMA_BALANCING
+	if (sysctl_numa_balancing)
+		task_tick_numa(rq, curr);
+#endif
 }
 
 /*
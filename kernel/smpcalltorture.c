@@ -0,0 +1,448 @@
+/*
+ * Module-based torture test facility for cross-cpu function calls
+ *
+ * Has nsenders kernel threads, bound to the first online cpus, call a
+ * function on ntargets of the other online cpus and wait for it to have
+ * run there, checking that every target ran it, and reports the average
+ * and worst cost of a call.  With more than one sender, the senders all
+ * target the same cpus, so their calls queue up behind each other.
+ * Loading it with increasing ntargets shows how the round trip grows
+ * with the number of cpus called.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Based on kernel/locktorture.c.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/smp.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/moduleparam.h>
+#include <linux/notifier.h>
+#include <linux/reboot.h>
+#include <linux/stat.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+
+MODULE_LICENSE("GPL");
+
+static int nsenders = 1;	/* # sender threads, one per cpu. */
+static int ntargets = -1;	/* # cpus called, defaults to all others. */
+static int stat_interval;	/* Interval between stats, in seconds. */
+				/*  Defaults to "only at end of test". */
+static int verbose;		/* Print more debug info. */
+static char *torture_type = "smp_call_many"; /* How to call the targets. */
+
+module_param(nsenders, int, 0444);
+MODULE_PARM_DESC(nsenders, "Number of cpus sending calls at once");
+module_param(ntargets, int, 0444);
+MODULE_PARM_DESC(ntargets, "Number of cpus called by each sender");
+module_param(stat_interval, int, 0644);
+MODULE_PARM_DESC(stat_interval, "Number of seconds between stats printk()s");
+module_param(verbose, bool, 0444);
+MODULE_PARM_DESC(verbose, "Enable verbose debugging printk()s");
+module_param(torture_type, charp, 0444);
+MODULE_PARM_DESC(torture_type, "Type of call to torture (smp_call_many, smp_call_single)");
+
+#define TORTURE_FLAG "-torture:"
+#define VERBOSE_PRINTK_STRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG s "\n", torture_type); } while (0)
+#define VERBOSE_PRINTK_ERRSTRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG "!!! " s "\n", torture_type); } while (0)
+
+static int nrealsenders;
+static int nrealtargets;
+static struct task_struct **sender_tasks;
+static struct task_struct *stats_task;
+static cpumask_var_t smp_call_targets;
+
+struct smp_call_sender_stats {
+	atomic_long_t n_received; /* Calls run on the targets. */
+	long n_expected;	/* Calls that should have run. */
+	long n_calls;
+	long n_lost;
+	u64 ns;
+	u64 max_ns;
+};
+static struct smp_call_sender_stats *scsa;
+
+static atomic_t n_smp_call_torture_errors;
+
+/* Mediate rmmod and system shutdown.  Concurrent rmmod & shutdown illegal! */
+
+#define FULLSTOP_DONTSTOP 0	/* Normal operation. */
+#define FULLSTOP_SHUTDOWN 1	/* System shutdown with smpcalltorture running. */
+#define FULLSTOP_RMMOD    2	/* Normal rmmod of smpcalltorture. */
+static int fullstop = FULLSTOP_RMMOD;
+/*
+ * Protect fullstop transitions and spawning of kthreads.
+ */
+static DEFINE_MUTEX(fullstop_mutex);
+
+/*
+ * Detect and respond to a system shutdown.
+ */
+static int
+smpcalltorture_shutdown_notify(struct notifier_block *unused1,
+			       unsigned long unused2, void *unused3)
+{
+	mutex_lock(&fullstop_mutex);
+	if (fullstop == FULLSTOP_DONTSTOP)
+		fullstop = FULLSTOP_SHUTDOWN;
+	else
+		printk(KERN_WARNING /* but going down anyway, so... */
+		       "Concurrent 'rmmod smpcalltorture' and shutdown illegal!\n");
+	mutex_unlock(&fullstop_mutex);
+	return NOTIFY_DONE;
+}
+
+/*
+ * Absorb kthreads into a kernel function that won't return, so that
+ * they won't ever access module text or data again.
+ */
+static void smpcalltorture_shutdown_absorb(char *title)
+{
+	if (ACCESS_ONCE(fullstop) == FULLSTOP_SHUTDOWN) {
+		printk(KERN_NOTICE
+		       "smpcalltorture thread %s parking due to system shutdown\n",
+		       title);
+		schedule_timeout_uninterruptible(MAX_SCHEDULE_TIMEOUT);
+	}
+}
+
+/*
+ * Operations vector for selecting different types of tests.  ->call
+ * is entered with preemption disabled and must not return before
+ * @func has run on every online cpu of @mask other than this one.
+ */
+
+struct smp_call_torture_ops {
+	void (*call)(const struct cpumask *mask, smp_call_func_t func,
+		     void *info);
+	char *name;
+};
+
+static struct smp_call_torture_ops *cur_ops;
+
+static void smp_call_torture_many(const struct cpumask *mask,
+				  smp_call_func_t func, void *info)
+{
+	smp_call_function_many(mask, func, info, true);
+}
+
+static struct smp_call_torture_ops smp_call_many_ops = {
+	.call	= smp_call_torture_many,
+	.name	= "smp_call_many"
+};
+
+static void smp_call_torture_single(const struct cpumask *mask,
+				    smp_call_func_t func, void *info)
+{
+	int this_cpu = smp_processor_id();
+	int cpu;
+
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		if (cpu != this_cpu)
+			smp_call_function_single(cpu, func, info, 1);
+}
+
+static struct smp_call_torture_ops smp_call_single_ops = {
+	.call	= smp_call_torture_single,
+	.name	= "smp_call_single"
+};
+
+static void smp_call_torture_func(void *info)
+{
+	struct smp_call_sender_stats *scsp = info;
+
+	atomic_long_inc(&scsp->n_received);
+}
+
+/*
+ * SMP call torture sender kthread.  Repeatedly calls the targets,
+ * timing each call and checking that every online target ran it.
+ */
+static int
+smp_call_torture_sender(void *arg)
+{
+	struct smp_call_sender_stats *scsp = arg;
+	int this_cpu, cpu;
+	u64 start, ns;
+
+	VERBOSE_PRINTK_STRING("smp_call_torture_sender task started");
+
+	do {
+		preempt_disable();
+		start = local_clock();
+		cur_ops->call(smp_call_targets, smp_call_torture_func, scsp);
+		ns = local_clock() - start;
+		/* The online mask cannot change while preemption is off. */
+		this_cpu = smp_processor_id();
+		for_each_cpu_and(cpu, smp_call_targets, cpu_online_mask)
+			if (cpu != this_cpu)
+				scsp->n_expected++;
+		preempt_enable();
+
+		if (atomic_long_read(&scsp->n_received) != scsp->n_expected) {
+			scsp->n_lost++;
+			atomic_long_set(&scsp->n_received, scsp->n_expected);
+		}
+		scsp->n_calls++;
+		scsp->ns += ns;
+		if (scsp->max_ns < ns)
+			scsp->max_ns = ns;
+		if (!(scsp->n_calls & 1023))
+			cond_resched();
+	} while (!kthread_should_stop() && fullstop == FULLSTOP_DONTSTOP);
+	VERBOSE_PRINTK_STRING("smp_call_torture_sender task stopping");
+	smpcalltorture_shutdown_absorb("smp_call_torture_sender");
+	while (!kthread_should_stop())
+		schedule_timeout_uninterruptible(1);
+	return 0;
+}
+
+/*
+ * Print torture statistics.  Caller must ensure that there is only
+ * one call to this function at a given time: the smp_call_torture_stats
+ * kthread while it runs, the init/cleanup functions otherwise.
+ */
+static void
+smp_call_torture_stats_print(void)
+{
+	long calls = 0, lost = 0;
+	u64 ns = 0, max_ns = 0;
+	int i;
+
+	for (i = 0; i < nrealsenders; i++) {
+		calls += scsa[i].n_calls;
+		lost += scsa[i].n_lost;
+		ns += scsa[i].ns;
+		if (max_ns < scsa[i].max_ns)
+			max_ns = scsa[i].max_ns;
+	}
+	printk(KERN_ALERT "%s" TORTURE_FLAG
+	       " Calls:  Total: %ld  ns/call avg: %llu  max: %llu"
+	       "  Lost: %ld %s\n",
+	       torture_type, calls, calls ? div64_u64(ns, calls) : 0,
+	       max_ns, lost, lost ? "!!!" : "");
+	if (lost) {
+		atomic_inc(&n_smp_call_torture_errors);
+		WARN_ON_ONCE(1);
+	}
+}
+
+/*
+ * Periodically prints torture statistics, if periodic statistics printing
+ * was specified via the stat_interval module parameter.
+ *
+ * No need to worry about fullstop here, since this one doesn't reference
+ * volatile state.
+ */
+static int
+smp_call_torture_stats(void *arg)
+{
+	VERBOSE_PRINTK_STRING("smp_call_torture_stats task started");
+	do {
+		schedule_timeout_interruptible(stat_interval * HZ);
+		smp_call_torture_stats_print();
+		smpcalltorture_shutdown_absorb("smp_call_torture_stats");
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("smp_call_torture_stats task stopping");
+	return 0;
+}
+
+static inline void
+smp_call_torture_print_module_parms(struct smp_call_torture_ops *cur_ops,
+				    char *tag)
+{
+	printk(KERN_ALERT "%s" TORTURE_FLAG
+	       "--- %s: nsenders=%d ntargets=%d stat_interval=%d verbose=%d\n",
+	       torture_type, tag, nrealsenders, nrealtargets, stat_interval,
+	       verbose);
+}
+
+static struct notifier_block smpcalltorture_shutdown_nb = {
+	.notifier_call = smpcalltorture_shutdown_notify,
+};
+
+static void
+smp_call_torture_cleanup(void)
+{
+	int i;
+
+	mutex_lock(&fullstop_mutex);
+	if (fullstop == FULLSTOP_SHUTDOWN) {
+		printk(KERN_WARNING /* but going down anyway, so... */
+		       "Concurrent 'rmmod smpcalltorture' and shutdown illegal!\n");
+		mutex_unlock(&fullstop_mutex);
+		return;
+	}
+	fullstop = FULLSTOP_RMMOD;
+	mutex_unlock(&fullstop_mutex);
+	unregister_reboot_notifier(&smpcalltorture_shutdown_nb);
+
+	if (sender_tasks) {
+		for (i = 0; i < nrealsenders; i++) {
+			if (sender_tasks[i]) {
+				VERBOSE_PRINTK_STRING(
+					"Stopping smp_call_torture_sender task");
+				kthread_stop(sender_tasks[i]);
+			}
+			sender_tasks[i] = NULL;
+		}
+		kfree(sender_tasks);
+		sender_tasks = NULL;
+	}
+
+	if (stats_task) {
+		VERBOSE_PRINTK_STRING("Stopping smp_call_torture_stats task");
+		kthread_stop(stats_task);
+	}
+	stats_task = NULL;
+
+	if (scsa) {
+		/* -After- the stats thread is stopped! */
+		smp_call_torture_stats_print();
+		kfree(scsa);
+		scsa = NULL;
+	}
+	free_cpumask_var(smp_call_targets);
+
+	if (atomic_read(&n_smp_call_torture_errors))
+		smp_call_torture_print_module_parms(cur_ops,
+						    "End of test: FAILURE");
+	else
+		smp_call_torture_print_module_parms(cur_ops,
+						    "End of test: SUCCESS");
+}
+
+static int __init
+smp_call_torture_init(void)
+{
+	int i, cpu, nr;
+	int firsterr = 0;
+	static struct smp_call_torture_ops *torture_ops[] = {
+		&smp_call_many_ops, &smp_call_single_ops,
+	};
+
+	mutex_lock(&fullstop_mutex);
+
+	/* Process args and tell the world that the torturer is on the job. */
+	for (i = 0; i < ARRAY_SIZE(torture_ops); i++) {
+		cur_ops = torture_ops[i];
+		if (strcmp(torture_type, cur_ops->name) == 0)
+			break;
+	}
+	if (i == ARRAY_SIZE(torture_ops)) {
+		printk(KERN_ALERT "smp-call-torture: invalid torture type: \"%s\"\n",
+		       torture_type);
+		printk(KERN_ALERT "smp-call-torture types:");
+		for (i = 0; i < ARRAY_SIZE(torture_ops); i++)
+			printk(KERN_ALERT " %s", torture_ops[i]->name);
+		printk(KERN_ALERT "\n");
+		mutex_unlock(&fullstop_mutex);
+		return -EINVAL;
+	}
+	if (!zalloc_cpumask_var(&smp_call_targets, GFP_KERNEL)) {
+		mutex_unlock(&fullstop_mutex);
+		return -ENOMEM;
+	}
+
+	/*
+	 * Senders go on the first nsenders online cpus, and call the
+	 * next ntargets of them.
+	 */
+	get_online_cpus();
+	nrealsenders = min(max(nsenders, 1), (int)num_online_cpus() - 1);
+	if (nrealsenders < 1) {
+		put_online_cpus();
+		printk(KERN_ALERT "smp-call-torture: needs two online cpus\n");
+		free_cpumask_var(smp_call_targets);
+		mutex_unlock(&fullstop_mutex);
+		return -EINVAL;
+	}
+	nrealtargets = num_online_cpus() - nrealsenders;
+	if (ntargets >= 0 && ntargets < nrealtargets)
+		nrealtargets = ntargets;
+	nr = 0;
+	for_each_online_cpu(cpu) {
+		if (nr++ < nrealsenders)
+			continue;
+		if (cpumask_weight(smp_call_targets) == nrealtargets)
+			break;
+		cpumask_set_cpu(cpu, smp_call_targets);
+	}
+	smp_call_torture_print_module_parms(cur_ops, "Start of test");
+	fullstop = FULLSTOP_DONTSTOP;
+
+	/* Initialize the statistics so that each run gets its own numbers. */
+
+	atomic_set(&n_smp_call_torture_errors, 0);
+	scsa = kzalloc(nrealsenders * sizeof(*scsa), GFP_KERNEL);
+	if (scsa == NULL) {
+		VERBOSE_PRINTK_ERRSTRING("scsa: Out of memory");
+		firsterr = -ENOMEM;
+		goto unwind;
+	}
+
+	/* Start up the kthreads. */
+
+	sender_tasks = kzalloc(nrealsenders * sizeof(sender_tasks[0]),
+			       GFP_KERNEL);
+	if (sender_tasks == NULL) {
+		VERBOSE_PRINTK_ERRSTRING("sender_tasks: Out of memory");
+		firsterr = -ENOMEM;
+		goto unwind;
+	}
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == nrealsenders)
+			break;
+		VERBOSE_PRINTK_STRING("Creating smp_call_torture_sender task");
+		sender_tasks[i] = kthread_create(smp_call_torture_sender,
+						 &scsa[i],
+						 "smp_call_torture_sender");
+		if (IS_ERR(sender_tasks[i])) {
+			firsterr = PTR_ERR(sender_tasks[i]);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create sender");
+			sender_tasks[i] = NULL;
+			goto unwind;
+		}
+		kthread_bind(sender_tasks[i], cpu);
+		wake_up_process(sender_tasks[i]);
+		i++;
+	}
+	if (stat_interval > 0) {
+		VERBOSE_PRINTK_STRING("Creating smp_call_torture_stats task");
+		stats_task = kthread_run(smp_call_torture_stats, NULL,
+					 "smp_call_torture_stats");
+		if (IS_ERR(stats_task)) {
+			firsterr = PTR_ERR(stats_task);
+			VERBOSE_PRINTK_ERRSTRING("Failed to create stats");
+			stats_task = NULL;
+			goto unwind;
+		}
+	}
+	put_online_cpus();
+	register_reboot_notifier(&smpcalltorture_shutdown_nb);
+	mutex_unlock(&fullstop_mutex);
+	return 0;
+
+unwind:
+	put_online_cpus();
+	mutex_unlock(&fullstop_mutex);
+	smp_call_torture_cleanup();
+	return firsterr;
+}
+
+module_init(smp_call_torture_init);
+module_exit(smp_call_torture_cleanup);
@@ -10,6 +10,7 @@
 #include <linux/mman.h>
 #include <linux/reboot.h>
 #include <linux/prctl.h>
+#include <linux/futex.h>
 #include <linux/highuid.h>
 #include <linux/fs.h>
 #include <linux/kmod.h>
@@ -1841,6 +1842,11 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			else
 				error = PR_MCE_KILL_DEFAULT;
 			break;
+		case PR_FUTEX_HASH:
+			if (arg4 | arg5)
+				return -EINVAL;
+			error = futex_hash_prctl(arg2, arg3);
+			break;
 		default:
 			error = -EINVAL;
 			break;
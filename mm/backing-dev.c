@@ -100,6 +100,8 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   "BdiDirtied:         %10lu kB\n"
 		   "BdiWritten:         %10lu kB\n"
 		   "BdiWriteBandwidth:  %10lu kBps\n"
+		   "BdiReadBandwidth:   %10lu kBps\n"
+		   "BdiReadLatency:     %10lu us\n"
 		   "b_dirty:            %10lu\n"
 		   "b_io:               %10lu\n"
 		   "b_more_io:          %10lu\n"
@@ -113,6 +115,8 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   (unsigned long) K(bdi_stat(bdi, BDI_DIRTIED)),
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITTEN)),
 		   (unsigned long) K(bdi->write_bandwidth),
+		   (unsigned long) K(bdi->read_bandwidth),
+		   bdi->read_latency,
 		   nr_dirty,
 		   nr_io,
 		   nr_more_io,
@@ -225,12 +229,31 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+static ssize_t read_ahead_adaptive_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	char *end;
+	unsigned int adaptive;
+	ssize_t ret = -EINVAL;
+
+	adaptive = simple_strtoul(buf, &end, 10);
+	if (*buf && (end[0] == '\0' || (end[0] == '\n' && end[1] == '\0')) &&
+	    adaptive <= 1) {
+		bdi->read_ahead_adaptive = adaptive;
+		ret = count;
+	}
+	return ret;
+}
+BDI_SHOW(read_ahead_adaptive, bdi->read_ahead_adaptive)
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RW(read_ahead_adaptive),
 	__ATTR_NULL,
 };
 
@@ -691,7 +714,21 @@ int bdi_init(struct backing_dev_info *bdi)
 	bdi->write_bandwidth = INIT_BW;
 	bdi->avg_write_bandwidth = INIT_BW;
 
-	err = prop_local_init_percpu(&bdi->completions);
+	bdi->read_ahead_adaptive = 0;
+	bdi->read_time_stamp = jiffies;
+	memset(&bdi->read_stamp, 0, sizeof(bdi->read_stamp));
+	bdi->read_bandwidth = 0;
+	bdi->read_latency = 0;
+
+	err = -ENOMEM;
+	bdi->read_stat = alloc_percpu(struct bdi_read_stat);
+	if (bdi->read_stat) {
+		err = prop_local_init_percpu(&bdi->completions);
+		if (err) {
+			free_percpu(bdi->read_stat);
+			bdi->read_stat = NULL;
+		}
+	}
 
 	if (err) {
 err:
@@ -736,6 +773,8 @@ void bdi_destroy(struct backing_dev_info *bdi)
 		percpu_counter_destroy(&bdi->bdi_stat[i]);
 
 	prop_local_destroy_percpu(&bdi->completions);
+	free_percpu(bdi->read_stat);
+	bdi->read_stat = NULL;
 }
 EXPORT_SYMBOL(bdi_destroy);
 
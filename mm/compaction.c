@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -37,6 +39,7 @@ struct compact_control {
 
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
+	unsigned long nr_blocks;	/* kcompactd: free blocks wanted */
 	struct zone *zone;
 };
 
@@ -425,6 +428,20 @@ static void update_nr_listpages(struct compact_control *cc)
 	cc->nr_freepages = nr_freepages;
 }
 
+/*
+ * Number of free blocks of the given order in the zone, counting larger
+ * free blocks as several.  Read without zone->lock, so only a hint.
+ */
+static unsigned long zone_free_blocks(struct zone *zone, unsigned int order)
+{
+	unsigned long nr = 0;
+	unsigned int o;
+
+	for (o = order; o < MAX_ORDER; o++)
+		nr += zone->free_area[o].nr_free << (o - order);
+	return nr;
+}
+
 static int compact_finished(struct zone *zone,
 			    struct compact_control *cc)
 {
@@ -452,6 +469,13 @@ static int compact_finished(struct zone *zone,
 	if (!zone_watermark_ok(zone, cc->order, watermark, 0, 0))
 		return COMPACT_CONTINUE;
 
+	/* kcompactd: are there enough free blocks of the target order? */
+	if (cc->nr_blocks) {
+		if (zone_free_blocks(zone, cc->order) >= cc->nr_blocks)
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		/* Job done if page is free of the right migratetype */
@@ -518,6 +542,8 @@ unsigned long compaction_suitable(struct zone *zone, int order)
 
 static int compact_zone(struct zone *zone, struct compact_control *cc)
 {
+	unsigned long start_pfn, end_pfn;
+	bool whole_zone;
 	int ret;
 
 	ret = compaction_suitable(zone, cc->order);
@@ -531,17 +557,39 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 		;
 	}
 
-	/* Setup to move all movable pages to the end of the zone */
-	cc->migrate_pfn = zone->zone_start_pfn;
-	cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
-	cc->free_pfn &= ~(pageblock_nr_pages-1);
+	/*
+	 * Setup to move all movable pages to the end of the zone.  Compaction
+	 * for a high-order page resumes where the last run stopped, unless the
+	 * scanners met or the cached positions are out of the zone.  A resumed
+	 * run has only covered part of the zone when its scanners meet: it
+	 * starts again from the zone boundaries then, so that COMPACT_COMPLETE
+	 * always means a full pass.
+	 */
+	start_pfn = zone->zone_start_pfn;
+	end_pfn = (start_pfn + zone->spanned_pages) & ~(pageblock_nr_pages-1);
+	cc->migrate_pfn = zone->compact_cached_migrate_pfn;
+	cc->free_pfn = zone->compact_cached_free_pfn;
+	if (cc->order == -1 || cc->migrate_pfn < start_pfn ||
+	    cc->free_pfn > end_pfn || cc->free_pfn <= cc->migrate_pfn) {
+		cc->migrate_pfn = start_pfn;
+		cc->free_pfn = end_pfn;
+	}
+	whole_zone = cc->migrate_pfn == start_pfn && cc->free_pfn == end_pfn;
 
 	migrate_prep_local();
 
-	while ((ret = compact_finished(zone, cc)) == COMPACT_CONTINUE) {
+	while ((ret = compact_finished(zone, cc)) == COMPACT_CONTINUE ||
+	       (ret == COMPACT_COMPLETE && !whole_zone)) {
 		unsigned long nr_migrate, nr_remaining;
 		int err;
 
+		if (ret == COMPACT_COMPLETE) {
+			cc->migrate_pfn = start_pfn;
+			cc->free_pfn = end_pfn;
+			whole_zone = true;
+			continue;
+		}
+
 		switch (isolate_migratepages(zone, cc)) {
 		case ISOLATE_ABORT:
 			ret = COMPACT_PARTIAL;
@@ -579,6 +627,21 @@ out:
 	cc->nr_freepages -= release_freepages(&cc->freepages);
 	VM_BUG_ON(cc->nr_freepages != 0);
 
+	if (cc->order != -1) {
+		/* Start from the zone boundaries again once the scanners met */
+		if (ret == COMPACT_COMPLETE) {
+			zone->compact_cached_migrate_pfn = start_pfn;
+			zone->compact_cached_free_pfn = end_pfn;
+		} else {
+			zone->compact_cached_migrate_pfn = cc->migrate_pfn;
+			zone->compact_cached_free_pfn = cc->free_pfn;
+		}
+
+		zone->compact_attempts++;
+		if (ret == COMPACT_PARTIAL)
+			zone->compact_success++;
+	}
+
 	return ret;
 }
 
@@ -649,6 +712,180 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	return rc;
 }
 
+/*
+ * Background compaction
+ *
+ * Each node has a kcompactd thread.  It is woken when the page allocator
+ * wakes kswapd for a high-order allocation, and compacts the node's zones
+ * until an allocation of that order would succeed.  If
+ * vm.kcompactd_free_blocks is set, it also wakes up every
+ * vm.kcompactd_sleep_millisecs and compacts zones that have fewer free
+ * blocks of order vm.kcompactd_order than that.
+ *
+ * kcompactd only uses asynchronous migration, and backs off from zones
+ * where compaction failed through defer_compaction(), so it never waits
+ * on page writeback or locks held by the workload.
+ */
+int sysctl_kcompactd_order;
+int sysctl_kcompactd_free_blocks;
+int sysctl_kcompactd_sleep_millisecs = 500;
+
+static bool kcompactd_zone_ok(struct zone *zone, int order,
+			      unsigned long nr_blocks)
+{
+	if (nr_blocks)
+		return zone_free_blocks(zone, order) >= nr_blocks;
+	return zone_watermark_ok(zone, order, low_wmark_pages(zone), 0, 0);
+}
+
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	unsigned long nr_blocks = 0;
+	int order, classzone_idx;
+	int zoneid;
+
+	order = pgdat->kcompactd_max_order;
+	classzone_idx = pgdat->kcompactd_classzone_idx;
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	if (!order) {
+		/* Periodic wakeup: maintain the free block target */
+		nr_blocks = ACCESS_ONCE(sysctl_kcompactd_free_blocks);
+		if (!nr_blocks)
+			return;
+		order = sysctl_kcompactd_order;
+		classzone_idx = pgdat->nr_zones - 1;
+	}
+
+	count_vm_event(KCOMPACTD_WAKE);
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.nr_blocks = nr_blocks,
+			.zone = zone,
+			.sync = false,
+		};
+
+		if (!populated_zone(zone))
+			continue;
+		if (kcompactd_zone_ok(zone, order, nr_blocks))
+			continue;
+		if (compaction_deferred(zone))
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		if (compact_zone(zone, &cc) == COMPACT_SKIPPED)
+			continue;
+
+		if (!kcompactd_zone_ok(zone, order, nr_blocks))
+			defer_compaction(zone);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (kthread_should_stop())
+			return;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	while (!kthread_should_stop()) {
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+
+		if (sysctl_kcompactd_free_blocks)
+			timeout = msecs_to_jiffies(
+					sysctl_kcompactd_sleep_millisecs);
+
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				pgdat->kcompactd_max_order ||
+				kthread_should_stop(), timeout);
+		if (kthread_should_stop())
+			break;
+
+		kcompactd_do_work(pgdat);
+	}
+
+	return 0;
+}
+
+/*
+ * A high-order allocation on this node fell below the low watermark, so
+ * compact in the background what kswapd cannot provide by reclaiming.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * Started by init and memory hot-add, stopped by memory hot-remove, like
+ * kswapd.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	if (!sysctl_kcompactd_order)
+		sysctl_kcompactd_order = pageblock_order;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
 
 /* Compact all zones within a node */
 static int compact_node(int nid)
@@ -712,6 +949,21 @@ int sysctl_compaction_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/* Let sleeping kcompactd threads pick up a new free block target */
+int sysctl_kcompactd_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret, nid;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		wake_up_interruptible(&NODE_DATA(nid)->kcompactd_wait);
+	return 0;
+}
+
 int sysctl_extfrag_handler(struct ctl_table *table, int write,
 			void __user *buffer, size_t *length, loff_t *ppos)
 {
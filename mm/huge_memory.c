@@ -17,6 +17,7 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/shmem_fs.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -45,7 +46,7 @@ static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
-static struct task_struct *khugepaged_thread __read_mostly;
+static unsigned int khugepaged_nr_threads __read_mostly = 1;
 static DEFINE_MUTEX(khugepaged_mutex);
 static DEFINE_SPINLOCK(khugepaged_mm_lock);
 static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
@@ -56,7 +57,7 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
 
-static int khugepaged(void *none);
+static int khugepaged(void *arg);
 static int mm_slots_hash_init(void);
 static int khugepaged_slab_init(void);
 static void khugepaged_slab_free(void);
@@ -68,31 +69,52 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
 /**
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
- * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @rb_node: node in khugepaged_queue, while no worker is scanning the mm
  * @mm: the mm that this information is valid for
+ * @address: the next address inside the mm to be scanned
+ * @benefit: estimated number of anon pages not yet mapped by huge pmds
+ * @nr_huge: huge pmds seen so far in the current pass over the mm
+ * @round: the pass of khugepaged_queue this mm is queued for
+ * @busy: a khugepaged worker is scanning the mm
  */
 struct mm_slot {
 	struct hlist_node hash;
-	struct list_head mm_node;
+	struct rb_node rb_node;
 	struct mm_struct *mm;
+	unsigned long address;
+	unsigned long benefit;
+	unsigned long nr_huge;
+	unsigned int round;
+	bool busy;
 };
 
+/*
+ * The mms registered with khugepaged are kept in khugepaged_queue, sorted
+ * by the pass they are queued for and then by decreasing benefit, so that
+ * every mm is scanned once per pass and the mms with the most to gain are
+ * scanned first.  A worker takes the first mm_slot off the queue, scans
+ * up to pages_to_scan of it and queues it again, for the next pass once
+ * it has scanned the whole mm.
+ */
+static struct rb_root khugepaged_queue = RB_ROOT;
+static unsigned int khugepaged_round;
+
+#define KHUGEPAGED_MAX_THREADS	16
+
 /**
- * struct khugepaged_scan - cursor for scanning
- * @mm_head: the head of the mm list to scan
- * @mm_slot: the current mm_slot we are scanning
- * @address: the next address inside that to be scanned
- *
- * There is only the one khugepaged_scan instance of this cursor structure.
+ * struct khugepaged_worker - one of the khugepaged threads
+ * @task: the thread, NULL if not running
+ * @id: index of the worker, threads with id >= threads exit
+ * @node_load: pages of the pmd being scanned on each node
  */
-struct khugepaged_scan {
-	struct list_head mm_head;
-	struct mm_slot *mm_slot;
-	unsigned long address;
-};
-static struct khugepaged_scan khugepaged_scan = {
-	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+struct khugepaged_worker {
+	struct task_struct *task;
+	int id;
+#ifdef CONFIG_NUMA
+	int node_load[MAX_NUMNODES];
+#endif
 };
+static struct khugepaged_worker khugepaged_workers[KHUGEPAGED_MAX_THREADS];
 
 
 static int set_recommended_min_free_kbytes(void)
@@ -139,22 +161,34 @@ static int start_khugepaged(void)
 {
 	int err = 0;
 	if (khugepaged_enabled()) {
-		int wakeup;
+		int wakeup, i;
 		if (unlikely(!mm_slot_cache || !mm_slots_hash)) {
 			err = -ENOMEM;
 			goto out;
 		}
 		mutex_lock(&khugepaged_mutex);
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (unlikely(IS_ERR(khugepaged_thread))) {
-			printk(KERN_ERR
-			       "khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
+		for (i = 0; i < khugepaged_nr_threads; i++) {
+			struct khugepaged_worker *w = &khugepaged_workers[i];
+			struct task_struct *task;
+
+			if (w->task)
+				continue;
+			w->id = i;
+			if (i)
+				task = kthread_run(khugepaged, w,
+						   "khugepaged%d", i);
+			else
+				task = kthread_run(khugepaged, w,
+						   "khugepaged");
+			if (unlikely(IS_ERR(task))) {
+				printk(KERN_ERR
+				       "khugepaged: kthread_run(khugepaged) failed\n");
+				err = PTR_ERR(task);
+				break;
+			}
+			w->task = task;
 		}
-		wakeup = !list_empty(&khugepaged_scan.mm_head);
+		wakeup = !RB_EMPTY_ROOT(&khugepaged_queue);
 		mutex_unlock(&khugepaged_mutex);
 		if (wakeup)
 			wake_up_interruptible(&khugepaged_wait);
@@ -317,6 +351,9 @@ static struct attribute *hugepage_attr[] = {
 	&defrag_attr.attr,
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
+#endif
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
 #endif
 	NULL,
 };
@@ -422,6 +459,33 @@ static ssize_t full_scans_show(struct kobject *kobj,
 static struct kobj_attribute full_scans_attr =
 	__ATTR_RO(full_scans);
 
+static ssize_t threads_show(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_nr_threads);
+}
+static ssize_t threads_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int err;
+	unsigned long threads;
+
+	err = strict_strtoul(buf, 10, &threads);
+	if (err || !threads || threads > KHUGEPAGED_MAX_THREADS)
+		return -EINVAL;
+
+	khugepaged_nr_threads = threads;
+	/* start the new workers, and wake up the surplus ones to exit */
+	err = start_khugepaged();
+	wake_up_interruptible(&khugepaged_wait);
+
+	return err ? err : count;
+}
+static struct kobj_attribute threads_attr =
+	__ATTR(threads, 0644, threads_show, threads_store);
+
 static ssize_t khugepaged_defrag_show(struct kobject *kobj,
 				      struct kobj_attribute *attr, char *buf)
 {
@@ -478,6 +542,7 @@ static struct attribute *khugepaged_attr[] = {
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
 	&full_scans_attr.attr,
+	&threads_attr.attr,
 	&scan_sleep_millisecs_attr.attr,
 	&alloc_sleep_millisecs_attr.attr,
 	NULL,
@@ -751,6 +816,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
+	if (!PageAnon(src_page)) {
+		/* a file extent is mapped again by the child on fault */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
 	page_dup_rmap(src_page);
@@ -889,15 +960,24 @@ int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct page *page, *new_page;
 	unsigned long haddr;
 
-	VM_BUG_ON(!vma->anon_vma);
 	spin_lock(&mm->page_table_lock);
 	if (unlikely(!pmd_same(*pmd, orig_pmd)))
 		goto out_unlock;
 
 	page = pmd_page(orig_pmd);
-	VM_BUG_ON(!PageCompound(page) || !PageHead(page));
 	haddr = address & HPAGE_PMD_MASK;
-	if (page_mapcount(page) == 1) {
+	/*
+	 * A file extent can be made writable in place, like an exclusive
+	 * anon hugepage, in a shared mapping that doesn't track dirtying.
+	 * Otherwise split the pmd and let the write fault be retried on
+	 * the ptes, to copy or notify the filesystem page by page.
+	 */
+	if (!PageAnon(page) && (!(vma->vm_flags & VM_SHARED) ||
+				vma_wants_writenotify(vma))) {
+		split_file_huge_pmd(vma, address, pmd);
+		goto out_unlock;
+	}
+	if (!PageAnon(page) || page_mapcount(page) == 1) {
 		pmd_t entry;
 		entry = pmd_mkyoung(orig_pmd);
 		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
@@ -906,6 +986,8 @@ int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		ret |= VM_FAULT_WRITE;
 		goto out_unlock;
 	}
+	VM_BUG_ON(!vma->anon_vma);
+	VM_BUG_ON(!PageCompound(page) || !PageHead(page));
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
 
@@ -960,11 +1042,43 @@ out:
 	return ret;
 }
 
-struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+/* follow_trans_huge_pmd() for a huge pmd mapping a file extent */
+static struct page *follow_file_huge_pmd(struct vm_area_struct *vma,
+					 unsigned long addr,
+					 pmd_t *pmd,
+					 unsigned int flags)
+{
+	struct page *page = pmd_page(*pmd);
+
+	if (flags & FOLL_TOUCH) {
+		pmd_t _pmd = pmd_mkyoung(*pmd);
+
+		if (flags & FOLL_WRITE)
+			_pmd = pmd_mkdirty(_pmd);
+		set_pmd_at(vma->vm_mm, addr & HPAGE_PMD_MASK, pmd, _pmd);
+	}
+	/* the pages are not compound, refcount them one by one */
+	page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	if (flags & FOLL_GET)
+		get_page(page);
+	if ((flags & FOLL_MLOCK) && (vma->vm_flags & VM_LOCKED)) {
+		/* as in follow_page() */
+		if (page->mapping && trylock_page(page)) {
+			lru_add_drain();  /* push cached pages to LRU */
+			if (page->mapping)
+				mlock_vma_page(page);
+			unlock_page(page);
+		}
+	}
+	return page;
+}
+
+struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 				   unsigned long addr,
 				   pmd_t *pmd,
 				   unsigned int flags)
 {
+	struct mm_struct *mm = vma->vm_mm;
 	struct page *page = NULL;
 
 	assert_spin_locked(&mm->page_table_lock);
@@ -973,6 +1087,8 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
+	if (!PageAnon(page))
+		return follow_file_huge_pmd(vma, addr, pmd, flags);
 	VM_BUG_ON(!PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
@@ -996,6 +1112,38 @@ out:
 	return page;
 }
 
+/*
+ * zap_huge_pmd() for a huge pmd mapping a file extent: the mapping of each
+ * page is dropped as zap_pte_range() would.  Called with the
+ * page_table_lock held, that is released.
+ */
+static void zap_file_huge_pmd(struct mmu_gather *tlb,
+			      struct vm_area_struct *vma, pmd_t *pmd)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page = pmd_page(*pmd);
+	pmd_t orig_pmd = *pmd;
+	pgtable_t pgtable;
+	int i;
+
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_clear(pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (pmd_dirty(orig_pmd))
+			set_page_dirty(page + i);
+		if (pmd_young(orig_pmd) &&
+		    likely(!VM_SequentialReadHint(vma)))
+			mark_page_accessed(page + i);
+		page_remove_rmap(page + i);
+	}
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		tlb_remove_page(tlb, page + i);
+	pte_free(mm, pgtable);
+}
+
 int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		 pmd_t *pmd)
 {
@@ -1007,6 +1155,9 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			spin_unlock(&tlb->mm->page_table_lock);
 			wait_split_huge_page(vma->anon_vma,
 					     pmd);
+		} else if (!PageAnon(pmd_page(*pmd))) {
+			zap_file_huge_pmd(tlb, vma, pmd);
+			ret = 1;
 		} else {
 			struct page *page;
 			pgtable_t pgtable;
@@ -1125,6 +1276,291 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 	return ret;
 }
 
+/*
+ * Map with a huge pmd the HPAGE_PMD_NR pages of a file extent, naturally
+ * aligned and physically contiguous from @page.  They are independent
+ * small pages, not a compound page: each keeps its own count, mapcount
+ * and dirty bit, and the huge pmd is split into ptes in place whenever a
+ * page has to be handled alone.  The caller holds the pages locked and a
+ * reference on each, that the mapping keeps if 0 is returned.
+ */
+static int do_set_huge_pmd(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, struct page *page, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(PageCompound(page) || PageAnon(page));
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+
+	/* deposited for split_file_huge_pmd() */
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return -EAGAIN;
+	}
+	entry = mk_pmd(page, vma->vm_page_prot);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FILE_MAPPED);
+	return 0;
+}
+
+/*
+ * Lock and pin the extent of @mapping at @hindex if its pages are all
+ * cached, uptodate and physically contiguous, and return its first page.
+ * The pages after the first are found by pfn, so they may have been
+ * freed or reused meanwhile: the mapping is checked before taking the
+ * lock, and again with the lock held.
+ */
+static struct page *find_lock_file_extent(struct address_space *mapping,
+					  pgoff_t hindex)
+{
+	struct page *page;
+	int i;
+
+	page = find_get_page(mapping, hindex);
+	if (!page || radix_tree_exceptional_entry(page))
+		return NULL;
+	if (page_to_pfn(page) & (HPAGE_PMD_NR - 1)) {
+		page_cache_release(page);
+		return NULL;
+	}
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *subpage = page + i;
+
+		if (i && (subpage->mapping != mapping ||
+			  !get_page_unless_zero(subpage)))
+			break;
+		/* may wait for the read of an extent just started */
+		lock_page(subpage);
+		if (subpage->mapping != mapping ||
+		    subpage->index != hindex + i ||
+		    !PageUptodate(subpage)) {
+			unlock_page(subpage);
+			page_cache_release(subpage);
+			break;
+		}
+	}
+	if (i == HPAGE_PMD_NR)
+		return page;
+
+	while (i--) {
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+	return NULL;
+}
+
+/*
+ * Called by ->pmd_fault() to map the extent of the file of @vma at
+ * @hindex, that covers @address, with a huge pmd.  The filesystem has
+ * already brought the pages in, ideally as one block as
+ * page_cache_huge_readahead() or shmem do.  Returns 0 or VM_FAULT_OOM,
+ * or VM_FAULT_FALLBACK if the extent must be mapped with ptes.
+ */
+int map_file_huge_extent(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd, pgoff_t hindex, unsigned int flags)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	struct page *page;
+	int error = -EAGAIN;
+	int i;
+
+	page = find_lock_file_extent(mapping, hindex);
+	if (!page)
+		return VM_FAULT_FALLBACK;
+
+	/* Perhaps the file has been truncated meanwhile */
+	if (hindex + HPAGE_PMD_NR <=
+	    DIV_ROUND_UP(i_size_read(mapping->host), PAGE_CACHE_SIZE))
+		error = do_set_huge_pmd(vma, address, pmd, page, flags);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unlock_page(page + i);
+		if (error)
+			page_cache_release(page + i);
+	}
+
+	if (error == -ENOMEM)
+		return VM_FAULT_OOM;
+	if (error)
+		return VM_FAULT_FALLBACK;
+	return 0;
+}
+
+/*
+ * get_unmapped_area() for file mappings that may be mapped with huge
+ * pmds: place them so that file offsets aligned to HPAGE_PMD_SIZE fall on
+ * aligned addresses, by asking the arch for a larger area and picking the
+ * suitably aligned address inside it.
+ */
+unsigned long thp_get_unmapped_area(struct file *file, unsigned long uaddr,
+				    unsigned long len, unsigned long pgoff,
+				    unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *,
+		unsigned long, unsigned long, unsigned long, unsigned long);
+	unsigned long addr;
+	unsigned long offset;
+	unsigned long inflated_len;
+	unsigned long inflated_addr;
+	unsigned long inflated_offset;
+
+	if (len > TASK_SIZE)
+		return -ENOMEM;
+
+	get_area = current->mm->get_unmapped_area;
+	addr = get_area(file, uaddr, len, pgoff, flags);
+
+	if (IS_ERR_VALUE(addr) || (addr & ~PAGE_MASK))
+		return addr;
+	if (addr > TASK_SIZE - len)
+		return addr;
+	if (len < HPAGE_PMD_SIZE)
+		return addr;
+	if (flags & MAP_FIXED)
+		return addr;
+	/* a hint that could be honoured is preferred to alignment */
+	if (uaddr == addr)
+		return addr;
+
+	offset = (pgoff << PAGE_SHIFT) & (HPAGE_PMD_SIZE - 1);
+	if (offset && offset + len < 2 * HPAGE_PMD_SIZE)
+		return addr;
+	if ((addr & (HPAGE_PMD_SIZE - 1)) == offset)
+		return addr;
+
+	inflated_len = len + HPAGE_PMD_SIZE - PAGE_SIZE;
+	if (inflated_len > TASK_SIZE || inflated_len < len)
+		return addr;
+
+	inflated_addr = get_area(NULL, 0, inflated_len, 0, flags);
+	if (IS_ERR_VALUE(inflated_addr) || (inflated_addr & ~PAGE_MASK))
+		return addr;
+
+	inflated_offset = inflated_addr & (HPAGE_PMD_SIZE - 1);
+	inflated_addr += offset - inflated_offset;
+	if (inflated_offset > offset)
+		inflated_addr += HPAGE_PMD_SIZE;
+
+	if (inflated_addr > TASK_SIZE - len)
+		return addr;
+	return inflated_addr;
+}
+
+/*
+ * Return the huge pmd that maps @page, a page cache page, at @address in
+ * @vma as part of a file extent, with mm->page_table_lock held; or NULL.
+ */
+pmd_t *page_check_file_huge_pmd(struct page *page,
+				struct vm_area_struct *vma,
+				unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	if (PageAnon(page) || !vma->vm_ops || !vma->vm_ops->pmd_fault)
+		return NULL;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) &&
+	    pmd_page(*pmd) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT) == page)
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
+/*
+ * The young bit of a huge pmd mapping a file extent stands for all of its
+ * pages: it is tested for each of them, but only cleared when the first
+ * page of the extent is aged, so that all the pages scanned meanwhile see
+ * the reference.  Must hold mm->page_table_lock.
+ */
+int file_huge_pmd_referenced(struct page *page, struct vm_area_struct *vma,
+			     unsigned long address, pmd_t *pmd)
+{
+	if (page == pmd_page(*pmd))
+		return pmdp_clear_flush_young_notify(vma,
+					address & HPAGE_PMD_MASK, pmd);
+	return pmd_young(*pmd);
+}
+
+/*
+ * Split a huge pmd mapping a file extent in place: the pages stay mapped,
+ * by ptes in the page table deposited by do_set_huge_pmd(), and keep their
+ * mapcount.  Must hold mm->page_table_lock.
+ */
+void split_file_huge_pmd(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page = pmd_page(*pmd);
+	pgtable_t pgtable;
+	pmd_t _pmd;
+	int i;
+
+	assert_spin_locked(&mm->page_table_lock);
+	VM_BUG_ON(PageAnon(page));
+
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t *pte, entry;
+
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		if (!pmd_write(*pmd))
+			entry = pte_wrprotect(entry);
+		if (pmd_dirty(*pmd))
+			entry = pte_mkdirty(entry);
+		if (!pmd_young(*pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+
+	mm->nr_ptes++;
+	smp_wmb(); /* make pte visible before pmd */
+	/* never load small and huge TLB entries together, see above */
+	haddr = address & HPAGE_PMD_MASK;
+	set_pmd_at(mm, haddr, pmd, pmd_mknotpresent(*pmd));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	pmd_populate(mm, pmd, pgtable);
+}
+
 pmd_t *page_check_address_pmd(struct page *page,
 			      struct mm_struct *mm,
 			      unsigned long address,
@@ -1588,6 +2024,40 @@ static inline int khugepaged_test_exit(struct mm_struct *mm)
 	return atomic_read(&mm->mm_users) == 0;
 }
 
+/* Insert @mm_slot into khugepaged_queue, must hold khugepaged_mm_lock */
+static void khugepaged_queue_mm_slot(struct mm_slot *mm_slot)
+{
+	struct rb_node **p = &khugepaged_queue.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct mm_slot *tmp;
+		int diff;
+
+		parent = *p;
+		tmp = rb_entry(parent, struct mm_slot, rb_node);
+		diff = (int)(mm_slot->round - tmp->round);
+		if (diff < 0 || (!diff && mm_slot->benefit > tmp->benefit))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&mm_slot->rb_node, parent, p);
+	rb_insert_color(&mm_slot->rb_node, &khugepaged_queue);
+}
+
+/*
+ * Anonymous pages of the mm that are not mapped by a huge pmd, as of the
+ * last full pass.  This is what khugepaged could still collapse.
+ */
+static unsigned long khugepaged_mm_benefit(struct mm_slot *mm_slot)
+{
+	unsigned long anon = get_mm_counter(mm_slot->mm, MM_ANONPAGES);
+	unsigned long huge = mm_slot->nr_huge * HPAGE_PMD_NR;
+
+	return anon > huge ? anon - huge : 0;
+}
+
 int __khugepaged_enter(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
@@ -1607,11 +2077,12 @@ int __khugepaged_enter(struct mm_struct *mm)
 	spin_lock(&khugepaged_mm_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
-	 * Insert just behind the scanning cursor, to let the area settle
-	 * down a little.
+	 * Queue for the next pass, to let the area settle down a little.
 	 */
-	wakeup = list_empty(&khugepaged_scan.mm_head);
-	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	wakeup = RB_EMPTY_ROOT(&khugepaged_queue);
+	mm_slot->round = khugepaged_round + 1;
+	mm_slot->benefit = get_mm_counter(mm, MM_ANONPAGES);
+	khugepaged_queue_mm_slot(mm_slot);
 	spin_unlock(&khugepaged_mm_lock);
 
 	atomic_inc(&mm->mm_count);
@@ -1652,9 +2123,9 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot && !mm_slot->busy) {
 		hlist_del(&mm_slot->hash);
-		list_del(&mm_slot->mm_node);
+		rb_erase(&mm_slot->rb_node, &khugepaged_queue);
 		free = 1;
 	}
 	spin_unlock(&khugepaged_mm_lock);
@@ -1855,6 +2326,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	up_read(&mm->mmap_sem);
 	if (unlikely(!new_page)) {
 		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		mm->thp_collapse_failed++;
 		*hpage = ERR_PTR(-ENOMEM);
 		return;
 	}
@@ -1865,6 +2337,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 #ifdef CONFIG_NUMA
 		put_page(new_page);
 #endif
+		mm->thp_collapse_failed++;
 		return;
 	}
 
@@ -1976,11 +2449,13 @@ static void collapse_huge_page(struct mm_struct *mm,
 	*hpage = NULL;
 #endif
 	khugepaged_pages_collapsed++;
+	mm->thp_collapsed++;
 out_up_write:
 	up_write(&mm->mmap_sem);
 	return;
 
 out:
+	mm->thp_collapse_failed++;
 	mem_cgroup_uncharge_page(new_page);
 #ifdef CONFIG_NUMA
 	put_page(new_page);
@@ -1988,11 +2463,56 @@ out:
 	goto out_up_write;
 }
 
-static int khugepaged_scan_pmd(struct mm_struct *mm,
+#ifdef CONFIG_NUMA
+/*
+ * Collapse onto the node that already holds most of the small pages, so
+ * that the fewest pages change node.
+ */
+static int khugepaged_find_target_node(struct khugepaged_worker *w)
+{
+	int nid, target_node = 0, max_value = 0;
+
+	for_each_online_node(nid)
+		if (w->node_load[nid] > max_value) {
+			max_value = w->node_load[nid];
+			target_node = nid;
+		}
+	return target_node;
+}
+
+static inline void khugepaged_clear_node_load(struct khugepaged_worker *w)
+{
+	memset(w->node_load, 0, sizeof(w->node_load[0]) * nr_node_ids);
+}
+
+static inline void khugepaged_add_node_load(struct khugepaged_worker *w,
+					    struct page *page)
+{
+	w->node_load[page_to_nid(page)]++;
+}
+#else
+static inline int khugepaged_find_target_node(struct khugepaged_worker *w)
+{
+	return 0;
+}
+
+static inline void khugepaged_clear_node_load(struct khugepaged_worker *w)
+{
+}
+
+static inline void khugepaged_add_node_load(struct khugepaged_worker *w,
+					    struct page *page)
+{
+}
+#endif
+
+static int khugepaged_scan_pmd(struct khugepaged_worker *w,
+			       struct mm_slot *mm_slot,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
 			       struct page **hpage)
 {
+	struct mm_struct *mm = mm_slot->mm;
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
@@ -2001,7 +2521,6 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	struct page *page;
 	unsigned long _address;
 	spinlock_t *ptl;
-	int node = -1;
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
@@ -2014,9 +2533,12 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 
 	pmd = pmd_offset(pud, address);
+	if (pmd_trans_huge(*pmd))
+		mm_slot->nr_huge++;
 	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
 
+	khugepaged_clear_node_load(w);
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -2032,13 +2554,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		page = vm_normal_page(vma, _address, pteval);
 		if (unlikely(!page))
 			goto out_unmap;
-		/*
-		 * Chose the node of the first page. This could
-		 * be more sophisticated and look at more pages,
-		 * but isn't for now.
-		 */
-		if (node == -1)
-			node = page_to_nid(page);
+		khugepaged_add_node_load(w, page);
 		VM_BUG_ON(PageCompound(page));
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
@@ -2055,7 +2571,8 @@ out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret)
 		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, vma, node);
+		collapse_huge_page(mm, address, hpage, vma,
+				   khugepaged_find_target_node(w));
 out:
 	return ret;
 }
@@ -2065,53 +2582,68 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	struct mm_struct *mm = mm_slot->mm;
 
 	VM_BUG_ON(!spin_is_locked(&khugepaged_mm_lock));
+	VM_BUG_ON(!mm_slot->busy);
 
-	if (khugepaged_test_exit(mm)) {
-		/* free mm_slot */
-		hlist_del(&mm_slot->hash);
-		list_del(&mm_slot->mm_node);
+	/* free mm_slot */
+	hlist_del(&mm_slot->hash);
 
-		/*
-		 * Not strictly needed because the mm exited already.
-		 *
-		 * clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
-		 */
+	/*
+	 * Not strictly needed because the mm exited already.
+	 *
+	 * clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+	 */
 
-		/* khugepaged_mm_lock actually not necessary for the below */
-		free_mm_slot(mm_slot);
-		mmdrop(mm);
+	/* khugepaged_mm_lock actually not necessary for the below */
+	free_mm_slot(mm_slot);
+	mmdrop(mm);
+}
+
+/*
+ * Take the next mm_slot to scan off khugepaged_queue and mark it busy.
+ * Returns NULL once the mms queued for the pass after @start_round are
+ * reached, so that a single khugepaged_do_scan() does not go through all
+ * the mms more than once.  Must hold khugepaged_mm_lock.
+ */
+static struct mm_slot *khugepaged_get_mm_slot(unsigned int start_round)
+{
+	struct mm_slot *mm_slot;
+	struct rb_node *node;
+
+	node = rb_first(&khugepaged_queue);
+	if (!node)
+		return NULL;
+	mm_slot = rb_entry(node, struct mm_slot, rb_node);
+
+	if ((int)(mm_slot->round - khugepaged_round) > 0) {
+		/* all the mms were scanned in this pass */
+		khugepaged_round = mm_slot->round;
+		khugepaged_full_scans++;
 	}
+	if ((int)(mm_slot->round - start_round) > 0)
+		return NULL;
+
+	rb_erase(&mm_slot->rb_node, &khugepaged_queue);
+	mm_slot->busy = true;
+	return mm_slot;
 }
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+static unsigned int khugepaged_scan_mm_slot(struct khugepaged_worker *w,
+					    struct mm_slot *mm_slot,
+					    unsigned int pages,
 					    struct page **hpage)
-	__releases(&khugepaged_mm_lock)
-	__acquires(&khugepaged_mm_lock)
 {
-	struct mm_slot *mm_slot;
-	struct mm_struct *mm;
+	struct mm_struct *mm = mm_slot->mm;
 	struct vm_area_struct *vma;
 	int progress = 0;
 
 	VM_BUG_ON(!pages);
-	VM_BUG_ON(!spin_is_locked(&khugepaged_mm_lock));
+	VM_BUG_ON(!mm_slot->busy);
 
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
-	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
-				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
-	}
-	spin_unlock(&khugepaged_mm_lock);
-
-	mm = mm_slot->mm;
 	down_read(&mm->mmap_sem);
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, mm_slot->address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -2145,26 +2677,26 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		hend = vma->vm_end & HPAGE_PMD_MASK;
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (mm_slot->address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (mm_slot->address < hstart)
+			mm_slot->address = hstart;
+		VM_BUG_ON(mm_slot->address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (mm_slot->address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
+			VM_BUG_ON(mm_slot->address < hstart ||
+				  mm_slot->address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
+			ret = khugepaged_scan_pmd(w, mm_slot, vma,
+						  mm_slot->address,
 						  hpage);
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			mm_slot->address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -2178,52 +2710,60 @@ breakouterloop:
 breakouterloop_mmap_sem:
 
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
 	/*
-	 * Release the current mm_slot if this mm is about to die, or
-	 * if we scanned all vmas of this mm.
+	 * Release the current mm_slot if this mm is about to die.  Once
+	 * mm_users reached zero __khugepaged_exit() leaves a busy mm_slot
+	 * to us.
 	 */
-	if (khugepaged_test_exit(mm) || !vma) {
-		/*
-		 * Make sure that if mm_users is reaching zero while
-		 * khugepaged runs here, khugepaged_exit will find
-		 * mm_slot not pointing to the exiting mm.
-		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
-				mm_slot->mm_node.next,
-				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
-		} else {
-			khugepaged_scan.mm_slot = NULL;
-			khugepaged_full_scans++;
-		}
-
+	if (khugepaged_test_exit(mm)) {
 		collect_mm_slot(mm_slot);
+	} else {
+		if (!vma) {
+			/* scanned all vmas of this mm: requeue for next pass */
+			mm_slot->benefit = khugepaged_mm_benefit(mm_slot);
+			mm_slot->nr_huge = 0;
+			mm_slot->address = 0;
+			mm_slot->round = khugepaged_round + 1;
+		}
+		mm_slot->busy = false;
+		khugepaged_queue_mm_slot(mm_slot);
 	}
+	spin_unlock(&khugepaged_mm_lock);
 
 	return progress;
 }
 
-static int khugepaged_has_work(void)
+static int khugepaged_should_run(struct khugepaged_worker *w)
 {
-	return !list_empty(&khugepaged_scan.mm_head) &&
-		khugepaged_enabled();
+	return khugepaged_enabled() &&
+		w->id < ACCESS_ONCE(khugepaged_nr_threads);
 }
 
-static int khugepaged_wait_event(void)
+static int khugepaged_has_work(struct khugepaged_worker *w)
 {
-	return !list_empty(&khugepaged_scan.mm_head) ||
-		!khugepaged_enabled();
+	return !RB_EMPTY_ROOT(&khugepaged_queue) &&
+		khugepaged_should_run(w);
 }
 
-static void khugepaged_do_scan(struct page **hpage)
+static int khugepaged_wait_event(struct khugepaged_worker *w)
 {
-	unsigned int progress = 0, pass_through_head = 0;
+	return !RB_EMPTY_ROOT(&khugepaged_queue) ||
+		!khugepaged_should_run(w);
+}
+
+static void khugepaged_do_scan(struct khugepaged_worker *w,
+			       struct page **hpage)
+{
+	unsigned int progress = 0, start_round;
 	unsigned int pages = khugepaged_pages_to_scan;
+	struct mm_slot *mm_slot;
 
 	barrier(); /* write khugepaged_pages_to_scan to local stack */
 
+	spin_lock(&khugepaged_mm_lock);
+	start_round = khugepaged_round;
+	spin_unlock(&khugepaged_mm_lock);
+
 	while (progress < pages) {
 		cond_resched();
 
@@ -2245,15 +2785,15 @@ static void khugepaged_do_scan(struct page **hpage)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
-			pass_through_head++;
-		if (khugepaged_has_work() &&
-		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
-							    hpage);
-		else
-			progress = pages;
+		mm_slot = NULL;
+		if (khugepaged_has_work(w))
+			mm_slot = khugepaged_get_mm_slot(start_round);
 		spin_unlock(&khugepaged_mm_lock);
+		if (!mm_slot)
+			break;
+
+		progress += khugepaged_scan_mm_slot(w, mm_slot,
+						    pages - progress, hpage);
 	}
 }
 
@@ -2264,7 +2804,7 @@ static void khugepaged_alloc_sleep(void)
 }
 
 #ifndef CONFIG_NUMA
-static struct page *khugepaged_alloc_hugepage(void)
+static struct page *khugepaged_alloc_hugepage(struct khugepaged_worker *w)
 {
 	struct page *hpage;
 
@@ -2276,21 +2816,21 @@ static struct page *khugepaged_alloc_hugepage(void)
 		} else
 			count_vm_event(THP_COLLAPSE_ALLOC);
 	} while (unlikely(!hpage) &&
-		 likely(khugepaged_enabled()));
+		 likely(khugepaged_should_run(w)));
 	return hpage;
 }
 #endif
 
-static void khugepaged_loop(void)
+static void khugepaged_loop(struct khugepaged_worker *w)
 {
 	struct page *hpage;
 
 #ifdef CONFIG_NUMA
 	hpage = NULL;
 #endif
-	while (likely(khugepaged_enabled())) {
+	while (likely(khugepaged_should_run(w))) {
 #ifndef CONFIG_NUMA
-		hpage = khugepaged_alloc_hugepage();
+		hpage = khugepaged_alloc_hugepage(w);
 		if (unlikely(!hpage))
 			break;
 #else
@@ -2300,7 +2840,7 @@ static void khugepaged_loop(void)
 		}
 #endif
 
-		khugepaged_do_scan(&hpage);
+		khugepaged_do_scan(w, &hpage);
 #ifndef CONFIG_NUMA
 		if (hpage)
 			put_page(hpage);
@@ -2308,20 +2848,20 @@ static void khugepaged_loop(void)
 		try_to_freeze();
 		if (unlikely(kthread_should_stop()))
 			break;
-		if (khugepaged_has_work()) {
+		if (khugepaged_has_work(w)) {
 			if (!khugepaged_scan_sleep_millisecs)
 				continue;
 			wait_event_freezable_timeout(khugepaged_wait, false,
 			    msecs_to_jiffies(khugepaged_scan_sleep_millisecs));
-		} else if (khugepaged_enabled())
+		} else if (khugepaged_should_run(w))
 			wait_event_freezable(khugepaged_wait,
-					     khugepaged_wait_event());
+					     khugepaged_wait_event(w));
 	}
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *arg)
 {
-	struct mm_slot *mm_slot;
+	struct khugepaged_worker *w = arg;
 
 	set_freezable();
 	set_user_nice(current, 19);
@@ -2331,31 +2871,25 @@ static int khugepaged(void *none)
 
 	for (;;) {
 		mutex_unlock(&khugepaged_mutex);
-		VM_BUG_ON(khugepaged_thread != current);
-		khugepaged_loop();
-		VM_BUG_ON(khugepaged_thread != current);
+		VM_BUG_ON(w->task != current);
+		khugepaged_loop(w);
+		VM_BUG_ON(w->task != current);
 
 		mutex_lock(&khugepaged_mutex);
-		if (!khugepaged_enabled())
+		if (!khugepaged_should_run(w))
 			break;
 		if (unlikely(kthread_should_stop()))
 			break;
 	}
 
-	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
-	if (mm_slot)
-		collect_mm_slot(mm_slot);
-	spin_unlock(&khugepaged_mm_lock);
-
-	khugepaged_thread = NULL;
+	w->task = NULL;
 	mutex_unlock(&khugepaged_mutex);
 
 	return 0;
 }
 
-void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *pmd)
 {
 	struct page *page;
 
@@ -2365,6 +2899,12 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 		return;
 	}
 	page = pmd_page(*pmd);
+	if (!PageAnon(page)) {
+		/* the caller holds mmap_sem, so the vma is stable */
+		split_file_huge_pmd(find_vma(mm, address), address, pmd);
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
 	VM_BUG_ON(!page_count(page));
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
@@ -2375,6 +2915,21 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	BUG_ON(pmd_trans_huge(*pmd));
 }
 
+void __split_huge_page_pmd_vma(struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && !PageAnon(pmd_page(*pmd))) {
+		split_file_huge_pmd(vma, address, pmd);
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+	spin_unlock(&mm->page_table_lock);
+	__split_huge_page_pmd(mm, address, pmd);
+}
+
 static void split_huge_page_address(struct mm_struct *mm,
 				    unsigned long address)
 {
@@ -2399,7 +2954,7 @@ static void split_huge_page_address(struct mm_struct *mm,
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
 	 * materialize from under us.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	split_huge_page_pmd(mm, address, pmd);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
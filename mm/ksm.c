@@ -36,6 +36,8 @@
 #include <linux/hash.h>
 #include <linux/freezer.h>
 #include <linux/oom.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -110,6 +112,18 @@ struct ksm_scan {
 	unsigned long seqnr;
 };
 
+/**
+ * struct ksm_batch_entry - a page ksmd has scanned, but not yet merged
+ * @page: the page, with a reference held on it
+ * @rmap_item: the reverse mapping of that page, marked BATCHED_FLAG
+ * @checksum: checksum of the page, by whichever scan thread claimed it
+ */
+struct ksm_batch_entry {
+	struct page *page;
+	struct rmap_item *rmap_item;
+	u32 checksum;
+};
+
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
@@ -151,6 +165,8 @@ struct rmap_item {
 #define SEQNR_MASK	0x0ff	/* low bits of unstable tree seqnr */
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
+#define VOLATILE_FLAG	0x400	/* checksum changed when last scanned */
+#define BATCHED_FLAG	0x800	/* is in ksm_batch, awaiting merge */
 
 /* The stable and unstable tree heads */
 static struct rb_root root_stable_tree = RB_ROOT;
@@ -189,6 +205,54 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * calc_checksum samples ksm_checksum_bytes of each page, in chunks of
+ * KSM_CHECKSUM_CHUNK spread evenly over it: it only has to notice pages
+ * which keep changing, the merge itself always compares the whole page.
+ */
+#define KSM_CHECKSUM_CHUNK	64
+static unsigned int ksm_checksum_bytes = PAGE_SIZE / 4;
+
+/*
+ * A vma more than this percentage of whose pages were found volatile is
+ * skipped for the next full scan, then for twice as many each time it
+ * is found as volatile again, up to KSM_MAX_SKIP_SCANS.  The pages of a
+ * vma smaller than KSM_MIN_SKIP_PAGES are not worth the bother.
+ */
+static unsigned int ksm_skip_volatile_percent = 90;
+#define KSM_MAX_SKIP_SCANS	16
+#define KSM_MIN_SKIP_PAGES	16
+
+/*
+ * ksmd takes pages from scan_get_next_rmap_item KSM_SCAN_BATCH at a time,
+ * and ksm_scan_threads threads (ksmd and its helpers) checksum the batch
+ * before ksmd merges it: merging stays single-threaded, under the mutex.
+ */
+#define KSM_SCAN_BATCH		128
+#define KSM_MAX_SCAN_THREADS	32
+static unsigned int ksm_scan_threads = 1;
+static struct task_struct *ksm_helpers[KSM_MAX_SCAN_THREADS - 1];
+
+static struct ksm_batch_entry ksm_batch[KSM_SCAN_BATCH];
+static unsigned int ksm_batch_nr;	/* entries in the batch */
+static unsigned int ksm_batch_next;	/* next entry to be claimed */
+static unsigned int ksm_batch_busy;	/* entries claimed, not checksummed */
+static DEFINE_SPINLOCK(ksm_batch_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ksm_helper_wait);
+static DECLARE_WAIT_QUEUE_HEAD(ksm_batch_wait);
+
+/* Pages scanned, pages skipped in volatile vmas, and pages merged */
+static unsigned long ksm_pages_scanned;
+static unsigned long ksm_pages_skipped;
+static unsigned long ksm_pages_merged;
+
+/* Pages scanned and merged per second over the last full scan */
+static unsigned long ksm_scan_rate;
+static unsigned long ksm_merge_rate;
+static unsigned long ksm_scan_start;	/* jiffies at start of full scan */
+static unsigned long ksm_scan_start_scanned;
+static unsigned long ksm_scan_start_merged;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -571,6 +635,11 @@ static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
 	while (*rmap_list) {
 		struct rmap_item *rmap_item = *rmap_list;
 		*rmap_list = rmap_item->rmap_list;
+		if (rmap_item->address & BATCHED_FLAG) {
+			/* ksm_do_scan will free it: its mm may be gone by then */
+			rmap_item->mm = NULL;
+			continue;
+		}
 		remove_rmap_item_from_tree(rmap_item);
 		free_rmap_item(rmap_item);
 	}
@@ -671,9 +740,20 @@ error:
 
 static u32 calc_checksum(struct page *page)
 {
+	unsigned int bytes = ACCESS_ONCE(ksm_checksum_bytes);
+	unsigned int stride = PAGE_SIZE / (bytes / KSM_CHECKSUM_CHUNK);
+	unsigned int offset;
 	u32 checksum;
 	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+
+	if (bytes == PAGE_SIZE)
+		checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	else {
+		checksum = 17;
+		for (offset = 0; offset < PAGE_SIZE; offset += stride)
+			checksum = jhash2(addr + offset,
+					  KSM_CHECKSUM_CHUNK / 4, checksum);
+	}
 	kunmap_atomic(addr, KM_USER0);
 	return checksum;
 }
@@ -1167,17 +1247,19 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @checksum: calc_checksum of the page, taken since it was scanned
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       unsigned int checksum)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
+	rmap_item->address &= ~VOLATILE_FLAG;
 
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
@@ -1191,6 +1273,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
+			ksm_pages_merged++;
 		}
 		put_page(kpage);
 		return;
@@ -1201,9 +1284,12 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
+	 * Mark it for scan_get_next_rmap_item to judge its vma by, unless
+	 * this was its first checksum (oldchecksum is then still 0).
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
+		if (rmap_item->oldchecksum)
+			rmap_item->address |= VOLATILE_FLAG;
 		rmap_item->oldchecksum = checksum;
 		return;
 	}
@@ -1227,6 +1313,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
+				ksm_pages_merged += 2;
 			}
 			unlock_page(kpage);
 
@@ -1272,7 +1359,84 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Called as the scan enters a VM_MERGEABLE vma with an anon_vma: returns
+ * true if the vma is to be skipped on this full scan, having advanced the
+ * cursor past its rmap_items (which are kept for when it is scanned next).
+ * Those still marked as in the unstable tree are taken out of it: they
+ * are not in this scan's tree, and would be too old to remove later.
+ */
+static bool skip_volatile_vma(struct vm_area_struct *vma)
+{
+	struct rmap_item *rmap_item;
+
+	vma->ksm_scanned = 0;
+	vma->ksm_volatile = 0;
+	if (!vma->ksm_skip)
+		return false;
+
+	vma->ksm_skip--;
+	while (*ksm_scan.rmap_list &&
+	       (*ksm_scan.rmap_list)->address < vma->vm_end) {
+		rmap_item = *ksm_scan.rmap_list;
+		if (rmap_item->address & UNSTABLE_FLAG)
+			remove_rmap_item_from_tree(rmap_item);
+		ksm_scan.rmap_list = &rmap_item->rmap_list;
+	}
+	ksm_pages_skipped += (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	return true;
+}
+
+/*
+ * Called as the scan leaves a vma it has scanned: decide whether to skip
+ * it for a while.  The VOLATILE_FLAGs counted on the way were set when its
+ * pages were last merged, so only trust them if that was in the previous
+ * full scan, not from before the vma was last skipped.
+ */
+static void end_vma_scan(struct vm_area_struct *vma)
+{
+	bool fresh = vma->ksm_seqnr + 1 == ksm_scan.seqnr;
+
+	vma->ksm_seqnr = ksm_scan.seqnr;
+	if (!fresh || vma->ksm_scanned < KSM_MIN_SKIP_PAGES)
+		return;
+
+	if ((unsigned long)vma->ksm_volatile * 100 >
+	    (unsigned long)vma->ksm_scanned * ksm_skip_volatile_percent) {
+		if (!vma->ksm_backoff)
+			vma->ksm_backoff = 1;
+		else if (vma->ksm_backoff < KSM_MAX_SKIP_SCANS)
+			vma->ksm_backoff *= 2;
+		vma->ksm_skip = vma->ksm_backoff;
+	} else
+		vma->ksm_backoff = 0;
+}
+
+/* Called at the start and at the end of each full scan */
+static void ksm_scan_rates(bool start)
+{
+	unsigned int msecs;
+
+	if (!start) {
+		msecs = jiffies_to_msecs(jiffies - ksm_scan_start) ?: 1;
+		ksm_scan_rate = div_u64((u64)(ksm_pages_scanned -
+				ksm_scan_start_scanned) * MSEC_PER_SEC, msecs);
+		ksm_merge_rate = div_u64((u64)(ksm_pages_merged -
+				ksm_scan_start_merged) * MSEC_PER_SEC, msecs);
+		return;
+	}
+	ksm_scan_start = jiffies;
+	ksm_scan_start_scanned = ksm_pages_scanned;
+	ksm_scan_start_merged = ksm_pages_merged;
+}
+
+/*
+ * Returns the next rmap_item to merge, with its page, or NULL: then
+ * *pass_done tells whether that was because the last mm was scanned.
+ * The caller ends the pass once it has merged what it took before.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page,
+						 bool *pass_done)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
@@ -1297,6 +1461,7 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		lru_add_drain_all();
 
 		root_unstable_tree = RB_ROOT;
+		ksm_scan_rates(true);
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1323,8 +1488,11 @@ next_mm:
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
+		if (ksm_scan.address <= vma->vm_start) {
 			ksm_scan.address = vma->vm_start;
+			if (vma->anon_vma && skip_volatile_vma(vma))
+				ksm_scan.address = vma->vm_end;
+		}
 		if (!vma->anon_vma)
 			ksm_scan.address = vma->vm_end;
 
@@ -1347,6 +1515,11 @@ next_mm:
 					ksm_scan.rmap_list =
 							&rmap_item->rmap_list;
 					ksm_scan.address += PAGE_SIZE;
+					vma->ksm_scanned++;
+					if (rmap_item->address & VOLATILE_FLAG)
+						vma->ksm_volatile++;
+					if (ksm_scan.address >= vma->vm_end)
+						end_vma_scan(vma);
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
@@ -1356,6 +1529,8 @@ next_mm:
 			ksm_scan.address += PAGE_SIZE;
 			cond_resched();
 		}
+		if (vma->ksm_scanned && !ksm_test_exit(mm))
+			end_vma_scan(vma);
 	}
 
 	if (ksm_test_exit(mm)) {
@@ -1399,27 +1574,125 @@ next_mm:
 	if (slot != &ksm_mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	*pass_done = true;
 	return NULL;
 }
 
+static struct ksm_batch_entry *ksm_batch_claim(void)
+{
+	struct ksm_batch_entry *entry = NULL;
+
+	spin_lock(&ksm_batch_lock);
+	if (ksm_batch_next < ksm_batch_nr) {
+		entry = &ksm_batch[ksm_batch_next++];
+		ksm_batch_busy++;
+	}
+	spin_unlock(&ksm_batch_lock);
+	return entry;
+}
+
+static void ksm_batch_done(void)
+{
+	bool done;
+
+	spin_lock(&ksm_batch_lock);
+	done = !--ksm_batch_busy && ksm_batch_next == ksm_batch_nr;
+	spin_unlock(&ksm_batch_lock);
+	if (done)
+		wake_up(&ksm_batch_wait);
+}
+
+static bool ksm_batch_checksummed(void)
+{
+	bool done;
+
+	spin_lock(&ksm_batch_lock);
+	done = !ksm_batch_busy;
+	spin_unlock(&ksm_batch_lock);
+	return done;
+}
+
+/*
+ * Checksum entries of ksm_batch until none are left to claim: run by ksmd
+ * and by its helpers alike.  Nothing else touches a batched rmap_item or
+ * its page until ksmd has seen the last checksummed.
+ */
+static void ksm_checksum_batch(void)
+{
+	struct ksm_batch_entry *entry;
+
+	while ((entry = ksm_batch_claim())) {
+		/* cmp_and_merge_page is not called on what's merged already */
+		if (!PageKsm(entry->page) || !in_stable_tree(entry->rmap_item))
+			entry->checksum = calc_checksum(entry->page);
+		ksm_batch_done();
+	}
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
  */
 static void ksm_do_scan(unsigned int scan_npages)
 {
+	struct ksm_batch_entry *entry;
 	struct rmap_item *rmap_item;
-	struct page *uninitialized_var(page);
+	unsigned int i, nr;
+	bool end = false, pass_done = false;
 
-	while (scan_npages-- && likely(!freezing(current))) {
-		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
-		if (!rmap_item)
-			return;
-		if (!PageKsm(page) || !in_stable_tree(rmap_item))
-			cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+	while (scan_npages && !end && likely(!freezing(current))) {
+		for (nr = 0; nr < KSM_SCAN_BATCH && nr < scan_npages; nr++) {
+			entry = &ksm_batch[nr];
+			cond_resched();
+			rmap_item = scan_get_next_rmap_item(&entry->page,
+							    &pass_done);
+			if (!rmap_item) {
+				end = true;
+				break;
+			}
+			rmap_item->address |= BATCHED_FLAG;
+			entry->rmap_item = rmap_item;
+			ksm_pages_scanned++;
+		}
+		if (!nr)
+			break;
+		scan_npages -= nr;
+
+		spin_lock(&ksm_batch_lock);
+		ksm_batch_nr = nr;
+		ksm_batch_next = 0;
+		spin_unlock(&ksm_batch_lock);
+		if (ksm_scan_threads > 1)
+			wake_up_all(&ksm_helper_wait);
+		ksm_checksum_batch();
+		wait_event(ksm_batch_wait, ksm_batch_checksummed());
+
+		for (i = 0; i < nr; i++) {
+			entry = &ksm_batch[i];
+			rmap_item = entry->rmap_item;
+			if (!rmap_item->mm) {
+				/* Left to us by remove_trailing_rmap_items */
+				remove_rmap_item_from_tree(rmap_item);
+				free_rmap_item(rmap_item);
+			} else {
+				rmap_item->address &= ~BATCHED_FLAG;
+				if (!PageKsm(entry->page) ||
+				    !in_stable_tree(rmap_item))
+					cmp_and_merge_page(entry->page,
+						rmap_item, entry->checksum);
+			}
+			put_page(entry->page);
+		}
+	}
+
+	/*
+	 * Only now that the last batch of the pass has been merged may
+	 * seqnr move on: remove_rmap_item_from_tree() ages unstable items
+	 * by it, and the next call resets root_unstable_tree.
+	 */
+	if (pass_done) {
+		ksm_scan_rates(false);
+		ksm_scan.seqnr++;
 	}
 }
 
@@ -1452,6 +1725,23 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+/*
+ * The helpers are not freezable: they only ever checksum pages which ksmd
+ * (which is) has handed them, and ksmd waits for them to finish each batch.
+ */
+static int ksm_helper_thread(void *nothing)
+{
+	set_user_nice(current, 5);
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(ksm_helper_wait,
+			ACCESS_ONCE(ksm_batch_next) < ACCESS_ONCE(ksm_batch_nr) ||
+			kthread_should_stop());
+		ksm_checksum_batch();
+	}
+	return 0;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1872,6 +2162,91 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t checksum_bytes_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_checksum_bytes);
+}
+
+static ssize_t checksum_bytes_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	unsigned long bytes;
+	int err;
+
+	err = strict_strtoul(buf, 10, &bytes);
+	if (err || bytes < KSM_CHECKSUM_CHUNK || bytes > PAGE_SIZE ||
+	    !is_power_of_2(bytes))
+		return -EINVAL;
+
+	ksm_checksum_bytes = bytes;
+
+	return count;
+}
+KSM_ATTR(checksum_bytes);
+
+static ssize_t skip_volatile_percent_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_skip_volatile_percent);
+}
+
+static ssize_t skip_volatile_percent_store(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   const char *buf, size_t count)
+{
+	unsigned long percent;
+	int err;
+
+	err = strict_strtoul(buf, 10, &percent);
+	if (err || percent > 100)
+		return -EINVAL;
+
+	ksm_skip_volatile_percent = percent;
+
+	return count;
+}
+KSM_ATTR(skip_volatile_percent);
+
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct task_struct *helper;
+	unsigned long nr_threads;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_threads);
+	if (err || !nr_threads || nr_threads > KSM_MAX_SCAN_THREADS)
+		return -EINVAL;
+
+	/* ksmd holds the mutex while a batch is being checksummed */
+	mutex_lock(&ksm_thread_mutex);
+	while (ksm_scan_threads < nr_threads) {
+		helper = kthread_run(ksm_helper_thread, NULL, "ksmd/%u",
+				     ksm_scan_threads);
+		if (IS_ERR(helper)) {
+			count = PTR_ERR(helper);
+			break;
+		}
+		ksm_helpers[ksm_scan_threads++ - 1] = helper;
+	}
+	while (ksm_scan_threads > nr_threads)
+		kthread_stop(ksm_helpers[--ksm_scan_threads - 1]);
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(scan_threads);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1967,15 +2342,58 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
+static ssize_t pages_merged_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_merged);
+}
+KSM_ATTR_RO(pages_merged);
+
+static ssize_t scan_rate_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_scan_rate);
+}
+KSM_ATTR_RO(scan_rate);
+
+static ssize_t merge_rate_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_merge_rate);
+}
+KSM_ATTR_RO(merge_rate);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&checksum_bytes_attr.attr,
+	&skip_volatile_percent_attr.attr,
+	&scan_threads_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&pages_skipped_attr.attr,
+	&pages_merged_attr.attr,
+	&scan_rate_attr.attr,
+	&merge_rate_attr.attr,
 	NULL,
 };
 
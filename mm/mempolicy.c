@@ -511,7 +511,7 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		split_huge_page_pmd(vma->vm_mm, pmd);
+		split_huge_page_pmd(vma->vm_mm, addr, pmd);
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
@@ -2305,6 +2305,67 @@ void numa_default_policy(void)
 	do_set_mempolicy(MPOL_DEFAULT, 0, NULL);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Make the pages of [addr, end) that are mapped once PROT_NONE, so that the
+ * next access to them takes a NUMA hinting fault.  Returns the number of
+ * ptes changed.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long addr, unsigned long end)
+{
+	unsigned long nr_updated;
+
+	nr_updated = change_protection(vma, addr, end, vma_prot_none(vma),
+				       0, 1);
+	if (nr_updated)
+		count_vm_events(NUMA_PTE_UPDATES, nr_updated);
+
+	return nr_updated;
+}
+
+/**
+ * mpol_misplaced - check whether a page faulted on should move here
+ * @page:   page the current task took a NUMA hinting fault on
+ * @vma:    vm area the page is mapped in
+ * @addr:   virtual address the page is mapped at
+ *
+ * Only the local allocation policy, or a preferred or bind policy that
+ * the local node satisfies, lets pages follow the task: interleaved pages,
+ * and pages a policy placed on purpose elsewhere, stay where they are.
+ *
+ * Returns the local node if @page should be migrated to it, -1 otherwise.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol;
+	int thisnid = numa_node_id();
+	int ret = -1;
+
+	if (page_to_nid(page) == thisnid)
+		return -1;
+
+	pol = get_vma_policy(current, vma, addr);
+	switch (pol->mode) {
+	case MPOL_PREFERRED:
+		if ((pol->flags & MPOL_F_LOCAL) ||
+		    pol->v.preferred_node == thisnid)
+			ret = thisnid;
+		break;
+	case MPOL_BIND:
+		if (node_isset(thisnid, pol->v.nodes))
+			ret = thisnid;
+		break;
+	default:
+		break;
+	}
+	mpol_cond_put(pol);
+
+	return ret;
+}
+#endif
+
 /*
  * Parse and format mempolicy from/to strings
  */
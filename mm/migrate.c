@@ -1367,3 +1367,48 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	return err;
 }
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long data, int **result)
+{
+	int nid = (int) data;
+
+	/* no reclaim on the target node just to move a page there */
+	return alloc_pages_exact_node(nid,
+				(GFP_HIGHUSER_MOVABLE & ~__GFP_WAIT) |
+				__GFP_THISNODE | __GFP_NOMEMALLOC |
+				__GFP_NORETRY | __GFP_NOWARN |
+				__GFP_NO_KSWAPD, 0);
+}
+
+/*
+ * Move @page, which the current task took a NUMA hinting fault on, to
+ * @node.  Called without locks, with a reference on @page that is dropped
+ * here.  Returns 1 if the page was migrated.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	LIST_HEAD(migratepages);
+	int nr_remaining;
+
+	if (isolate_lru_page(page)) {
+		put_page(page);
+		return 0;
+	}
+	/* isolate_lru_page() took a reference of its own */
+	put_page(page);
+
+	list_add(&page->lru, &migratepages);
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	nr_remaining = migrate_pages(&migratepages, alloc_misplaced_dst_page,
+				     node, false, false);
+	if (nr_remaining) {
+		putback_lru_pages(&migratepages);
+		return 0;
+	}
+	count_vm_event(NUMA_PAGE_MIGRATE);
+
+	return 1;
+}
+#endif /* CONFIG_NUMA_BALANCING */
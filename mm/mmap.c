@@ -30,6 +30,7 @@
 #include <linux/perf_event.h>
 #include <linux/audit.h>
 #include <linux/khugepaged.h>
+#include <linux/shmem_fs.h>
 
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -133,7 +134,7 @@ int __vm_enough_memory(struct mm_struct *mm, long pages, int cap_sys_admin)
 		 */
 		free -= global_page_state(NR_SHMEM);
 
-		free += nr_swap_pages;
+		free += get_nr_swap_pages();
 
 		/*
 		 * Any slabs which are created with the
@@ -1551,6 +1552,20 @@ get_unmapped_area(struct file *file, unsigned long addr, unsigned long len,
 	get_area = current->mm->get_unmapped_area;
 	if (file && file->f_op && file->f_op->get_unmapped_area)
 		get_area = file->f_op->get_unmapped_area;
+	else if (!file && (flags & MAP_SHARED)) {
+		/*
+		 * mmap_region() will call shmem_zero_setup() to create a file,
+		 * so use shmem's get_unmapped_area in case it can be huge.
+		 */
+		pgoff = 0;
+		get_area = shmem_get_unmapped_area;
+	} else if (file && S_ISREG(file->f_path.dentry->d_inode->i_mode) &&
+		   (transparent_hugepage_flags &
+		    ((1<<TRANSPARENT_HUGEPAGE_FLAG) |
+		     (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)))) {
+		/* large regular files may be mapped by filemap_pmd_fault() */
+		get_area = thp_get_unmapped_area;
+	}
 	addr = get_area(file, addr, len, pgoff, flags);
 	if (IS_ERR_VALUE(addr))
 		return addr;
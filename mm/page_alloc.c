@@ -97,6 +97,7 @@ EXPORT_SYMBOL(node_states);
 unsigned long totalram_pages __read_mostly;
 unsigned long totalreserve_pages __read_mostly;
 int percpu_pagelist_fraction;
+int percpu_pagelist_max_order = PCP_MAX_ORDER;
 gfp_t gfp_allowed_mask __read_mostly = GFP_BOOT_MASK;
 
 #ifdef CONFIG_PM_SLEEP
@@ -134,6 +135,7 @@ int pageblock_order __read_mostly;
 #endif
 
 static void __free_pages_ok(struct page *page, unsigned int order);
+static void free_pcp_page(struct page *page, unsigned int order, int cold);
 
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
@@ -558,10 +560,16 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+static inline struct per_cpu_pages *pageset_pcp(struct per_cpu_pageset *pset,
+						int order)
+{
+	return order ? &pset->pcp_order[order - 1] : &pset->pcp;
+}
+
 /*
  * Frees a number of pages from the PCP lists
  * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * count is the number of blocks of that order to free.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -570,7 +578,7 @@ static inline int free_pages_check(struct page *page)
  * pinned" detection logic.
  */
 static void free_pcppages_bulk(struct zone *zone, int count,
-					struct per_cpu_pages *pcp)
+				struct per_cpu_pages *pcp, int order)
 {
 	int migratetype = 0;
 	int batch_free = 0;
@@ -607,11 +615,11 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, count << order);
 	spin_unlock(&zone->lock);
 }
 
@@ -656,8 +664,14 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
+
+	if (order <= percpu_pagelist_max_order) {
+		free_pcp_page(page, order, 0);
+		return;
+	}
 
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -1040,18 +1054,24 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
  * Note that this function must be called with the thread pinned to
  * a single processor.
  */
-void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
+void drain_zone_pages(struct zone *zone, struct per_cpu_pageset *pset)
 {
 	unsigned long flags;
-	int to_drain;
+	int order, to_drain;
 
 	local_irq_save(flags);
-	if (pcp->count >= pcp->batch)
-		to_drain = pcp->batch;
-	else
-		to_drain = pcp->count;
-	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
+	for (order = 0; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_pages *pcp = pageset_pcp(pset, order);
+
+		if (pcp->count >= pcp->batch)
+			to_drain = pcp->batch;
+		else
+			to_drain = pcp->count;
+		if (to_drain) {
+			free_pcppages_bulk(zone, to_drain, pcp, order);
+			pcp->count -= to_drain;
+		}
+	}
 	local_irq_restore(flags);
 }
 #endif
@@ -1071,14 +1091,17 @@ static void drain_pages(unsigned int cpu)
 	for_each_populated_zone(zone) {
 		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
+		int order;
 
 		local_irq_save(flags);
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
-		pcp = &pset->pcp;
-		if (pcp->count) {
-			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			pcp = pageset_pcp(pset, order);
+			if (pcp->count) {
+				free_pcppages_bulk(zone, pcp->count, pcp, order);
+				pcp->count = 0;
+			}
 		}
 		local_irq_restore(flags);
 	}
@@ -1137,10 +1160,10 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of order 0..PCP_MAX_ORDER to the per-cpu lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void free_pcp_page(struct page *page, unsigned int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
@@ -1148,7 +1171,16 @@ void free_hot_cold_page(struct page *page, int cold)
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	if (!free_pages_prepare(page, order))
+		return;
+
+	/*
+	 * Compound pages are torn down in __free_one_page(), but cached
+	 * blocks only get there when the list is drained, and must look
+	 * like any other free block to prep_new_page() before that.
+	 */
+	if (unlikely(PageCompound(page)) &&
+	    unlikely(destroy_compound_page(page, order)))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
@@ -1156,7 +1188,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1167,20 +1199,20 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
-	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	pcp = pageset_pcp(this_cpu_ptr(zone->pageset), order);
 	if (cold)
 		list_add_tail(&page->lru, &pcp->lists[migratetype]);
 	else
 		list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
+		free_pcppages_bulk(zone, pcp->batch, pcp, order);
 		pcp->count -= pcp->batch;
 	}
 
@@ -1188,6 +1220,15 @@ out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	free_pcp_page(page, 0, cold);
+}
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -1276,20 +1317,23 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	int cold = !!(gfp_flags & __GFP_COLD);
 
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= percpu_pagelist_max_order)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
-		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		pcp = pageset_pcp(this_cpu_ptr(zone->pageset), order);
 		list = &pcp->lists[migratetype];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
+			if (order)
+				__count_vm_event(PCP_HIGHORDER_MISS);
+			pcp->count += rmqueue_bulk(zone, order,
 					pcp->batch, list,
 					migratetype, cold);
 			if (unlikely(list_empty(list)))
 				goto failed;
-		}
+		} else if (order)
+			__count_vm_event(PCP_HIGHORDER_HIT);
 
 		if (cold)
 			page = list_entry(list->prev, struct page, lru);
@@ -1614,6 +1658,28 @@ static void zlc_clear_zones_full(struct zonelist *zonelist)
 }
 #endif	/* CONFIG_NUMA */
 
+/*
+ * Blocks on the high-order per-cpu lists are not in NR_FREE_PAGES nor in
+ * free_area, so the watermark check cannot see them.  But buffered_rmqueue()
+ * serves an allocation from this cpu's list for its migratetype first, and
+ * that takes nothing from the buddy lists the watermark protects.
+ */
+static bool zone_pcp_has_block(struct zone *zone, int order, int migratetype)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+	bool ret;
+
+	if (!order || order > percpu_pagelist_max_order)
+		return false;
+
+	local_irq_save(flags);
+	pcp = pageset_pcp(this_cpu_ptr(zone->pageset), order);
+	ret = !list_empty(&pcp->lists[migratetype]);
+	local_irq_restore(flags);
+	return ret;
+}
+
 /*
  * get_page_from_freelist goes through the zonelist trying to allocate
  * a page.
@@ -1653,7 +1719,8 @@ zonelist_scan:
 
 			mark = zone->watermark[alloc_flags & ALLOC_WMARK_MASK];
 			if (zone_watermark_ok(zone, order, mark,
-				    classzone_idx, alloc_flags))
+				    classzone_idx, alloc_flags) ||
+			    zone_pcp_has_block(zone, order, migratetype))
 				goto try_this_zone;
 
 			if (NUMA_BUILD && !did_zlc_setup && nr_online_nodes > 1) {
@@ -1868,6 +1935,7 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 	bool sync_migration)
 {
 	struct page *page;
+	bool drained = false;
 
 	if (!order || compaction_deferred(preferred_zone))
 		return NULL;
@@ -1882,6 +1950,7 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 		drain_pages(get_cpu());
 		put_cpu();
 
+retry:
 		page = get_page_from_freelist(gfp_mask, nodemask,
 				order, zonelist, high_zoneidx,
 				alloc_flags, preferred_zone,
@@ -1897,7 +1966,16 @@ __alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
 		 * It's bad if compaction run occurs and fails.
 		 * The most likely reason is that pages exist,
 		 * but not enough to satisfy watermarks.
+		 *
+		 * Free blocks of the cached orders may also sit on other
+		 * cpus' lists, out of sight of compaction and the buddy
+		 * lists.  Give them back to merge before deferring.
 		 */
+		if (!drained && percpu_pagelist_max_order) {
+			drain_all_pages();
+			drained = true;
+			goto retry;
+		}
 		count_vm_event(COMPACTFAIL);
 		defer_compaction(preferred_zone);
 
@@ -3544,19 +3622,43 @@ static int zone_batchsize(struct zone *zone)
 #endif
 }
 
+/*
+ * The high-order lists are sized from the order-0 high watermark: each
+ * order may hold about a third of it in base pages, so all of them
+ * together cache roughly as much memory as the order-0 list does.
+ */
+static void setup_pageset_orders(struct per_cpu_pageset *p,
+				unsigned long high)
+{
+	int order;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_pages *pcp = pageset_pcp(p, order);
+
+		pcp->high = (high / 3) >> order;
+		pcp->batch = max(1, pcp->high / 4);
+	}
+}
+
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int order, migratetype;
 
 	memset(p, 0, sizeof(*p));
 
+	for (order = 0; order <= PCP_MAX_ORDER; order++) {
+		pcp = pageset_pcp(p, order);
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES;
+							migratetype++)
+			INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	}
+
 	pcp = &p->pcp;
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	setup_pageset_orders(p, pcp->high);
 }
 
 /*
@@ -3574,6 +3676,7 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
+	setup_pageset_orders(p, high);
 }
 
 static void setup_zone_pageset(struct zone *zone)
@@ -3659,11 +3762,16 @@ static int __zone_pcp_update(void *data)
 		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
 
+		int order;
+
 		pset = per_cpu_ptr(zone->pageset, cpu);
-		pcp = &pset->pcp;
 
 		local_irq_save(flags);
-		free_pcppages_bulk(zone, pcp->count, pcp);
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			pcp = pageset_pcp(pset, order);
+			if (pcp->count)
+				free_pcppages_bulk(zone, pcp->count, pcp, order);
+		}
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -4115,6 +4223,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
@@ -4172,7 +4283,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 
 		zone_pcp_init(zone);
 		for_each_lru(l)
-			INIT_LIST_HEAD(&zone->lru[l].list);
+			INIT_LIST_HEAD(&zone->lruvec.lists[l]);
 		zone->reclaim_stat.recent_rotated[0] = 0;
 		zone->reclaim_stat.recent_rotated[1] = 0;
 		zone->reclaim_stat.recent_scanned[0] = 0;
@@ -5018,6 +5129,24 @@ int percpu_pagelist_fraction_sysctl_handler(ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * percpu_pagelist_max_order - the highest order that is cached on the per
+ * cpu pagelists.  Lowering it drains the lists so that no pages of an order
+ * that is no longer cached are left stranded on them.
+ */
+
+int percpu_pagelist_max_order_sysctl_handler(ctl_table *table, int write,
+	void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!write || ret)
+		return ret;
+	drain_all_pages();
+	return 0;
+}
+
 int hashdist = HASHDIST_DEFAULT;
 
 #ifdef CONFIG_NUMA
@@ -17,6 +17,10 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
+#include <linux/math64.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
 
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
@@ -177,7 +181,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
 		page = page_cache_alloc_readahead(mapping);
@@ -202,6 +206,70 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Read the naturally aligned extent of HPAGE_PMD_NR pages at @index into a
+ * single block of memory, so that filemap_pmd_fault() can map it with a
+ * huge pmd.  The block is split into independent pages before the I/O is
+ * started, so nothing else needs to know.  Only tried when no page of the
+ * extent is cached (shadow entries don't count): returns the number of
+ * pages submitted, 0 if the caller should fall back to regular readahead.
+ */
+int page_cache_huge_readahead(struct address_space *mapping,
+			      struct file *filp, pgoff_t index)
+{
+	struct inode *inode = mapping->host;
+	loff_t isize = i_size_read(inode);
+	LIST_HEAD(page_pool);
+	struct page *page;
+	unsigned long found, next = index;
+	bool cached = false;
+	void **slot;
+	int i;
+
+	VM_BUG_ON(index & (HPAGE_PMD_NR - 1));
+	if (isize == 0 ||
+	    index + HPAGE_PMD_NR - 1 > ((isize - 1) >> PAGE_CACHE_SHIFT))
+		return 0;
+
+	rcu_read_lock();
+	while (radix_tree_gang_lookup_slot(&mapping->page_tree, &slot, &found,
+					   next, 1) &&
+	       found < index + HPAGE_PMD_NR) {
+		page = radix_tree_deref_slot(slot);
+		if (radix_tree_deref_retry(page))
+			continue;
+		/* Shadow entries of evicted pages are holes here */
+		if (page && !radix_tree_exceptional_entry(page)) {
+			cached = true;
+			break;
+		}
+		next = found + 1;
+	}
+	rcu_read_unlock();
+	if (cached)
+		return 0;
+
+	/* opportunistic, like the rest of readahead */
+	page = alloc_pages(mapping_gfp_mask(mapping) | __GFP_COLD |
+			   __GFP_NORETRY | __GFP_NOWARN | __GFP_NO_KSWAPD,
+			   HPAGE_PMD_ORDER);
+	if (!page)
+		return 0;
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page[i].index = index + i;
+		list_add(&page[i].lru, &page_pool);
+	}
+	read_pages(mapping, filp, &page_pool, HPAGE_PMD_NR);
+	BUG_ON(!list_empty(&page_pool));
+	count_vm_event(THP_FILE_ALLOC);
+
+	return HPAGE_PMD_NR;
+}
+#endif
+
 /*
  * Chunk the readahead into 2 megabyte units, so that we don't pin too much
  * memory at once.
@@ -209,11 +277,14 @@ out:
 int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		pgoff_t offset, unsigned long nr_to_read)
 {
+	struct blk_plug plug;
 	int ret = 0;
 
 	if (unlikely(!mapping->a_ops->readpage && !mapping->a_ops->readpages))
 		return -EINVAL;
 
+	/* Let the chunks go down to the device as one batch */
+	blk_start_plug(&plug);
 	nr_to_read = max_sane_readahead(nr_to_read);
 	while (nr_to_read) {
 		int err;
@@ -232,6 +303,7 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		offset += this_chunk;
 		nr_to_read -= this_chunk;
 	}
+	blk_finish_plug(&plug);
 	return ret;
 }
 
@@ -259,6 +331,83 @@ unsigned long ra_submit(struct file_ra_state *ra,
 	return actual;
 }
 
+/*
+ * Update the read bandwidth and latency estimates of @bdi from the reads
+ * completed by its request queue, at most every READ_ESTIMATE_INTERVAL.
+ * Only an interval during which the device had a read in flight for most
+ * of the time counts: what it delivers while idle says nothing of what it
+ * could deliver.  Completion times are only counted in jiffies, but summed
+ * over many reads, each straddling a tick with probability proportional to
+ * its length, they still average out to the right latency.
+ */
+#define READ_ESTIMATE_INTERVAL	max(HZ / 5, 1)
+
+static void bdi_update_read_estimate(struct backing_dev_info *bdi)
+{
+	unsigned long stamp = bdi->read_time_stamp;
+	unsigned long elapsed = jiffies - stamp;
+	struct bdi_read_stat sum = { 0 };
+	unsigned long sectors, ios, ticks;
+	unsigned long bw, latency;
+	int cpu;
+
+	if (elapsed < READ_ESTIMATE_INTERVAL)
+		return;
+	/* Of racing readers, one updates and the rest use the old estimate */
+	if (cmpxchg(&bdi->read_time_stamp, stamp, stamp + elapsed) != stamp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct bdi_read_stat *stat = per_cpu_ptr(bdi->read_stat, cpu);
+
+		sum.sectors += stat->sectors;
+		sum.ios += stat->ios;
+		sum.ticks += stat->ticks;
+	}
+	sectors = sum.sectors - bdi->read_stamp.sectors;
+	ios = sum.ios - bdi->read_stamp.ios;
+	ticks = sum.ticks - bdi->read_stamp.ticks;
+	bdi->read_stamp = sum;
+
+	if (!ios || ticks < elapsed / 2)
+		return;
+
+	bw = div_u64((u64)sectors * HZ, elapsed) >> (PAGE_SHIFT - 9);
+	latency = div_u64((u64)ticks * USEC_PER_SEC, (u64)ios * HZ);
+
+	/* Smooth them a little, but start from the first sample */
+	if (!bdi->read_bandwidth) {
+		bdi->read_bandwidth = bw;
+		bdi->read_latency = latency;
+	} else {
+		bdi->read_bandwidth = (3 * bdi->read_bandwidth + bw) / 4;
+		bdi->read_latency = (3 * bdi->read_latency + latency) / 4;
+	}
+}
+
+/*
+ * The maximum readahead window: ra_pages, unless the bdi asks for adaptive
+ * readahead.  Then it is twice the data which the device delivers in one
+ * read latency, so that the next window is on its way before the reader
+ * gets to the end of this one; never less than ra_pages, which without an
+ * estimate (no request queue, or no reads yet) it stays.
+ */
+static unsigned long get_max_ra_size(struct address_space *mapping,
+				     struct file_ra_state *ra)
+{
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long max;
+
+	if (!bdi->read_ahead_adaptive || !bdi->read_stat)
+		return ra->ra_pages;
+
+	bdi_update_read_estimate(bdi);
+	max = div_u64((u64)bdi->read_bandwidth * bdi->read_latency * 2,
+		      USEC_PER_SEC);
+	max = min(max, (VM_MAX_ADAPTIVE_READAHEAD * 1024) / PAGE_CACHE_SIZE);
+	return max_t(unsigned long, max, ra->ra_pages);
+}
+
 /*
  * Set the initial window size, round to next power of 2 and square
  * for small size, x 4 for medium, and x 2 for large
@@ -349,7 +498,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
@@ -398,7 +547,8 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max = max_sane_readahead(get_max_ra_size(mapping, ra));
+	int pattern = RA_PATTERN_INITIAL;
 
 	/*
 	 * start of file
@@ -415,6 +565,7 @@ ondemand_readahead(struct address_space *mapping,
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_SUBSEQUENT;
 		goto readit;
 	}
 
@@ -428,7 +579,7 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset + 1, max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
@@ -439,14 +590,17 @@ ondemand_readahead(struct address_space *mapping,
 		ra->size += req_size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_MARKER;
 		goto readit;
 	}
 
 	/*
 	 * oversize read
 	 */
-	if (req_size > max)
+	if (req_size > max) {
+		pattern = RA_PATTERN_OVERSIZE;
 		goto initial_readahead;
+	}
 
 	/*
 	 * sequential cache miss
@@ -458,8 +612,10 @@ ondemand_readahead(struct address_space *mapping,
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = RA_PATTERN_CONTEXT;
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
@@ -483,6 +639,7 @@ readit:
 		ra->size += ra->async_size;
 	}
 
+	trace_readahead_window(mapping, ra, offset, req_size, max, pattern);
 	return ra_submit(ra, mapping, filp);
 }
 
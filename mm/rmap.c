@@ -59,6 +59,8 @@
 
 #include <asm/tlbflush.h>
 
+#include <trace/events/vmscan.h>
+
 #include "internal.h"
 
 static struct kmem_cache *anon_vma_cachep;
@@ -689,8 +691,27 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		 * these out using page_check_address().
 		 */
 		pte = page_check_address(page, mm, address, &ptl, 0);
-		if (!pte)
-			goto out;
+		if (!pte) {
+			pmd_t *pmd;
+
+			/* a page cache page may be mapped by a huge pmd */
+			pmd = page_check_file_huge_pmd(page, vma, address);
+			if (!pmd)
+				goto out;
+
+			if (vma->vm_flags & VM_LOCKED) {
+				spin_unlock(&mm->page_table_lock);
+				*mapcount = 0;	/* break early from loop */
+				*vm_flags |= VM_LOCKED;
+				goto out;
+			}
+
+			if (file_huge_pmd_referenced(page, vma, address, pmd) &&
+			    likely(!VM_SequentialReadHint(vma)))
+				referenced++;
+			spin_unlock(&mm->page_table_lock);
+			goto out_referenced;
+		}
 
 		if (vma->vm_flags & VM_LOCKED) {
 			pte_unmap_unlock(pte, ptl);
@@ -713,6 +734,7 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		pte_unmap_unlock(pte, ptl);
 	}
 
+out_referenced:
 	/* Pretend the page is referenced if the task has the
 	   swap token and is in the middle of a page fault. */
 	if (mm != current->mm && has_swap_token(mm) &&
@@ -1162,6 +1184,128 @@ void page_remove_rmap(struct page *page)
 	 */
 }
 
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+/*
+ * Flush the TLBs of all mms with ptes cleared under TTU_BATCH_FLUSH.  The
+ * flush of each mm replaces the per-page flush_tlb_page() of every page
+ * unmapped from it, and so saves nr_pages - 1 rounds of IPIs when the mm
+ * is active on other cpus.
+ */
+void try_to_unmap_flush(void)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = current->tlb_ubc;
+	int i;
+
+	if (!tlb_ubc)
+		return;
+
+	for (i = 0; i < tlb_ubc->nr_mm; i++) {
+		struct mm_struct *mm = tlb_ubc->mm[i];
+		unsigned int nr_pages = tlb_ubc->nr_pages[i];
+
+		trace_mm_vmscan_unmap_tlb_flush(mm, nr_pages);
+		if (nr_pages > 1 && cpumask_any_but(mm_cpumask(mm),
+				raw_smp_processor_id()) < nr_cpu_ids)
+			count_vm_events(UNMAP_TLB_FLUSH_SAVED, nr_pages - 1);
+		flush_tlb_mm(mm);
+		mmdrop(mm);
+	}
+	tlb_ubc->nr_mm = 0;
+	tlb_ubc->writable = false;
+}
+
+/*
+ * A cpu could still write to a page through a stale TLB entry of a dirty
+ * pte, so such pages must not be written back before the flush.
+ */
+void try_to_unmap_flush_dirty(void)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = current->tlb_ubc;
+
+	if (tlb_ubc && tlb_ubc->writable)
+		try_to_unmap_flush();
+}
+
+/*
+ * Record that a pte of @mm was cleared without a TLB flush.  The mm is
+ * pinned until try_to_unmap_flush() so that its cpumask stays valid.
+ */
+static void set_tlb_ubc_flush_pending(struct mm_struct *mm, bool writable)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = current->tlb_ubc;
+	int i;
+
+	for (i = 0; i < tlb_ubc->nr_mm; i++)
+		if (tlb_ubc->mm[i] == mm)
+			goto found;
+
+	if (tlb_ubc->nr_mm == TLB_UBC_NR_MM)
+		try_to_unmap_flush();
+	i = tlb_ubc->nr_mm++;
+	atomic_inc(&mm->mm_count);
+	tlb_ubc->mm[i] = mm;
+	tlb_ubc->nr_pages[i] = 0;
+found:
+	tlb_ubc->nr_pages[i]++;
+	if (writable)
+		tlb_ubc->writable = true;
+
+	/*
+	 * Under the pte lock, after the pte was cleared: anyone taking the
+	 * lock to change ptes of this mm sees it and flushes first.
+	 */
+	barrier();
+	mm->tlb_flush_batched = true;
+}
+
+/*
+ * Called under the pte lock by munmap, mprotect, mremap and MADV_DONTNEED
+ * before they change ptes.  Reclaim may have cleared ptes of this mm and
+ * not flushed the TLB yet: another cpu could then keep a stale writable
+ * entry for a page which reclaim frees after the caller is done, and which
+ * the caller's own flush, covering only the ptes it changed, misses.
+ */
+void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+	if (mm->tlb_flush_batched) {
+		flush_tlb_mm(mm);
+
+		/*
+		 * Do not allow the compiler to re-order the clearing of
+		 * tlb_flush_batched before the flush is issued.
+		 */
+		barrier();
+		mm->tlb_flush_batched = false;
+	}
+}
+
+/*
+ * Only defer the flush if the caller asked for it and the mm may be live
+ * on another cpu.  A local flush is cheap and not worth batching.
+ */
+static bool should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
+{
+	bool ret = false;
+
+	if (!(flags & TTU_BATCH_FLUSH) || !current->tlb_ubc)
+		return false;
+
+	if (cpumask_any_but(mm_cpumask(mm), get_cpu()) < nr_cpu_ids)
+		ret = true;
+	put_cpu();
+	return ret;
+}
+#else
+static void set_tlb_ubc_flush_pending(struct mm_struct *mm, bool writable)
+{
+}
+
+static bool should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
+{
+	return false;
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
+
 /*
  * Subfunctions of try_to_unmap: try_to_unmap_one called
  * repeatedly from try_to_unmap_ksm, try_to_unmap_anon or try_to_unmap_file.
@@ -1176,8 +1320,36 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	int ret = SWAP_AGAIN;
 
 	pte = page_check_address(page, mm, address, &ptl, 0);
-	if (!pte)
-		goto out;
+	if (!pte) {
+		pmd_t *pmd;
+
+		/*
+		 * A page cache page mapped by a huge pmd is unmapped alone
+		 * once the pmd is split into ptes; but don't split it when
+		 * there is nothing to do or reclaim would fail anyway.
+		 */
+		pmd = page_check_file_huge_pmd(page, vma, address);
+		if (!pmd)
+			goto out;
+		if ((flags & TTU_IGNORE_MLOCK) ||
+		    !(vma->vm_flags & VM_LOCKED)) {
+			if (TTU_ACTION(flags) == TTU_MUNLOCK) {
+				spin_unlock(&mm->page_table_lock);
+				goto out;
+			}
+			if (!(flags & TTU_IGNORE_ACCESS) &&
+			    file_huge_pmd_referenced(page, vma, address, pmd)) {
+				spin_unlock(&mm->page_table_lock);
+				return SWAP_FAIL;
+			}
+		}
+		split_file_huge_pmd(vma, address, pmd);
+		spin_unlock(&mm->page_table_lock);
+
+		pte = page_check_address(page, mm, address, &ptl, 0);
+		if (!pte)
+			goto out;
+	}
 
 	/*
 	 * If the page is mlock()d, we cannot swap it out.
@@ -1200,7 +1372,16 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 
 	/* Nuke the page table entry. */
 	flush_cache_page(vma, address, page_to_pfn(page));
-	pteval = ptep_clear_flush_notify(vma, address, pte);
+	if (should_defer_flush(mm, flags)) {
+		/*
+		 * The TLB is flushed later for all pages unmapped from this
+		 * mm.  Secondary MMUs are invalidated right away.
+		 */
+		pteval = ptep_get_and_clear(mm, address, pte);
+		mmu_notifier_invalidate_page(mm, address);
+		set_tlb_ubc_flush_pending(mm, pte_dirty(pteval));
+	} else
+		pteval = ptep_clear_flush_notify(vma, address, pte);
 
 	/* Move the dirty bit to the physical page now the pte is gone. */
 	if (pte_dirty(pteval))
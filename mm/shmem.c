@@ -89,8 +89,74 @@ enum sgp_type {
 	SGP_CACHE,	/* don't exceed i_size, may allocate page */
 	SGP_DIRTY,	/* like SGP_CACHE, but set new page dirty */
 	SGP_WRITE,	/* may exceed i_size, may allocate page */
+	SGP_NOHUGE,	/* like SGP_CACHE, but no huge extent */
+	SGP_HUGE,	/* like SGP_CACHE, huge extent if advised */
 };
 
+/*
+ * Allocation of huge extents, naturally aligned blocks of HPAGE_PMD_NR
+ * pages that shared mappings can map with a single huge pmd.  The tmpfs
+ * "huge=" mount option selects one of:
+ */
+#define SHMEM_HUGE_NEVER	0	/* small pages only */
+#define SHMEM_HUGE_ALWAYS	1	/* whenever a page is allocated */
+#define SHMEM_HUGE_WITHIN_SIZE	2	/* if the extent is within i_size */
+#define SHMEM_HUGE_ADVISE	3	/* for MADV_HUGEPAGE mappings */
+
+/*
+ * and /sys/kernel/mm/transparent_hugepage/shmem_enabled, which sets it for
+ * the internal mount of SysV shm and shared anonymous mappings, may also
+ * override all mounts with:
+ */
+#define SHMEM_HUGE_DENY		(-1)	/* for emergencies */
+#define SHMEM_HUGE_FORCE	(-2)	/* for testing */
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static int shmem_huge __read_mostly;
+
+#if defined(CONFIG_SYSFS) || defined(CONFIG_TMPFS)
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "advise"))
+		return SHMEM_HUGE_ADVISE;
+	if (!strcmp(str, "deny"))
+		return SHMEM_HUGE_DENY;
+	if (!strcmp(str, "force"))
+		return SHMEM_HUGE_FORCE;
+	return -EINVAL;
+}
+
+static const char *shmem_format_huge(int huge)
+{
+	switch (huge) {
+	case SHMEM_HUGE_NEVER:
+		return "never";
+	case SHMEM_HUGE_ALWAYS:
+		return "always";
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return "within_size";
+	case SHMEM_HUGE_ADVISE:
+		return "advise";
+	case SHMEM_HUGE_DENY:
+		return "deny";
+	case SHMEM_HUGE_FORCE:
+		return "force";
+	default:
+		VM_BUG_ON(1);
+		return "bad_val";
+	}
+}
+#endif
+#else
+#define shmem_huge SHMEM_HUGE_DENY
+#endif
+
 #ifdef CONFIG_TMPFS
 static unsigned long shmem_default_max_blocks(void)
 {
@@ -142,10 +208,11 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size)
  * shmem_getpage reports shmem_acct_block failure as -ENOSPC not -ENOMEM,
  * so that a failure on a sparse tmpfs mapping will give SIGBUS not OOM.
  */
-static inline int shmem_acct_block(unsigned long flags)
+static inline int shmem_acct_block(unsigned long flags, long pages)
 {
 	return (flags & VM_NORESERVE) ?
-		security_vm_enough_memory_kern(VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+		security_vm_enough_memory_kern(pages *
+					       VM_ACCT(PAGE_CACHE_SIZE)) : 0;
 }
 
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
@@ -170,6 +237,15 @@ static struct backing_dev_info shmem_backing_dev_info  __read_mostly = {
 static LIST_HEAD(shmem_swaplist);
 static DEFINE_MUTEX(shmem_swaplist_mutex);
 
+/*
+ * Exceptional entries in a shmem mapping are swap entries; in any other
+ * mapping, they are shadows of evicted pages.
+ */
+bool shmem_mapping(struct address_space *mapping)
+{
+	return mapping->backing_dev_info == &shmem_backing_dev_info;
+}
+
 static int shmem_reserve_inode(struct super_block *sb)
 {
 	struct shmem_sb_info *sbinfo = SHMEM_SB(sb);
@@ -796,6 +872,22 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	 */
 	return alloc_page_vma(gfp, &pvma, 0);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = index;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, index);
+
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0, numa_node_id());
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *mpol)
@@ -814,6 +906,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -823,6 +923,155 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Whether huge extents may be used for @inode at all, and with @sgp for
+ * the extent holding @index.
+ */
+static bool shmem_huge_enabled(struct inode *inode)
+{
+	if (!S_ISREG(inode->i_mode) || shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	return shmem_huge == SHMEM_HUGE_FORCE ||
+		SHMEM_SB(inode->i_sb)->huge != SHMEM_HUGE_NEVER;
+}
+
+static bool shmem_should_alloc_huge(struct inode *inode, pgoff_t index,
+				    enum sgp_type sgp)
+{
+	pgoff_t hindex = round_down(index, HPAGE_PMD_NR);
+
+	if (sgp == SGP_NOHUGE || !shmem_huge_enabled(inode))
+		return false;
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return hindex + HPAGE_PMD_NR <=
+			DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE);
+	case SHMEM_HUGE_ADVISE:
+		return sgp == SGP_HUGE;
+	}
+	return false;
+}
+
+/*
+ * Allocate the whole empty extent around @index as a naturally aligned,
+ * physically contiguous block, for shmem_pmd_fault() to map.  It is split
+ * into small pages at once: they're inserted, accounted and reclaimed
+ * one by one as if allocated separately, so no other part of shmem has
+ * to know about extents.  Returns the page at @index locked, or NULL when
+ * the caller should allocate a small page instead.
+ */
+static struct page *shmem_alloc_huge_extent(struct inode *inode,
+					    pgoff_t index, enum sgp_type sgp,
+					    gfp_t gfp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	pgoff_t hindex = round_down(index, HPAGE_PMD_NR);
+	struct page *page, *ret = NULL;
+	struct page *found;
+	pgoff_t found_index;
+	int i, nr;
+
+	if (!shmem_should_alloc_huge(inode, index, sgp))
+		return NULL;
+
+	/* only an empty extent: never mix in pages that are swapped out */
+	if (shmem_find_get_pages_and_swap(mapping, hindex, 1,
+					  &found, &found_index)) {
+		if (!radix_tree_exceptional_entry(found))
+			page_cache_release(found);
+		if (found_index < hindex + HPAGE_PMD_NR)
+			return NULL;
+	}
+
+	if (shmem_acct_block(info->flags, HPAGE_PMD_NR))
+		return NULL;
+	if (sbinfo->max_blocks) {
+		if (percpu_counter_compare(&sbinfo->used_blocks,
+				(s64)sbinfo->max_blocks - HPAGE_PMD_NR) > 0)
+			goto unacct;
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+	}
+
+	/* opportunistic, like khugepaged: don't reclaim hard for it */
+	page = shmem_alloc_hugepage(gfp | __GFP_NORETRY | __GFP_NOWARN |
+				    __GFP_NOMEMALLOC | __GFP_NO_KSWAPD,
+				    info, hindex);
+	if (!page)
+		goto decused;
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_highpage(page + i);
+		flush_dcache_page(page + i);
+		SetPageUptodate(page + i);
+		SetPageSwapBacked(page + i);
+		__set_page_locked(page + i);
+	}
+
+	/*
+	 * Insert the pages in order, stopping at the first failure: an
+	 * extent that raced with another allocation is simply incomplete,
+	 * and will be mapped by ptes.
+	 */
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		if (mem_cgroup_cache_charge(page + nr, current->mm,
+					    gfp & GFP_RECLAIM_MASK))
+			break;
+		if (shmem_add_to_page_cache(page + nr, mapping, hindex + nr,
+					    gfp, NULL))
+			break;
+		lru_cache_add_anon(page + nr);
+	}
+
+	spin_lock(&info->lock);
+	info->alloced += nr;
+	inode->i_blocks += BLOCKS_PER_PAGE * nr;
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (i < nr && hindex + i == index) {
+			ret = page + i;
+			continue;
+		}
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+
+	if (nr < HPAGE_PMD_NR) {
+		if (sbinfo->max_blocks)
+			percpu_counter_add(&sbinfo->used_blocks,
+					   nr - HPAGE_PMD_NR);
+		shmem_unacct_blocks(info->flags, HPAGE_PMD_NR - nr);
+	}
+	if (nr == HPAGE_PMD_NR)
+		count_vm_event(THP_FILE_ALLOC);
+	return ret;
+
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -HPAGE_PMD_NR);
+unacct:
+	shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+	return NULL;
+}
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+static inline struct page *shmem_alloc_huge_extent(struct inode *inode,
+					pgoff_t index, enum sgp_type sgp,
+					gfp_t gfp)
+{
+	return NULL;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /*
  * shmem_getpage_gfp - find page in cache, or get from swap, or allocate
  *
@@ -845,7 +1094,7 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 		return -EFBIG;
 repeat:
 	swap.val = 0;
-	page = find_lock_page(mapping, index);
+	page = find_lock_entry(mapping, index);
 	if (radix_tree_exceptional_entry(page)) {
 		swap = radix_to_swp_entry(page);
 		page = NULL;
@@ -924,7 +1173,14 @@ repeat:
 		swap_free(swap);
 
 	} else {
-		if (shmem_acct_block(info->flags)) {
+		page = shmem_alloc_huge_extent(inode, index, sgp, gfp);
+		if (page) {
+			if (sgp == SGP_DIRTY)
+				set_page_dirty(page);
+			goto done;
+		}
+
+		if (shmem_acct_block(info->flags, 1)) {
 			error = -ENOSPC;
 			goto failed;
 		}
@@ -993,7 +1249,7 @@ unacct:
 	shmem_unacct_blocks(info->flags, 1);
 failed:
 	if (swap.val && error != -EINVAL) {
-		struct page *test = find_get_page(mapping, index);
+		struct page *test = find_get_entry(mapping, index);
 		if (test && !radix_tree_exceptional_entry(test))
 			page_cache_release(test);
 		/* Have another try if the entry has changed */
@@ -1016,13 +1272,25 @@ failed:
 	return error;
 }
 
+static inline enum sgp_type shmem_fault_sgp(struct vm_area_struct *vma)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return SGP_NOHUGE;
+	if (vma->vm_flags & VM_HUGEPAGE)
+		return SGP_HUGE;
+#endif
+	return SGP_CACHE;
+}
+
 static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
 	int error;
 	int ret = VM_FAULT_LOCKED;
 
-	error = shmem_getpage(inode, vmf->pgoff, &vmf->page, SGP_CACHE, &ret);
+	error = shmem_getpage(inode, vmf->pgoff, &vmf->page,
+			      shmem_fault_sgp(vma), &ret);
 	if (error)
 		return ((error == -ENOMEM) ? VM_FAULT_OOM : VM_FAULT_SIGBUS);
 
@@ -1033,6 +1301,58 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Map a whole extent with a huge pmd if it is, or can be made, complete:
+ * all its pages in cache, uptodate and physically contiguous, as when
+ * shmem_alloc_huge_extent() allocated them.  Only shared mappings are
+ * eligible: there is little point in private mappings of tmpfs files.
+ * Anything else falls back to shmem_fault() and ptes.
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgoff_t hindex, index;
+	struct page *page;
+	int ret = 0;
+	int error;
+
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_NONLINEAR | VM_NOHUGEPAGE)))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	hindex = ((haddr - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+	if (hindex & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	if (!shmem_huge_enabled(inode))
+		return VM_FAULT_FALLBACK;
+	if (hindex + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return VM_FAULT_FALLBACK;
+
+	/* errors are left for shmem_fault() to report */
+	index = hindex + ((address - haddr) >> PAGE_SHIFT);
+	error = shmem_getpage(inode, index, &page, shmem_fault_sgp(vma), &ret);
+	if (error)
+		return VM_FAULT_FALLBACK;
+	unlock_page(page);
+	page_cache_release(page);
+
+	error = map_file_huge_extent(vma, address, pmd, hindex, flags);
+	if (error)
+		return error;
+
+	if (ret & VM_FAULT_MAJOR) {
+		count_vm_event(PGMAJFAULT);
+		mem_cgroup_count_vm_event(vma->vm_mm, PGMAJFAULT);
+	}
+	return ret;
+}
+#endif
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -1091,6 +1411,38 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	return 0;
 }
 
+/*
+ * Place mappings of tmpfs files, SysV shm and shared anonymous memory at
+ * huge page aligned addresses whenever their extents may be mapped huge.
+ */
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long uaddr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	struct super_block *sb;
+
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return thp_get_unmapped_area(file, uaddr, len, pgoff, flags);
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		goto out;
+
+	if (file) {
+		VM_BUG_ON(file->f_op != &shmem_file_operations);
+		sb = file->f_path.mnt->mnt_sb;
+	} else {
+		/* shared anonymous, set up by shmem_zero_setup() */
+		if (IS_ERR(shm_mnt))
+			goto out;
+		sb = shm_mnt->mnt_sb;
+	}
+	if (SHMEM_SB(sb)->huge != SHMEM_HUGE_NEVER)
+		return thp_get_unmapped_area(file, uaddr, len, pgoff, flags);
+out:
+#endif
+	return current->mm->get_unmapped_area(file, uaddr, len, pgoff, flags);
+}
+
 static struct inode *shmem_get_inode(struct super_block *sb, const struct inode *dir,
 				     int mode, dev_t dev, unsigned long flags)
 {
@@ -2065,6 +2417,15 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+
+			/* deny and force only make sense system wide */
+			if (huge < 0)
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2110,6 +2471,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2133,6 +2495,10 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_format_huge(sbinfo->huge));
+#endif
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2277,6 +2643,7 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+	.get_unmapped_area = shmem_get_unmapped_area,
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -2350,6 +2717,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2394,6 +2764,10 @@ int __init shmem_init(void)
 		printk(KERN_ERR "Could not kern_mount tmpfs\n");
 		goto out1;
 	}
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (shmem_huge > SHMEM_HUGE_DENY)
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+#endif
 	return 0;
 
 out1:
@@ -2407,6 +2781,58 @@ out4:
 	return error;
 }
 
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS)
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	int values[] = {
+		SHMEM_HUGE_ALWAYS,
+		SHMEM_HUGE_WITHIN_SIZE,
+		SHMEM_HUGE_ADVISE,
+		SHMEM_HUGE_NEVER,
+		SHMEM_HUGE_DENY,
+		SHMEM_HUGE_FORCE,
+	};
+	int i, count;
+
+	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
+		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
+
+		count += sprintf(buf + count, fmt,
+				 shmem_format_huge(values[i]));
+	}
+	buf[count - 1] = '\n';
+	return count;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	char tmp[16];
+	int huge;
+
+	if (count + 1 > sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	if (count && tmp[count - 1] == '\n')
+		tmp[count - 1] = '\0';
+
+	huge = shmem_parse_huge(tmp);
+	if (huge == -EINVAL)
+		return -EINVAL;
+
+	shmem_huge = huge;
+	if (shmem_huge > SHMEM_HUGE_DENY)
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE && CONFIG_SYSFS */
+
 #else /* !CONFIG_SHMEM */
 
 /*
@@ -2441,6 +2867,11 @@ int shmem_unuse(swp_entry_t swap, struct page *page)
 	return 0;
 }
 
+bool shmem_mapping(struct address_space *mapping)
+{
+	return false;
+}
+
 int shmem_lock(struct file *file, int lock, struct user_struct *user)
 {
 	return 0;
@@ -2452,6 +2883,13 @@ void shmem_truncate_range(struct inode *inode, loff_t lstart, loff_t lend)
 }
 EXPORT_SYMBOL_GPL(shmem_truncate_range);
 
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long addr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+
 #define shmem_vm_ops				generic_file_vm_ops
 #define shmem_file_operations			ramfs_file_operations
 #define shmem_get_inode(sb, dir, mode, dev, flags)	ramfs_get_inode(sb, dir, mode, dev)
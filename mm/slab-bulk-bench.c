@@ -0,0 +1,103 @@
+/*
+ * mm/slab-bulk-bench.c
+ *
+ * Compares kmem_cache_alloc_bulk()/kmem_cache_free_bulk() with allocating
+ * and freeing the same objects one at a time.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+#define BENCH_OBJ_SIZE		256
+#define BENCH_MAX_BATCH		256
+#define BENCH_OBJECTS		(1 << 20)
+
+static int obj_size = BENCH_OBJ_SIZE;
+module_param(obj_size, int, 0444);
+MODULE_PARM_DESC(obj_size, "Size of the benchmarked objects");
+
+static void *objs[BENCH_MAX_BATCH];
+static int bench_failed;
+
+static u64 bench_single(struct kmem_cache *cache, int batch)
+{
+	ktime_t start;
+	int i, j;
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_OBJECTS / batch; i++) {
+		for (j = 0; j < batch; j++) {
+			objs[j] = kmem_cache_alloc(cache, GFP_KERNEL);
+			if (!objs[j]) {
+				bench_failed++;
+				break;
+			}
+		}
+		while (j--)
+			kmem_cache_free(cache, objs[j]);
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static u64 bench_bulk(struct kmem_cache *cache, int batch)
+{
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_OBJECTS / batch; i++) {
+		if (!kmem_cache_alloc_bulk(cache, GFP_KERNEL, batch, objs)) {
+			bench_failed++;
+			continue;
+		}
+		kmem_cache_free_bulk(cache, batch, objs);
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int __init slab_bulk_bench_init(void)
+{
+	struct kmem_cache *cache;
+	int batch;
+
+	if (obj_size <= 0 || obj_size > KMALLOC_MAX_SIZE)
+		return -EINVAL;
+
+	cache = kmem_cache_create("slab_bulk_bench", obj_size, 0, 0, NULL);
+	if (!cache)
+		return -ENOMEM;
+
+	printk(KERN_INFO "slab_bulk_bench: %d byte objects, ns per object "
+	       "(alloc + free)\n", obj_size);
+	for (batch = 1; batch <= BENCH_MAX_BATCH; batch <<= 1) {
+		u64 single, bulk;
+
+		bench_failed = 0;
+		single = bench_single(cache, batch);
+		bulk = bench_bulk(cache, batch);
+
+		printk(KERN_INFO "slab_bulk_bench: batch %3d: single %3llu "
+		       "bulk %3llu%s\n", batch,
+		       div_u64(single, BENCH_OBJECTS),
+		       div_u64(bulk, BENCH_OBJECTS),
+		       bench_failed ? " (failures)" : "");
+		cond_resched();
+	}
+
+	kmem_cache_destroy(cache);
+	/* Nothing to keep loaded */
+	return -EAGAIN;
+}
+module_init(slab_bulk_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Slab bulk allocation API benchmark");
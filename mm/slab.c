@@ -384,6 +384,11 @@ static void kmem_list3_init(struct kmem_list3 *parent)
 #define	STATS_INC_NODEALLOCS(x)	((x)->node_allocs++)
 #define	STATS_INC_NODEFREES(x)	((x)->node_frees++)
 #define STATS_INC_ACOVERFLOW(x)   ((x)->node_overflow++)
+#define	STATS_ADD_REMOTEFLUSH(x, n)					\
+	do {								\
+		(x)->remote_flushes++;					\
+		(x)->remote_flush_objs += (n);				\
+	} while (0)
 #define	STATS_SET_FREEABLE(x, i)					\
 	do {								\
 		if ((x)->max_freeable < i)				\
@@ -404,6 +409,7 @@ static void kmem_list3_init(struct kmem_list3 *parent)
 #define	STATS_INC_NODEALLOCS(x)	do { } while (0)
 #define	STATS_INC_NODEFREES(x)	do { } while (0)
 #define STATS_INC_ACOVERFLOW(x)   do { } while (0)
+#define	STATS_ADD_REMOTEFLUSH(x, n) do { } while (0)
 #define	STATS_SET_FREEABLE(x, i) do { } while (0)
 #define STATS_INC_ALLOCHIT(x)	do { } while (0)
 #define STATS_INC_ALLOCMISS(x)	do { } while (0)
@@ -963,6 +969,10 @@ static int transfer_objects(struct array_cache *to,
 
 #define drain_alien_cache(cachep, alien) do { } while (0)
 #define reap_alien(cachep, l3) do { } while (0)
+#define alloc_remote_free(cachep) do { } while (0)
+#define free_remote_free(cachep) do { } while (0)
+#define drain_remote_free(cachep) do { } while (0)
+#define drain_remote_free_cpu(cachep, cpu) do { } while (0)
 
 static inline struct array_cache **alloc_alien_cache(int node, int limit, gfp_t gfp)
 {
@@ -1031,6 +1041,85 @@ static void free_alien_cache(struct array_cache **ac_ptr)
 	kfree(ac_ptr);
 }
 
+/*
+ * Objects freed on a cpu that belong to a slab on another node are
+ * collected in a per-cpu batch and handed back to their home node in one
+ * go.  The remote list_lock is then taken once per batch, and the alien
+ * cache lock that all cpus of a node share is not taken at all.  A batch
+ * only holds objects of one node: freeing an object of another node
+ * flushes it first.
+ */
+#define REMOTE_FREE_LIMIT	32
+
+struct remote_free {
+	int node;		/* home node of the batched objects */
+	unsigned int avail;
+	void *entry[REMOTE_FREE_LIMIT];
+};
+
+static void alloc_remote_free(struct kmem_cache *cachep)
+{
+	if (!use_alien_caches || cachep->remote_free)
+		return;
+	/* Without the batches frees simply go through the alien caches */
+	cachep->remote_free = alloc_percpu(struct remote_free);
+}
+
+static void free_remote_free(struct kmem_cache *cachep)
+{
+	free_percpu(cachep->remote_free);
+}
+
+/*
+ * Must be called with interrupts disabled, either on the cpu that owns
+ * the batch or for a cpu that is dead.
+ */
+static void flush_remote_free(struct kmem_cache *cachep,
+				struct remote_free *rf)
+{
+	struct kmem_list3 *rl3;
+	struct array_cache *shared;
+	int nr;
+
+	if (!rf->avail)
+		return;
+
+	STATS_ADD_REMOTEFLUSH(cachep, rf->avail);
+	rl3 = cachep->nodelists[rf->node];
+	spin_lock(&rl3->list_lock);
+	/*
+	 * As in __drain_alien_cache(), stuff the objects into the remote
+	 * node's shared array first.
+	 */
+	shared = rl3->shared;
+	if (shared) {
+		nr = min(rf->avail, shared->limit - shared->avail);
+		memcpy(shared->entry + shared->avail,
+			rf->entry + rf->avail - nr, sizeof(void *) * nr);
+		shared->avail += nr;
+		rf->avail -= nr;
+	}
+	if (rf->avail)
+		free_block(cachep, rf->entry, rf->avail, rf->node);
+	rf->avail = 0;
+	spin_unlock(&rl3->list_lock);
+}
+
+static void drain_remote_free(struct kmem_cache *cachep)
+{
+	if (cachep->remote_free)
+		flush_remote_free(cachep, this_cpu_ptr(cachep->remote_free));
+}
+
+static void drain_remote_free_cpu(struct kmem_cache *cachep, int cpu)
+{
+	if (cachep->remote_free) {
+		local_irq_disable();
+		flush_remote_free(cachep, per_cpu_ptr(cachep->remote_free, cpu));
+		local_irq_enable();
+	}
+}
+
 static void __drain_alien_cache(struct kmem_cache *cachep,
 				struct array_cache *ac, int node)
 {
@@ -1059,6 +1148,13 @@ static void reap_alien(struct kmem_cache *cachep, struct kmem_list3 *l3)
 {
 	int node = __this_cpu_read(slab_reap_node);
 
+	if (cachep->remote_free &&
+	    __this_cpu_read(cachep->remote_free->avail)) {
+		local_irq_disable();
+		drain_remote_free(cachep);
+		local_irq_enable();
+	}
+
 	if (l3->alien) {
 		struct array_cache *ac = l3->alien[node];
 
@@ -1105,7 +1201,16 @@ static inline int cache_free_alien(struct kmem_cache *cachep, void *objp)
 
 	l3 = cachep->nodelists[node];
 	STATS_INC_NODEFREES(cachep);
-	if (l3->alien && l3->alien[nodeid]) {
+	if (cachep->remote_free) {
+		struct remote_free *rf = this_cpu_ptr(cachep->remote_free);
+
+		if (unlikely(rf->node != nodeid ||
+			     rf->avail == REMOTE_FREE_LIMIT)) {
+			flush_remote_free(cachep, rf);
+			rf->node = nodeid;
+		}
+		rf->entry[rf->avail++] = objp;
+	} else if (l3->alien && l3->alien[nodeid]) {
 		alien = l3->alien[nodeid];
 		spin_lock(&alien->lock);
 		if (unlikely(alien->avail == alien->limit)) {
@@ -1186,6 +1291,8 @@ static void __cpuinit cpuup_canceled(long cpu)
 		cachep->array[cpu] = NULL;
 		l3 = cachep->nodelists[node];
 
+		drain_remote_free_cpu(cachep, cpu);
+
 		if (!l3)
 			goto free_array_cache;
 
@@ -2043,6 +2150,7 @@ static void __kmem_cache_destroy(struct kmem_cache *cachep)
 
 	for_each_online_cpu(i)
 	    kfree(cachep->array[i]);
+	free_remote_free(cachep);
 
 	/* NUMA: free the list3 structures */
 	for_each_online_node(i) {
@@ -2543,6 +2651,7 @@ static void do_drain(void *arg)
 	free_block(cachep, ac->entry, ac->avail, node);
 	spin_unlock(&cachep->nodelists[node]->list_lock);
 	ac->avail = 0;
+	drain_remote_free(cachep);
 }
 
 static void drain_cpu_caches(struct kmem_cache *cachep)
@@ -3858,6 +3967,47 @@ void kmem_cache_free(struct kmem_cache *cachep, void *objp)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+int kmem_cache_alloc_bulk(struct kmem_cache *cachep, gfp_t flags, size_t size,
+								void **p)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		p[i] = kmem_cache_alloc(cachep, flags);
+		if (unlikely(!p[i])) {
+			kmem_cache_free_bulk(cachep, i, p);
+			return 0;
+		}
+	}
+	return size;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/*
+ * Like kmem_cache_free() for each object, but interrupts are only disabled
+ * once for the whole array.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *cachep, size_t size, void **p)
+{
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	for (i = 0; i < size; i++) {
+		void *objp = p[i];
+
+		debug_check_no_locks_freed(objp, obj_size(cachep));
+		if (!(cachep->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(objp, obj_size(cachep));
+		__cache_free(cachep, objp, __builtin_return_address(0));
+	}
+	local_irq_restore(flags);
+
+	for (i = 0; i < size; i++)
+		trace_kmem_cache_free(_RET_IP_, p[i]);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /**
  * kfree - free previously allocated memory
  * @objp: pointer returned by kmalloc.
@@ -4047,6 +4197,8 @@ static int enable_cpucache(struct kmem_cache *cachep, gfp_t gfp)
 	int err;
 	int limit, shared;
 
+	alloc_remote_free(cachep);
+
 	/*
 	 * The head array serves three purposes:
 	 * - create a LIFO ordering, i.e. return objects that are cache-warm
@@ -4212,6 +4364,7 @@ static void print_slabinfo_header(struct seq_file *m)
 #if STATS
 	seq_puts(m, " : globalstat <listallocs> <maxobjs> <grown> <reaped> "
 		 "<error> <maxfreeable> <nodeallocs> <remotefrees> <alienoverflow>");
+	seq_puts(m, " : remotestat <batches> <batchobjs> <avgbatch>");
 	seq_puts(m, " : cpustat <allochit> <allocmiss> <freehit> <freemiss>");
 #endif
 	seq_putc(m, '\n');
@@ -4320,6 +4473,14 @@ static int s_show(struct seq_file *m, void *p)
 			   reaped, errors, max_freeable, node_allocs,
 			   node_frees, overflows);
 	}
+	/* cross-node free batches */
+	{
+		unsigned long batches = cachep->remote_flushes;
+		unsigned long objs = cachep->remote_flush_objs;
+
+		seq_printf(m, " : remotestat %6lu %6lu %4lu",
+			   batches, objs, batches ? objs / batches : 0);
+	}
 	/* cpu stats */
 	{
 		unsigned long allochit = atomic_read(&cachep->allochit);
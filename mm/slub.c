@@ -2560,6 +2560,106 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Bulk allocation: objects are taken off the per cpu freelist with
+ * interrupts disabled instead of with one cmpxchg_double per object.
+ * The tid is bumped whenever the per cpu freelist was changed behind the
+ * back of a fastpath that might have been interrupted on this cpu.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+								void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i;
+
+	if (unlikely(kmem_cache_debug(s))) {
+		for (i = 0; i < size; i++) {
+			p[i] = kmem_cache_alloc(s, flags);
+			if (unlikely(!p[i]))
+				goto error;
+		}
+		return size;
+	}
+
+	if (slab_pre_alloc_hook(s, flags))
+		return 0;
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			c->tid = next_tid(c->tid);
+			p[i] = __slab_alloc(s, flags, NUMA_NO_NODE, _RET_IP_, c);
+			/* __slab_alloc() may have enabled interrupts */
+			c = this_cpu_ptr(s->cpu_slab);
+			if (unlikely(!p[i])) {
+				local_irq_enable();
+				goto error;
+			}
+			continue;
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+		stat(s, ALLOC_FASTPATH);
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	for (i = 0; i < size; i++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+		slab_post_alloc_hook(s, flags, p[i]);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->objsize, s->size,
+									flags);
+	}
+	return size;
+
+error:
+	kmem_cache_free_bulk(s, i, p);
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct kmem_cache_cpu *c;
+	struct page *page;
+	size_t i;
+
+	if (unlikely(kmem_cache_debug(s))) {
+		for (i = 0; i < size; i++)
+			kmem_cache_free(s, p[i]);
+		return;
+	}
+
+	for (i = 0; i < size; i++) {
+		slab_free_hook(s, p[i]);
+		trace_kmem_cache_free(_RET_IP_, p[i]);
+	}
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = p[i];
+
+		page = virt_to_head_page(object);
+		if (likely(page == c->page)) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+			continue;
+		}
+		__slab_free(s, page, object, _RET_IP_);
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
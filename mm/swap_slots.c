@@ -0,0 +1,166 @@
+/*
+ *  linux/mm/swap_slots.c
+ *
+ *  Per-cpu caches of swap entries.
+ *
+ *  get_swap_page() used to take swap_lock and scan a swap_map for every
+ *  page swapped out, which serializes reclaim on all cpus behind one lock.
+ *  Instead, each cpu keeps a small cache of entries allocated for the swap
+ *  cache, refilled SWAP_SLOTS_CACHE_SIZE at a time by get_swap_pages(), and
+ *  allocates from it under a mutex of its own.  A mutex rather than a
+ *  spinlock: refilling may scan and reschedule, and a task which migrates
+ *  meanwhile just goes on using the cache of the cpu it started on.
+ *
+ *  Entries sitting in a cache are allocated as far as the swap device is
+ *  concerned, so the caches are drained when swap is nearly full, and
+ *  disabled while swapoff runs try_to_unuse().
+ */
+
+#include <linux/swap_slots.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static bool swap_slot_cache_active;
+static bool swap_slot_cache_enabled;
+static bool swap_slot_cache_initialized;
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+
+/* Give the entries left in every cpu's cache back to their devices */
+static void drain_slots_cache(void)
+{
+	struct swap_slots_cache *cache;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cache = &per_cpu(swp_slots, cpu);
+		mutex_lock(&cache->alloc_lock);
+		if (cache->nr) {
+			swapcache_free_entries(cache->slots + cache->cur,
+					       cache->nr);
+			cache->cur = 0;
+			cache->nr = 0;
+		}
+		mutex_unlock(&cache->alloc_lock);
+	}
+}
+
+/*
+ * Decide whether get_swap_page() should go through the caches, switching
+ * them off (and draining them) when free swap runs low.  Racy, but only
+ * ever costs a batch allocated or drained more or less.
+ */
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled)
+		return false;
+
+	pages = get_nr_swap_pages();
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE *
+			    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE)
+			swap_slot_cache_active = true;
+	} else if (pages < num_online_cpus() * SWAP_SLOTS_CACHE_SIZE *
+			   THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE) {
+		swap_slot_cache_active = false;
+		drain_slots_cache();
+	}
+	return swap_slot_cache_active;
+}
+
+/* Called with cache->alloc_lock held, when the cache is empty */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	/* disable_swap_slots_cache_lock() may have drained us meanwhile */
+	if (!swap_slot_cache_enabled || !swap_slot_cache_active)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+	return cache->nr;
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	entry.val = 0;
+	if (check_cache_active()) {
+		cache = &per_cpu(swp_slots, raw_smp_processor_id());
+		mutex_lock(&cache->alloc_lock);
+		if (cache->slots && (cache->nr ||
+				     refill_swap_slots_cache(cache))) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+	return entry;
+}
+
+/*
+ * Called by swapon: allocate the caches the first time round, then
+ * (re)enable them.
+ */
+void enable_swap_slots_cache(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t *slots;
+	unsigned int cpu;
+
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	if (!swap_slot_cache_initialized) {
+		for_each_possible_cpu(cpu) {
+			/* a cpu left without a cache allocates directly */
+			slots = kzalloc_node(SWAP_SLOTS_CACHE_SIZE *
+					     sizeof(swp_entry_t), GFP_KERNEL,
+					     cpu_to_node(cpu));
+			cache = &per_cpu(swp_slots, cpu);
+			mutex_lock(&cache->alloc_lock);
+			cache->slots = slots;
+			mutex_unlock(&cache->alloc_lock);
+		}
+		swap_slot_cache_initialized = true;
+	}
+	swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/*
+ * Called by swapoff before try_to_unuse(): stop caching, and give back
+ * the cached entries, which try_to_unuse() would otherwise wait on for
+ * ever.  Returns holding the mutex, so swapon cannot reenable meanwhile.
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	if (swap_slot_cache_initialized)
+		drain_slots_cache();
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	swap_slot_cache_enabled = swap_slot_cache_initialized;
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		mutex_init(&per_cpu(swp_slots, cpu).alloc_lock);
+	return 0;
+}
+core_initcall(swap_slots_cache_init);
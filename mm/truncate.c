@@ -209,12 +209,20 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	const pgoff_t start = (lstart + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
 	const unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
 	struct pagevec pvec;
+	unsigned long nrpages;
 	pgoff_t index;
 	pgoff_t end;
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
+	/*
+	 * Reclaim replaces a page by its shadow under tree_lock, which this
+	 * does not take: read nrpages first, in the opposite order to
+	 * __delete_from_page_cache()'s updates, to see at least one of them.
+	 */
+	nrpages = mapping->nrpages;
+	smp_rmb();
+	if (nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -292,6 +300,8 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	/* Refaults beyond the new end of file are not going to happen */
+	workingset_clear_shadows(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -400,7 +410,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
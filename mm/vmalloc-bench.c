@@ -0,0 +1,111 @@
+/*
+ * mm/vmalloc-bench.c
+ *
+ * Runs vmalloc()/vfree() loops concurrently on every online cpu, from the
+ * system workqueue, to show how the vmap area allocator scales with the
+ * number of cpus.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+#define BENCH_LOOPS		100000
+
+static int alloc_size = PAGE_SIZE;
+module_param(alloc_size, int, 0444);
+MODULE_PARM_DESC(alloc_size, "Size of each vmalloc() allocation");
+
+static int loops = BENCH_LOOPS;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "Number of vmalloc()/vfree() pairs per cpu");
+
+struct vmalloc_bench_stats {
+	u64 ns;
+	int failed;
+};
+
+static DEFINE_PER_CPU(struct vmalloc_bench_stats, vmalloc_bench_stats);
+static atomic_t vmalloc_bench_waiting;
+static DECLARE_COMPLETION(vmalloc_bench_start);
+
+/* Runs on each online cpu from schedule_on_each_cpu() */
+static void vmalloc_bench_work(struct work_struct *work)
+{
+	struct vmalloc_bench_stats *stats = &__get_cpu_var(vmalloc_bench_stats);
+	ktime_t start;
+	void *p;
+	int i;
+
+	/* Start all cpus together, so that they really contend */
+	if (atomic_dec_and_test(&vmalloc_bench_waiting))
+		complete_all(&vmalloc_bench_start);
+	else
+		wait_for_completion(&vmalloc_bench_start);
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		p = vmalloc(alloc_size);
+		if (!p) {
+			stats->failed++;
+			continue;
+		}
+		vfree(p);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	stats->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int __init vmalloc_bench_init(void)
+{
+	struct vmalloc_bench_stats *stats;
+	u64 total = 0;
+	int cpu, nr, ret;
+
+	if (alloc_size <= 0 || loops <= 0)
+		return -EINVAL;
+
+	/* Keeps the set of cpus schedule_on_each_cpu() will use stable */
+	get_online_cpus();
+	nr = num_online_cpus();
+	atomic_set(&vmalloc_bench_waiting, nr);
+	ret = schedule_on_each_cpu(vmalloc_bench_work);
+	if (ret) {
+		put_online_cpus();
+		return ret;
+	}
+
+	printk(KERN_INFO "vmalloc_bench: %d cpus, %d byte allocations, "
+	       "ns per vmalloc()/vfree() pair\n", nr, alloc_size);
+	for_each_online_cpu(cpu) {
+		stats = &per_cpu(vmalloc_bench_stats, cpu);
+		printk(KERN_INFO "vmalloc_bench: cpu %d: %llu%s\n", cpu,
+		       div_u64(stats->ns, loops),
+		       stats->failed ? " (failures)" : "");
+		total += stats->ns;
+	}
+	put_online_cpus();
+
+	printk(KERN_INFO "vmalloc_bench: average %llu\n",
+	       div_u64(total, (u64)nr * loops));
+
+	/* Nothing to keep loaded */
+	return -EAGAIN;
+}
+module_init(vmalloc_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("vmalloc scalability benchmark");
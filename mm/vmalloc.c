@@ -22,6 +22,7 @@
 #include <linux/kallsyms.h>
 #include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/llist.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
 #include <linux/pfn.h>
@@ -254,23 +255,34 @@ struct vmap_area {
 	unsigned long va_end;
 	unsigned long flags;
 	struct rb_node rb_node;		/* address sorted rbtree */
+	unsigned long subtree_max_size;	/* free tree: largest block below */
 	struct list_head list;		/* address sorted list */
-	struct list_head purge_list;	/* "lazy purge" list */
+	struct llist_node purge_list;	/* "lazy purge" list */
 	void *private;
-	struct rcu_head rcu_head;
 };
 
+/*
+ * The address space is split between two trees, each under its own lock.
+ * vmap_area_root holds the areas in use and is what find_vmap_area() looks
+ * up on vfree() and friends; free_vmap_area_root holds the free blocks in
+ * between and is what alloc_vmap_area() searches and carves up.  Neither
+ * lock is ever taken inside the other: an allocation carves its range out
+ * of the free tree and only then inserts it into the busy tree, and a free
+ * goes the other way round.  In between the range is in neither tree, which
+ * nobody minds since nobody else can allocate or look it up.
+ */
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+static DEFINE_SPINLOCK(free_vmap_area_lock);
+static struct rb_root free_vmap_area_root = RB_ROOT;
 
-static unsigned long vmap_area_pcpu_hole;
+/*
+ * Lazily freed areas are queued on the list of the cpu that freed them, so
+ * that vfree() does not touch any shared state other than vmap_lazy_nr.
+ */
+static DEFINE_PER_CPU(struct llist_head, vmap_purge_list);
 
 static struct vmap_area *__find_vmap_area(unsigned long addr)
 {
@@ -318,9 +330,248 @@ static void __insert_vmap_area(struct vmap_area *va)
 	if (tmp) {
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
-		list_add_rcu(&va->list, &prev->list);
+		list_add(&va->list, &prev->list);
 	} else
-		list_add_rcu(&va->list, &vmap_area_list);
+		list_add(&va->list, &vmap_area_list);
+}
+
+static void insert_vmap_area(struct vmap_area *va)
+{
+	spin_lock(&vmap_area_lock);
+	__insert_vmap_area(va);
+	spin_unlock(&vmap_area_lock);
+}
+
+static void __unlink_vmap_area(struct vmap_area *va)
+{
+	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
+
+	rb_erase(&va->rb_node, &vmap_area_root);
+	RB_CLEAR_NODE(&va->rb_node);
+	list_del(&va->list);
+}
+
+/*
+ * The free tree is augmented with the size of the largest free block in
+ * each subtree, which lets the allocator skip whole subtrees that cannot
+ * satisfy a request instead of visiting every block.
+ */
+static unsigned long subtree_max_size(struct rb_node *n)
+{
+	return n ? rb_entry(n, struct vmap_area, rb_node)->subtree_max_size : 0;
+}
+
+static void free_vmap_area_augment_cb(struct rb_node *n, void *unused)
+{
+	struct vmap_area *va;
+
+	if (!n)
+		return;
+	va = rb_entry(n, struct vmap_area, rb_node);
+	va->subtree_max_size = max3(va->va_end - va->va_start,
+				    subtree_max_size(n->rb_left),
+				    subtree_max_size(n->rb_right));
+}
+
+/* A free block's size changed: recompute the path from it up to the root */
+static void free_vmap_area_resized(struct vmap_area *va)
+{
+	rb_augment_insert(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void free_vmap_area_insert(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (va->va_start < rb_entry(parent, struct vmap_area,
+					    rb_node)->va_start)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	va->flags = 0;
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	free_vmap_area_resized(va);
+}
+
+static void free_vmap_area_erase(struct vmap_area *va)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	rb_augment_erase_end(deepest, free_vmap_area_augment_cb, NULL);
+	kfree(va);
+}
+
+/*
+ * Give the range of @va back to the free tree, merging it with the free
+ * blocks on either side.  @va is reused as a free block or freed.
+ */
+static void __merge_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct vmap_area *prev = NULL, *next = NULL, *tmp;
+
+	/* find the free blocks just below and just above the range */
+	while (n) {
+		tmp = rb_entry(n, struct vmap_area, rb_node);
+		if (tmp->va_start < va->va_start) {
+			prev = tmp;
+			n = n->rb_right;
+		} else {
+			next = tmp;
+			n = n->rb_left;
+		}
+	}
+
+	if (next && next->va_start == va->va_end) {
+		if (prev && prev->va_end == va->va_start) {
+			prev->va_end = next->va_end;
+			free_vmap_area_erase(next);
+			free_vmap_area_resized(prev);
+		} else {
+			next->va_start = va->va_start;
+			free_vmap_area_resized(next);
+		}
+		kfree(va);
+	} else if (prev && prev->va_end == va->va_start) {
+		prev->va_end = va->va_end;
+		free_vmap_area_resized(prev);
+		kfree(va);
+	} else
+		free_vmap_area_insert(va);
+}
+
+/*
+ * Return the lowest suitably aligned address in the free block @va that
+ * can hold @size bytes within [vstart, vend), or 0 if there is none.
+ */
+static unsigned long free_vmap_area_fit(struct vmap_area *va,
+				unsigned long size, unsigned long align,
+				unsigned long vstart, unsigned long vend)
+{
+	unsigned long addr = ALIGN(max(va->va_start, vstart), align);
+
+	if (addr < va->va_start || addr + size - 1 < addr)
+		return 0;
+	if (addr + size > va->va_end || addr + size > vend)
+		return 0;
+	return addr;
+}
+
+/*
+ * Find the lowest free block holding an allocation, only looking into
+ * subtrees with a block of at least @length bytes.  This walks down the
+ * tree to the lowest candidate, and only climbs back up when a candidate
+ * turns out not to fit after all.  With @length large enough for any
+ * alignment, that only happens around vstart and vend, so the search
+ * stays O(log n).
+ */
+static struct vmap_area *__find_free_vmap_area(unsigned long size,
+				unsigned long align, unsigned long vstart,
+				unsigned long vend, unsigned long length,
+				unsigned long *addr)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node, *from;
+	struct vmap_area *va;
+
+	if (subtree_max_size(n) < length)
+		return NULL;
+
+	for (;;) {
+		va = rb_entry(n, struct vmap_area, rb_node);
+
+		/* left blocks all end below va_start, too low if that is */
+		if (va->va_start >= vstart + size &&
+		    subtree_max_size(n->rb_left) >= length) {
+			n = n->rb_left;
+			continue;
+		}
+
+		for (;;) {
+			va = rb_entry(n, struct vmap_area, rb_node);
+			*addr = free_vmap_area_fit(va, size, align,
+						   vstart, vend);
+			if (*addr)
+				return va;
+
+			/* right blocks all start above va_end */
+			if (va->va_end >= vend)
+				return NULL;
+			if (subtree_max_size(n->rb_right) >= length) {
+				n = n->rb_right;
+				break;
+			}
+
+			/* climb to the first ancestor we are to the left of */
+			do {
+				from = n;
+				n = rb_parent(n);
+				if (!n)
+					return NULL;
+			} while (n->rb_right == from);
+		}
+	}
+}
+
+static struct vmap_area *find_free_vmap_area(unsigned long size,
+				unsigned long align, unsigned long vstart,
+				unsigned long vend, unsigned long *addr)
+{
+	struct vmap_area *va;
+
+	/*
+	 * Blocks and addresses are page aligned: any block this large will
+	 * do whatever its alignment.  For align > PAGE_SIZE that may not be
+	 * the lowest fit, but the lower blocks it passes over would only
+	 * fit by luck.
+	 */
+	va = __find_free_vmap_area(size, align, vstart, vend,
+				   size + align - PAGE_SIZE, addr);
+	/* Before giving up, try those smaller blocks too */
+	if (!va && align > PAGE_SIZE)
+		va = __find_free_vmap_area(size, align, vstart, vend,
+					   size, addr);
+	return va;
+}
+
+/*
+ * Carve [addr, addr + size) out of the free block @va.  Splitting the
+ * block in two takes a new vmap_area, from *spare; returns -ENOMEM if
+ * that is needed and there is none.
+ */
+static int __clip_free_vmap_area(struct vmap_area *va, unsigned long addr,
+				 unsigned long size, struct vmap_area **spare)
+{
+	unsigned long end = addr + size;
+	struct vmap_area *lva;
+
+	if (addr == va->va_start && end == va->va_end) {
+		free_vmap_area_erase(va);
+	} else if (addr == va->va_start) {
+		va->va_start = end;
+		free_vmap_area_resized(va);
+	} else if (end == va->va_end) {
+		va->va_end = addr;
+		free_vmap_area_resized(va);
+	} else {
+		if (!*spare)
+			return -ENOMEM;
+		lva = *spare;
+		*spare = NULL;
+		lva->va_start = va->va_start;
+		lva->va_end = addr;
+		va->va_start = end;
+		free_vmap_area_resized(va);
+		free_vmap_area_insert(lva);
+	}
+	return 0;
 }
 
 static void purge_vmap_area_lazy(void);
@@ -334,11 +585,9 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
+	struct vmap_area *va, *block, *spare = NULL;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -350,86 +599,28 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	spin_lock(&vmap_area_lock);
-	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
-	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
+	spin_lock(&free_vmap_area_lock);
+	block = find_free_vmap_area(size, align, vstart, vend, &addr);
+	if (!block)
+		goto overflow;
 
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
+	if (__clip_free_vmap_area(block, addr, size, &spare)) {
+		spin_unlock(&free_vmap_area_lock);
+		spare = kmalloc_node(sizeof(struct vmap_area),
+				gfp_mask & GFP_RECLAIM_MASK, node);
+		if (unlikely(!spare)) {
+			kfree(va);
+			return ERR_PTR(-ENOMEM);
 		}
-
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
+		goto retry;
 	}
-
-found:
-	if (addr + size > vend)
-		goto overflow;
+	spin_unlock(&free_vmap_area_lock);
+	kfree(spare);
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
-	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
-	spin_unlock(&vmap_area_lock);
+	insert_vmap_area(va);
 
 	BUG_ON(va->va_start & (align-1));
 	BUG_ON(va->va_start < vstart);
@@ -438,7 +629,7 @@ found:
 	return va;
 
 overflow:
-	spin_unlock(&vmap_area_lock);
+	spin_unlock(&free_vmap_area_lock);
 	if (!purged) {
 		purge_vmap_area_lazy();
 		purged = 1;
@@ -448,53 +639,23 @@ overflow:
 		printk(KERN_WARNING
 			"vmap allocation for size %lu failed: "
 			"use vmalloc=<size> to increase size.\n", size);
+	kfree(spare);
 	kfree(va);
 	return ERR_PTR(-EBUSY);
 }
 
-static void __free_vmap_area(struct vmap_area *va)
-{
-	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
-
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
-	rb_erase(&va->rb_node, &vmap_area_root);
-	RB_CLEAR_NODE(&va->rb_node);
-	list_del_rcu(&va->list);
-
-	/*
-	 * Track the highest possible candidate for pcpu area
-	 * allocation.  Areas outside of vmalloc area can be returned
-	 * here too, consider only end addresses which fall inside
-	 * vmalloc area proper.
-	 */
-	if (va->va_end > VMALLOC_START && va->va_end <= VMALLOC_END)
-		vmap_area_pcpu_hole = max(vmap_area_pcpu_hole, va->va_end);
-
-	kfree_rcu(va, rcu_head);
-}
-
 /*
  * Free a region of KVA allocated by alloc_vmap_area
  */
 static void free_vmap_area(struct vmap_area *va)
 {
 	spin_lock(&vmap_area_lock);
-	__free_vmap_area(va);
+	__unlink_vmap_area(va);
 	spin_unlock(&vmap_area_lock);
+
+	spin_lock(&free_vmap_area_lock);
+	__merge_free_vmap_area(va);
+	spin_unlock(&free_vmap_area_lock);
 }
 
 /*
@@ -579,10 +740,10 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist = NULL;
+	struct llist_node *node, *next;
 	struct vmap_area *va;
-	struct vmap_area *n_va;
-	int nr = 0;
+	int cpu, nr = 0;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -598,20 +759,22 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
+	for_each_possible_cpu(cpu) {
+		node = llist_del_all(&per_cpu(vmap_purge_list, cpu));
+		for (; node; node = next) {
+			next = node->next;
+			va = llist_entry(node, struct vmap_area, purge_list);
 			if (va->va_start < *start)
 				*start = va->va_start;
 			if (va->va_end > *end)
 				*end = va->va_end;
 			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
+			node->next = valist;
+			valist = node;
 			va->flags |= VM_LAZY_FREEING;
 			va->flags &= ~VM_LAZY_FREE;
 		}
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -621,9 +784,18 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 
 	if (nr) {
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
-			__free_vmap_area(va);
+		for (node = valist; node; node = node->next)
+			__unlink_vmap_area(llist_entry(node, struct vmap_area,
+						       purge_list));
 		spin_unlock(&vmap_area_lock);
+
+		spin_lock(&free_vmap_area_lock);
+		for (node = valist; node; node = next) {
+			next = node->next;
+			__merge_free_vmap_area(llist_entry(node,
+						struct vmap_area, purge_list));
+		}
+		spin_unlock(&free_vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
 }
@@ -657,6 +829,8 @@ static void purge_vmap_area_lazy(void)
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
 	va->flags |= VM_LAZY_FREE;
+	/* llist_add() is safe even if we migrate to another cpu meanwhile */
+	llist_add(&va->purge_list, __this_cpu_ptr(&vmap_purge_list));
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
@@ -1143,6 +1317,33 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 	vmlist = vm;
 }
 
+/*
+ * Everything between the areas imported from the vmlist is free, from the
+ * first page up to the last one.  Address 0 is never handed out.
+ */
+static void __init vmap_init_free_space(void)
+{
+	unsigned long start = PAGE_SIZE, end = ULONG_MAX & PAGE_MASK;
+	struct vmap_area *busy, *free;
+
+	list_for_each_entry(busy, &vmap_area_list, list) {
+		if (busy->va_start > start) {
+			free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+			free->va_start = start;
+			free->va_end = busy->va_start;
+			free_vmap_area_insert(free);
+		}
+		start = max(start, busy->va_end);
+	}
+
+	if (end > start) {
+		free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		free->va_start = start;
+		free->va_end = end;
+		free_vmap_area_insert(free);
+	}
+}
+
 void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
@@ -1166,7 +1367,7 @@ void __init vmalloc_init(void)
 		__insert_vmap_area(va);
 	}
 
-	vmap_area_pcpu_hole = VMALLOC_END;
+	vmap_init_free_space();
 
 	vmap_initialized = true;
 }
@@ -2205,81 +2406,56 @@ static struct vmap_area *node_to_va(struct rb_node *n)
 }
 
 /**
- * pvm_find_next_prev - find the next and prev vmap_area surrounding @end
- * @end: target address
- * @pnext: out arg for the next vmap_area
- * @pprev: out arg for the previous vmap_area
- *
- * Returns: %true if either or both of next and prev are found,
- *	    %false if no vmap_area exists
+ * pvm_find_free_enclose - find the free block containing @addr
+ * @addr: target address
  *
- * Find vmap_areas end addresses of which enclose @end.  ie. if not
- * NULL, *pnext->va_end > @end and *pprev->va_end <= @end.
+ * Returns: the free vmap_area which contains @addr, or failing that the
+ *	    highest one below it, or %NULL if there is none.
  */
-static bool pvm_find_next_prev(unsigned long end,
-			       struct vmap_area **pnext,
-			       struct vmap_area **pprev)
+static struct vmap_area *pvm_find_free_enclose(unsigned long addr)
 {
-	struct rb_node *n = vmap_area_root.rb_node;
-	struct vmap_area *va = NULL;
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct vmap_area *va = NULL, *tmp;
 
 	while (n) {
-		va = rb_entry(n, struct vmap_area, rb_node);
-		if (end < va->va_end)
-			n = n->rb_left;
-		else if (end > va->va_end)
+		tmp = rb_entry(n, struct vmap_area, rb_node);
+		if (tmp->va_start <= addr) {
+			va = tmp;
+			if (tmp->va_end >= addr)
+				break;
 			n = n->rb_right;
-		else
-			break;
+		} else
+			n = n->rb_left;
 	}
 
-	if (!va)
-		return false;
-
-	if (va->va_end > end) {
-		*pnext = va;
-		*pprev = node_to_va(rb_prev(&(*pnext)->rb_node));
-	} else {
-		*pprev = va;
-		*pnext = node_to_va(rb_next(&(*pprev)->rb_node));
-	}
-	return true;
+	return va;
 }
 
 /**
- * pvm_determine_end - find the highest aligned address between two vmap_areas
- * @pnext: in/out arg for the next vmap_area
- * @pprev: in/out arg for the previous vmap_area
+ * pvm_determine_end - find the highest aligned end address in a free block
+ * @pva: in/out arg for the free vmap_area to start from
  * @align: alignment
  *
- * Returns: determined end address
- *
- * Find the highest aligned address between *@pnext and *@pprev below
- * VMALLOC_END.  *@pnext and *@pprev are adjusted so that the aligned
- * down address is between the end addresses of the two vmap_areas.
+ * Returns: determined end address, 0 if no block is left
  *
- * Please note that the address returned by this function may fall
- * inside *@pnext vmap_area.  The caller is responsible for checking
- * that.
+ * Find the highest aligned address below VMALLOC_END which ends a non-empty
+ * part of *@pva, going down to lower free blocks until one has such an
+ * address, and leave *@pva at that block.
  */
-static unsigned long pvm_determine_end(struct vmap_area **pnext,
-				       struct vmap_area **pprev,
+static unsigned long pvm_determine_end(struct vmap_area **pva,
 				       unsigned long align)
 {
 	const unsigned long vmalloc_end = VMALLOC_END & ~(align - 1);
 	unsigned long addr;
 
-	if (*pnext)
-		addr = min((*pnext)->va_start & ~(align - 1), vmalloc_end);
-	else
-		addr = vmalloc_end;
-
-	while (*pprev && (*pprev)->va_end > addr) {
-		*pnext = *pprev;
-		*pprev = node_to_va(rb_prev(&(*pnext)->rb_node));
+	while (*pva) {
+		addr = min((*pva)->va_end & ~(align - 1), vmalloc_end);
+		if ((*pva)->va_start < addr)
+			return addr;
+		*pva = node_to_va(rb_prev(&(*pva)->rb_node));
 	}
 
-	return addr;
+	return 0;
 }
 
 /**
@@ -2300,11 +2476,12 @@ static unsigned long pvm_determine_end(struct vmap_area **pnext,
  * areas are allocated from top.
  *
  * Despite its complicated look, this allocator is rather simple.  It
- * does everything top-down and scans areas from the end looking for
- * matching slot.  While scanning, if any of the areas overlaps with
- * existing vmap_area, the base address is pulled down to fit the
+ * does everything top-down and scans the free blocks from the end
+ * looking for matching slot.  While scanning, if any of the areas does
+ * not fit in a free block, the base address is pulled down to fit the
  * area.  Scanning is repeated till all the areas fit and then all
- * necessary data structres are inserted and the result is returned.
+ * areas are carved out of the free blocks, the necessary data
+ * structres are inserted and the result is returned.
  */
 struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 				     const size_t *sizes, int nr_vms,
@@ -2312,7 +2489,7 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 {
 	const unsigned long vmalloc_start = ALIGN(VMALLOC_START, align);
 	const unsigned long vmalloc_end = VMALLOC_END & ~(align - 1);
-	struct vmap_area **vas, *prev, *next;
+	struct vmap_area **vas, **spares, *va;
 	struct vm_struct **vms;
 	int area, area2, last_area, term_area;
 	unsigned long base, start, end, last_end;
@@ -2352,39 +2529,36 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 
 	vms = kzalloc(sizeof(vms[0]) * nr_vms, GFP_KERNEL);
 	vas = kzalloc(sizeof(vas[0]) * nr_vms, GFP_KERNEL);
-	if (!vas || !vms)
+	/* carving an area out of the middle of a free block splits it */
+	spares = kzalloc(sizeof(spares[0]) * nr_vms, GFP_KERNEL);
+	if (!vas || !vms || !spares)
 		goto err_free;
 
 	for (area = 0; area < nr_vms; area++) {
 		vas[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
 		vms[area] = kzalloc(sizeof(struct vm_struct), GFP_KERNEL);
-		if (!vas[area] || !vms[area])
+		spares[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
+		if (!vas[area] || !vms[area] || !spares[area])
 			goto err_free;
 	}
 retry:
-	spin_lock(&vmap_area_lock);
+	spin_lock(&free_vmap_area_lock);
 
 	/* start scanning - we scan from the top, begin with the last area */
 	area = term_area = last_area;
 	start = offsets[area];
 	end = start + sizes[area];
 
-	if (!pvm_find_next_prev(vmap_area_pcpu_hole, &next, &prev)) {
-		base = vmalloc_end - last_end;
-		goto found;
-	}
-	base = pvm_determine_end(&next, &prev, align) - end;
+	va = pvm_find_free_enclose(vmalloc_end);
+	base = pvm_determine_end(&va, align) - end;
 
 	while (true) {
-		BUG_ON(next && next->va_end <= base + end);
-		BUG_ON(prev && prev->va_end > base + end);
-
 		/*
 		 * base might have underflowed, add last_end before
 		 * comparing.
 		 */
-		if (base + last_end < vmalloc_start + last_end) {
-			spin_unlock(&vmap_area_lock);
+		if (!va || base + last_end < vmalloc_start + last_end) {
+			spin_unlock(&free_vmap_area_lock);
 			if (!purged) {
 				purge_vmap_area_lazy();
 				purged = true;
@@ -2394,24 +2568,24 @@ retry:
 		}
 
 		/*
-		 * If next overlaps, move base downwards so that it's
-		 * right below next and then recheck.
+		 * If the area sticks out of the top of the free block,
+		 * move base downwards so that it ends in the block and
+		 * then recheck.
 		 */
-		if (next && next->va_start < base + end) {
-			base = pvm_determine_end(&next, &prev, align) - end;
+		if (base + end > va->va_end) {
+			base = pvm_determine_end(&va, align) - end;
 			term_area = area;
 			continue;
 		}
 
 		/*
-		 * If prev overlaps, shift down next and prev and move
-		 * base so that it's right below new next and then
-		 * recheck.
+		 * If the area starts below the free block, move base so
+		 * that it's right below the next lower free block and
+		 * then recheck.
 		 */
-		if (prev && prev->va_end > base + start)  {
-			next = prev;
-			prev = node_to_va(rb_prev(&next->rb_node));
-			base = pvm_determine_end(&next, &prev, align) - end;
+		if (base + start < va->va_start) {
+			va = node_to_va(rb_prev(&va->rb_node));
+			base = pvm_determine_end(&va, align) - end;
 			term_area = area;
 			continue;
 		}
@@ -2425,22 +2599,33 @@ retry:
 			break;
 		start = offsets[area];
 		end = start + sizes[area];
-		pvm_find_next_prev(base + end, &next, &prev);
+		va = pvm_find_free_enclose(base + end);
 	}
-found:
-	/* we've found a fitting base, insert all va's */
+
+	/* we've found a fitting base, carve all areas out of the free tree */
 	for (area = 0; area < nr_vms; area++) {
-		struct vmap_area *va = vas[area];
+		start = base + offsets[area];
+		va = pvm_find_free_enclose(start);
+		BUG_ON(!va || start + sizes[area] > va->va_end);
+		BUG_ON(__clip_free_vmap_area(va, start, sizes[area],
+					     &spares[area]));
+	}
+	spin_unlock(&free_vmap_area_lock);
 
+	/* and insert all va's */
+	spin_lock(&vmap_area_lock);
+	for (area = 0; area < nr_vms; area++) {
+		va = vas[area];
 		va->va_start = base + offsets[area];
 		va->va_end = va->va_start + sizes[area];
 		__insert_vmap_area(va);
 	}
-
-	vmap_area_pcpu_hole = base + offsets[last_area];
-
 	spin_unlock(&vmap_area_lock);
 
+	for (area = 0; area < nr_vms; area++)
+		kfree(spares[area]);
+	kfree(spares);
+
 	/* insert all vm's */
 	for (area = 0; area < nr_vms; area++)
 		insert_vmalloc_vm(vms[area], vas[area], VM_ALLOC,
@@ -2455,9 +2640,12 @@ err_free:
 			kfree(vas[area]);
 		if (vms)
 			kfree(vms[area]);
+		if (spares)
+			kfree(spares[area]);
 	}
 	kfree(vas);
 	kfree(vms);
+	kfree(spares);
 	return NULL;
 }
 
@@ -470,7 +470,7 @@ void refresh_cpu_vm_stats(int cpu)
 		 * Check if there are pages remaining in this pageset
 		 * if not then there is nothing to expire.
 		 */
-		if (!p->expire || !p->pcp.count)
+		if (!p->expire || !pageset_has_pages(p))
 			continue;
 
 		/*
@@ -485,8 +485,8 @@ void refresh_cpu_vm_stats(int cpu)
 		if (p->expire)
 			continue;
 
-		if (p->pcp.count)
-			drain_zone_pages(zone, &p->pcp);
+		if (pageset_has_pages(p))
+			drain_zone_pages(zone, p);
 #endif
 	}
 
@@ -681,6 +681,9 @@ static void walk_zones_in_node(struct seq_file *m, pg_data_t *pgdat,
 #define TEXTS_FOR_ZONES(xx) TEXT_FOR_DMA(xx) TEXT_FOR_DMA32(xx) xx "_normal", \
 					TEXT_FOR_HIGHMEM(xx) xx "_movable",
 
+#define TEXTS_FOR_KSWAPD_THREADS(xx) xx "_0", xx "_1", xx "_2", xx "_3", \
+					xx "_4", xx "_5", xx "_6", xx "_7",
+
 const char * const vmstat_text[] = {
 	/* Zoned VM counters */
 	"nr_free_pages",
@@ -709,6 +712,8 @@ const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -733,6 +738,8 @@ const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pcp_highorder_hit",
+	"pcp_highorder_miss",
 
 	"pgfault",
 	"pgmajfault",
@@ -752,10 +759,15 @@ const char * const vmstat_text[] = {
 	"kswapd_low_wmark_hit_quickly",
 	"kswapd_high_wmark_hit_quickly",
 	"kswapd_skip_congestion_wait",
+	TEXTS_FOR_KSWAPD_THREADS("kswapd_thread_scan")
+	TEXTS_FOR_KSWAPD_THREADS("kswapd_thread_steal")
 	"pageoutrun",
 	"allocstall",
 
 	"pgrotated",
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	"unmap_tlb_flush_saved",
+#endif
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -764,12 +776,20 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_daemon_wake",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
 	"htlb_buddy_alloc_success",
 	"htlb_buddy_alloc_fail",
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+#endif
 	"unevictable_pgs_culled",
 	"unevictable_pgs_scanned",
 	"unevictable_pgs_rescued",
@@ -785,6 +805,8 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc",
 	"thp_collapse_alloc_failed",
 	"thp_split",
+	"thp_file_alloc",
+	"thp_file_mapped",
 #endif
 
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
@@ -1022,6 +1044,16 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		   zone->all_unreclaimable,
 		   zone->zone_start_pfn,
 		   zone->inactive_ratio);
+#ifdef CONFIG_COMPACTION
+	seq_printf(m,
+		   "\n  compact_attempts:  %lu"
+		   "\n  compact_success:   %lu"
+		   "\n  compact_fragindex: %d (order %d)",
+		   zone->compact_attempts,
+		   zone->compact_success,
+		   fragmentation_index(zone, sysctl_kcompactd_order),
+		   sysctl_kcompactd_order);
+#endif
 	seq_putc(m, '\n');
 }
 
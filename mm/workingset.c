@@ -0,0 +1,312 @@
+/*
+ *  linux/mm/workingset.c
+ *
+ *  Workingset detection
+ *
+ *  Page cache pages start out on the inactive file list and get promoted
+ *  to the active list when they are accessed a second time while still
+ *  there.  That protects the active list from use-once streams, but when
+ *  the inactive list is too small for the access distance of a working
+ *  set, its pages keep being evicted before their second access, and a
+ *  large enough streaming scan pushes out the whole working set without
+ *  the active list ever getting a say.
+ *
+ *  So, when a file page is evicted from the inactive list, a shadow entry
+ *  is left in its page cache slot, recording the zone's inactive_age at
+ *  the time.  inactive_age ticks for every eviction from and every
+ *  activation out of the inactive list: the difference between its value
+ *  at refault time and the recorded one, the refault distance, is the
+ *  number of pages which have left the inactive list in between.  Had the
+ *  inactive list been that much larger, the page would still have been
+ *  in memory when it was wanted again; and the only memory the inactive
+ *  list could have taken that from is the active list.  So if the refault
+ *  distance is no larger than the active file list, the refaulting page
+ *  goes straight onto the active list, to compete with the pages there,
+ *  instead of having to prove itself on the inactive list once again.
+ *
+ *  Shadow entries outlive the pages they stand for, so the number of
+ *  them has to be kept in check: a refault distance is at most the size
+ *  of the active list to count, so more shadows than there are file pages
+ *  cannot all be useful.  The excess is reclaimed by a shrinker, from the
+ *  mappings which hold shadows in turn, a bounded batch at a time.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/radix-tree.h>
+#include <linux/percpu_counter.h>
+#include <linux/spinlock.h>
+#include <linux/init.h>
+
+/*
+ * The eviction timestamp is packed into the shadow entry along with the
+ * node and zone of the page, below the bits the radix tree reserves for
+ * exceptional entries; what does not fit of the timestamp is cut off at
+ * the top, so distances are calculated modulo the remaining bits.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 ZONES_SHIFT + NODES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+/* Shadow entries looked up at a time while clearing them */
+#define SHADOW_BATCH	16
+
+/* Mappings holding shadow entries, in the shrinker's round robin order */
+static LIST_HEAD(shadow_mappings);
+static DEFINE_SPINLOCK(shadow_mappings_lock);
+static struct percpu_counter nr_shadows;
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction, refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page, so that a later refault can be detected.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/**
+ * workingset_add_shadow - account a shadow entry stored in a mapping
+ * @mapping: the mapping whose page_tree the entry was stored in
+ *
+ * Caller holds @mapping->tree_lock.
+ */
+void workingset_add_shadow(struct address_space *mapping)
+{
+	if (!mapping->nrshadows++) {
+		spin_lock(&shadow_mappings_lock);
+		list_add_tail(&mapping->shadow_list, &shadow_mappings);
+		spin_unlock(&shadow_mappings_lock);
+	}
+	percpu_counter_inc(&nr_shadows);
+}
+
+/**
+ * workingset_del_shadow - account a shadow entry removed from a mapping
+ * @mapping: the mapping whose page_tree the entry was removed from
+ *
+ * Caller holds @mapping->tree_lock.
+ */
+void workingset_del_shadow(struct address_space *mapping)
+{
+	percpu_counter_dec(&nr_shadows);
+	if (!--mapping->nrshadows) {
+		spin_lock(&shadow_mappings_lock);
+		list_del_init(&mapping->shadow_list);
+		spin_unlock(&shadow_mappings_lock);
+	}
+}
+
+/*
+ * Delete the shadow entries of @mapping between @start and @end, looking
+ * at no more than *@nr_to_scan slots, which is decremented accordingly.
+ * Returns the index to resume at, or 0 when done.  Leaves it to the caller
+ * to unlink the mapping from shadow_mappings once it has no shadows left.
+ * Caller holds @mapping->tree_lock.
+ */
+static pgoff_t clear_shadows(struct address_space *mapping, pgoff_t start,
+			     pgoff_t end, unsigned long *nr_to_scan)
+{
+	unsigned long indices[SHADOW_BATCH];
+	void **slots[SHADOW_BATCH];
+	unsigned int i, nr, nr_shadows_found;
+	pgoff_t next;
+
+	while (*nr_to_scan && mapping->nrshadows) {
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+				indices, start, min_t(unsigned long,
+						*nr_to_scan, SHADOW_BATCH));
+		if (!nr)
+			return 0;
+		*nr_to_scan -= nr;
+		next = indices[nr - 1] + 1;
+
+		/* Collect the indices first: deletion may free the slots */
+		nr_shadows_found = 0;
+		for (i = 0; i < nr; i++) {
+			void *entry;
+
+			if (indices[i] > end) {
+				next = 0;
+				break;
+			}
+			entry = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+			if (radix_tree_exceptional_entry(entry))
+				indices[nr_shadows_found++] = indices[i];
+		}
+		for (i = 0; i < nr_shadows_found; i++) {
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			percpu_counter_dec(&nr_shadows);
+			mapping->nrshadows--;
+		}
+		if (!next)
+			return 0;
+		start = next;
+	}
+	return mapping->nrshadows ? start : 0;
+}
+
+/**
+ * workingset_clear_shadows - delete the shadow entries in a range
+ * @mapping: the mapping to clear
+ * @start: first page cache index of the range
+ * @end: last page cache index of the range, inclusive
+ *
+ * Called by truncation, once the pages of the range are gone.  Takes
+ * and drops @mapping->tree_lock for each batch, and may sleep between.
+ */
+void workingset_clear_shadows(struct address_space *mapping,
+			      pgoff_t start, pgoff_t end)
+{
+	unsigned long nr_to_scan;
+
+	while (mapping->nrshadows) {
+		nr_to_scan = SHADOW_BATCH * 4;
+		spin_lock_irq(&mapping->tree_lock);
+		if (mapping->nrshadows) {
+			start = clear_shadows(mapping, start, end, &nr_to_scan);
+			if (!mapping->nrshadows) {
+				spin_lock(&shadow_mappings_lock);
+				list_del_init(&mapping->shadow_list);
+				spin_unlock(&shadow_mappings_lock);
+			}
+		} else
+			start = 0;
+		spin_unlock_irq(&mapping->tree_lock);
+		if (!start)
+			break;
+		cond_resched();
+	}
+}
+
+/*
+ * Reports the shadow entries in excess of the pages on the file LRU
+ * lists, and clears nr_to_scan slots' worth of them, visiting the
+ * mappings in turn and picking up where it left off in each of them.
+ * tree_lock nests outside shadow_mappings_lock, so it is only trylocked
+ * here, and a busy mapping gets skipped for this round.
+ */
+static int shrink_shadows(struct shrinker *shrink, struct shrink_control *sc)
+{
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	unsigned long shadows, pages;
+
+	if (nr_to_scan) {
+		struct address_space *mapping;
+
+		spin_lock_irq(&shadow_mappings_lock);
+		while (nr_to_scan && !list_empty(&shadow_mappings)) {
+			mapping = list_first_entry(&shadow_mappings,
+					struct address_space, shadow_list);
+			list_move_tail(&mapping->shadow_list,
+				       &shadow_mappings);
+			if (!spin_trylock(&mapping->tree_lock)) {
+				nr_to_scan--;
+				continue;
+			}
+			mapping->shadow_index = clear_shadows(mapping,
+					mapping->shadow_index, ULONG_MAX,
+					&nr_to_scan);
+			if (!mapping->nrshadows)
+				list_del_init(&mapping->shadow_list);
+			spin_unlock(&mapping->tree_lock);
+		}
+		spin_unlock_irq(&shadow_mappings_lock);
+	}
+
+	shadows = percpu_counter_read_positive(&nr_shadows);
+	pages = global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_FILE);
+	if (shadows <= pages)
+		return 0;
+	return min_t(unsigned long, shadows - pages, INT_MAX);
+}
+
+static struct shrinker shadow_shrinker = {
+	.shrink = shrink_shadows,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	int error;
+
+	error = percpu_counter_init(&nr_shadows, 0);
+	if (error)
+		return error;
+	register_shrinker(&shadow_shrinker);
+	return 0;
+}
+core_initcall(workingset_init);
@@ -58,6 +58,7 @@
 #include <linux/scatterlist.h>
 #include <linux/errqueue.h>
 #include <linux/prefetch.h>
+#include <linux/cpu.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -74,6 +75,69 @@
 static struct kmem_cache *skbuff_head_cache __read_mostly;
 static struct kmem_cache *skbuff_fclone_cache __read_mostly;
 
+/*
+ * sk_buff heads allocated and freed in softirq context (NAPI receive and
+ * the GRO merge/free path) are recycled through a small per cpu stack.
+ * The stack is refilled and trimmed with the slab bulk API, so most heads
+ * cost an array access instead of a trip through the slab fast path.
+ * Hard interrupt context never touches the stack, and process context only
+ * does so with bottom halves disabled.
+ */
+#define SKB_HEAD_CACHE_SIZE	64
+#define SKB_HEAD_CACHE_BULK	16
+
+struct skb_head_cache {
+	unsigned int count;
+	void *heads[SKB_HEAD_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct skb_head_cache, skb_head_cache);
+
+static inline bool skb_head_cache_usable(void)
+{
+	return in_softirq() && !in_irq();
+}
+
+static struct sk_buff *skb_head_cache_get(gfp_t gfp_mask)
+{
+	struct skb_head_cache *hc = &__get_cpu_var(skb_head_cache);
+
+	if (unlikely(!hc->count)) {
+		hc->count = kmem_cache_alloc_bulk(skbuff_head_cache, gfp_mask,
+						  SKB_HEAD_CACHE_BULK,
+						  hc->heads);
+		if (unlikely(!hc->count))
+			return NULL;
+	}
+	return hc->heads[--hc->count];
+}
+
+static void skb_head_cache_put(struct sk_buff *skb)
+{
+	struct skb_head_cache *hc = &__get_cpu_var(skb_head_cache);
+
+	if (unlikely(hc->count == SKB_HEAD_CACHE_SIZE)) {
+		hc->count -= SKB_HEAD_CACHE_BULK;
+		kmem_cache_free_bulk(skbuff_head_cache, SKB_HEAD_CACHE_BULK,
+				     hc->heads + hc->count);
+	}
+	hc->heads[hc->count++] = skb;
+}
+
+static int skb_head_cache_cpu_callback(struct notifier_block *nfb,
+				       unsigned long action, void *hcpu)
+{
+	struct skb_head_cache *hc;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	hc = &per_cpu(skb_head_cache, (unsigned long)hcpu);
+	kmem_cache_free_bulk(skbuff_head_cache, hc->count, hc->heads);
+	hc->count = 0;
+	return NOTIFY_OK;
+}
+
 static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
@@ -179,7 +243,10 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 	cache = fclone ? skbuff_fclone_cache : skbuff_head_cache;
 
 	/* Get the HEAD */
-	skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	if (!fclone && node == NUMA_NO_NODE && skb_head_cache_usable())
+		skb = skb_head_cache_get(gfp_mask & ~__GFP_DMA);
+	else
+		skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
 	if (!skb)
 		goto out;
 	prefetchw(skb);
@@ -369,7 +436,10 @@ static void kfree_skbmem(struct sk_buff *skb)
 
 	switch (skb->fclone) {
 	case SKB_FCLONE_UNAVAILABLE:
-		kmem_cache_free(skbuff_head_cache, skb);
+		if (skb_head_cache_usable())
+			skb_head_cache_put(skb);
+		else
+			kmem_cache_free(skbuff_head_cache, skb);
 		break;
 
 	case SKB_FCLONE_ORIG:
@@ -2907,6 +2977,7 @@ void __init skb_init(void)
 						0,
 						SLAB_HWCACHE_ALIGN|SLAB_PANIC,
 						NULL);
+	hotcpu_notifier(skb_head_cache_cpu_callback, 0);
 }
 
 /**
@@ -0,0 +1,167 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Benchmark for the futex hash table
+ *
+ * Each thread keeps doing FUTEX_WAIT on futexes of its own, with a value
+ * they do not have: every call hashes its key and takes the bucket lock,
+ * to return -EAGAIN right away.  So the throughput is that of the hash
+ * and of its locks, with all the threads hammering them at once.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int nsecs = 10;
+static unsigned int hash_slots;
+static bool fshared;
+
+static volatile int done;
+static pthread_barrier_t barrier;
+
+struct worker {
+	pthread_t thread;
+	u_int32_t *futexes;
+	unsigned long long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: online cpus)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify number of futexes per thread"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('s', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_UINTEGER('H', "hash", &hash_slots,
+		     "Use a private futex hash of that many buckets"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	int opflags = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+	unsigned long long ops = 0;
+	unsigned int i;
+
+	pthread_barrier_wait(&barrier);
+	while (!done) {
+		for (i = 0; i < nfutexes; i++) {
+			/* the futex is 0: this never blocks */
+			if (futex_wait(&w->futexes[i], 1, NULL, opflags) != -1 ||
+			    errno != EAGAIN) {
+				perror("futex_wait");
+				exit(1);
+			}
+		}
+		ops += nfutexes;
+	}
+	w->ops = ops;
+	return NULL;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long total = 0;
+	struct worker *workers;
+	double secs;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfutexes || !nsecs)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	/* while there is just this one thread */
+	if (hash_slots && futex_set_private_hash(hash_slots)) {
+		perror("prctl(PR_FUTEX_HASH)");
+		exit(1);
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].futexes = calloc(nfutexes, sizeof(u_int32_t));
+		if (!workers[i].futexes)
+			die("calloc");
+		if (pthread_create(&workers[i].thread, NULL,
+				   workerfn, &workers[i]))
+			die("pthread_create");
+	}
+
+	pthread_barrier_wait(&barrier);
+	gettimeofday(&start, NULL);
+	sleep(nsecs);
+	done = 1;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			die("pthread_join");
+		total += workers[i].ops;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads operating on %u %s futexes each, "
+		       "%s hash\n\n", nthreads, nfutexes,
+		       fshared ? "shared" : "private",
+		       hash_slots ? "private" : "global");
+		for (i = 0; i < nthreads; i++)
+			printf(" thread %3u: %14.0lf ops/sec\n",
+			       i, workers[i].ops / secs);
+		printf("\n %14s: %.0lf ops/sec\n", "Total",
+		       total / secs);
+		printf(" %14s: %.0lf ops/sec\n", "Per thread",
+		       total / secs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		free(workers[i].futexes);
+	free(workers);
+	pthread_barrier_destroy(&barrier);
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ *
+ * futex-wake.c
+ *
+ * wake: Benchmark for FUTEX_WAKE
+ *
+ * A number of threads block on one futex, then get woken up one at a
+ * time: the time it takes to wake them all up, the length of the hash
+ * chain walks and the bucket lock hold times show up in.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nwakes = 1;
+static unsigned int iterations = 10;
+static bool fshared;
+
+static u_int32_t futex1;
+static int opflags;
+static pthread_barrier_t barrier;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: online cpus)"),
+	OPT_UINTEGER('w', "nwakes", &nwakes,
+		     "Specify number of threads to wake up per FUTEX_WAKE"),
+	OPT_UINTEGER('i', "iterations", &iterations,
+		     "Specify number of iterations"),
+	OPT_BOOLEAN('s', "shared", &fshared,
+		    "Use a shared futex instead of a private one"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_usage[] = {
+	"perf bench futex wake <options>",
+	NULL
+};
+
+static void *waiterfn(void *arg __used)
+{
+	pthread_barrier_wait(&barrier);
+	/* -EAGAIN or -EINTR: only a wakeup lets the thread go */
+	while (futex_wait(&futex1, 0, NULL, opflags) && errno != EAGAIN)
+		;
+	return NULL;
+}
+
+int bench_futex_wake(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long total_usec = 0;
+	pthread_t *waiters;
+	unsigned int i, j, woken;
+	int ret;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_wake_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_wake_usage, options);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nwakes || !iterations)
+		usage_with_options(bench_futex_wake_usage, options);
+	opflags = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	waiters = calloc(nthreads, sizeof(*waiters));
+	if (!waiters)
+		die("calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u threads blocking on a %s futex, "
+		       "woken up %u at a time\n\n", nthreads,
+		       fshared ? "shared" : "private", nwakes);
+
+	for (j = 0; j < iterations; j++) {
+		pthread_barrier_init(&barrier, NULL, nthreads + 1);
+		for (i = 0; i < nthreads; i++)
+			if (pthread_create(&waiters[i], NULL, waiterfn, NULL))
+				die("pthread_create");
+		pthread_barrier_wait(&barrier);
+		/* let them get to block in the kernel */
+		usleep(100000);
+
+		gettimeofday(&start, NULL);
+		for (woken = 0; woken < nthreads; woken += ret) {
+			ret = futex_wake(&futex1, nwakes, opflags);
+			if (ret < 0) {
+				perror("futex_wake");
+				exit(1);
+			}
+		}
+		gettimeofday(&stop, NULL);
+		timersub(&stop, &start, &diff);
+		total_usec += diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf(" iteration %3u: woke %u threads in %lu.%03lu ms\n",
+			       j, nthreads,
+			       (unsigned long)(diff.tv_sec * 1000 +
+					       diff.tv_usec / 1000),
+			       (unsigned long)(diff.tv_usec % 1000));
+
+		for (i = 0; i < nthreads; i++)
+			if (pthread_join(waiters[i], NULL))
+				die("pthread_join");
+		pthread_barrier_destroy(&barrier);
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("\n %14s: %.3lf ms\n", "Average",
+		       (double)total_usec / iterations / 1000);
+		printf(" %14s: %.3lf usecs/thread\n", "Per wakeup",
+		       (double)total_usec / iterations / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.3lf\n", (double)total_usec / iterations / 1000);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(waiters);
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * futex.h
+ *
+ * Glue between the futex benchmarks and the futex(2) system call,
+ * which glibc does not wrap.
+ */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/prctl.h>
+#include <linux/futex.h>
+
+#ifndef PR_FUTEX_HASH
+#define PR_FUTEX_HASH			35
+#define PR_FUTEX_HASH_SET_SLOTS		1
+#define PR_FUTEX_HASH_GET_SLOTS		2
+#endif
+
+static inline int
+futex(u_int32_t *uaddr, int op, u_int32_t val, struct timespec *timeout,
+      u_int32_t *uaddr2, u_int32_t val3, int opflags)
+{
+	return syscall(SYS_futex, uaddr, op | opflags, val, timeout,
+		       uaddr2, val3);
+}
+
+/* Wait while *uaddr == val */
+static inline int
+futex_wait(u_int32_t *uaddr, u_int32_t val, struct timespec *timeout,
+	   int opflags)
+{
+	return futex(uaddr, FUTEX_WAIT, val, timeout, NULL, 0, opflags);
+}
+
+/* Wake up to nr_wake waiters on uaddr */
+static inline int
+futex_wake(u_int32_t *uaddr, int nr_wake, int opflags)
+{
+	return futex(uaddr, FUTEX_WAKE, nr_wake, NULL, NULL, 0, opflags);
+}
+
+/* Give the process a private futex hash of that many buckets, or not */
+static inline int futex_set_private_hash(unsigned int slots)
+{
+	return prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_SET_SLOTS, slots, 0, 0);
+}
+
+#endif /* _FUTEX_H */